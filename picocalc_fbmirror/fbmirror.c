@@ -0,0 +1,532 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Framebuffer mirror for the picocalc ILI9488 panel
+ * fbmirror.c: Frame loop, double-buffered submission and statistics.
+ *
+ * The main thread scans the source at the frame rate, merges changed tiles
+ * into rectangles and converts them into a free transfer buffer. The submit
+ * thread sends the other buffer meanwhile. With both buffers busy the main
+ * thread waits, so no damage is ever dropped. The frame rate follows the
+ * keyboard, see fbmirror_governor.c. SIGUSR1 prints the statistics, SIGINT
+ * and SIGTERM print them and exit.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fbmirror.h"
+
+struct fbm_pipeline
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct fbm_frame frames[2];
+	struct fbm_sink* sink;
+	struct fbm_governor* gov;
+
+	// Buffer index waiting for and on the wire, -1 for none
+	int queued;
+	int sending;
+	bool stop;
+	int error;
+
+	// Submit side, under lock
+	struct fbm_hist submit_hist;
+	struct fbm_hist latency_hist;
+	uint64_t wire_bytes;
+
+	// Frame side, main thread only
+	struct fbm_hist prepare_hist;
+	uint64_t scanned;
+	uint64_t sent;
+	uint64_t idle;
+	uint64_t late;
+	uint64_t stalls;
+	uint64_t rects;
+	uint64_t pixels;
+	uint64_t started_ns;
+};
+
+static volatile sig_atomic_t fbm_stop;
+static volatile sig_atomic_t fbm_report;
+
+uint64_t fbm_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void fbm_sleep_until_ns(uint64_t deadline)
+{
+	struct timespec ts = {
+		.tv_sec = deadline / 1000000000ull,
+		.tv_nsec = deadline % 1000000000ull,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+		if (fbm_stop) {
+			break;
+		}
+	}
+}
+
+void fbm_hist_add(struct fbm_hist* hist, uint64_t us)
+{
+	unsigned int bucket = us ? 64 - __builtin_clzll(us) : 0;
+
+	hist->bucket[(bucket < FBM_HIST_BUCKETS) ? bucket : FBM_HIST_BUCKETS - 1]++;
+	hist->count++;
+	hist->sum_us += us;
+	if (us > hist->max_us) {
+		hist->max_us = us;
+	}
+}
+
+void fbm_hist_print(struct fbm_hist const* hist, char const* name)
+{
+	uint64_t peak = 0;
+	unsigned int i;
+	char bar[41];
+	int len;
+
+	printf("%s: %llu frames, avg %llu us, max %llu us\n", name,
+		(unsigned long long)hist->count,
+		(unsigned long long)(hist->count ? hist->sum_us / hist->count : 0),
+		(unsigned long long)hist->max_us);
+
+	for (i = 0; i < FBM_HIST_BUCKETS; i++) {
+		if (hist->bucket[i] > peak) {
+			peak = hist->bucket[i];
+		}
+	}
+
+	// Bucket i holds durations below 2^i us
+	for (i = 0; i < FBM_HIST_BUCKETS; i++) {
+		if (!hist->bucket[i]) {
+			continue;
+		}
+		len = (int)((hist->bucket[i] * 40 + peak - 1) / peak);
+		memset(bar, '#', len);
+		bar[len] = '\0';
+		if (i < FBM_HIST_BUCKETS - 1) {
+			printf("  < %8llu us %10llu %s\n", 1ull << i,
+				(unsigned long long)hist->bucket[i], bar);
+		} else {
+			printf("  >=%8llu us %10llu %s\n", 1ull << (i - 1),
+				(unsigned long long)hist->bucket[i], bar);
+		}
+	}
+}
+
+static void fbm_print_stats(struct fbm_pipeline* pipe, struct fbm_diff const* diff)
+{
+	double secs = (fbm_now_ns() - pipe->started_ns) / 1e9;
+	uint64_t full = (uint64_t)diff->width * diff->height;
+
+	pthread_mutex_lock(&pipe->lock);
+	printf("frames %llu in %.1f s (%.1f fps): %llu sent, %llu unchanged, %llu late,"
+		" %llu waited for a buffer\n",
+		(unsigned long long)pipe->scanned, secs, pipe->scanned / secs,
+		(unsigned long long)pipe->sent, (unsigned long long)pipe->idle,
+		(unsigned long long)pipe->late, (unsigned long long)pipe->stalls);
+	printf("rects %.2f per frame sent, %llu bounding box fallbacks, pixels %.1f%%"
+		" of full frames\n",
+		pipe->sent ? (double)pipe->rects / pipe->sent : 0.0,
+		(unsigned long long)diff->fallbacks,
+		pipe->scanned ? 100.0 * pipe->pixels / (full * pipe->scanned) : 0.0);
+	printf("wire %llu bytes, %.2f MB/s, %.1f%% of sending every frame in full\n",
+		(unsigned long long)pipe->wire_bytes, pipe->wire_bytes / secs / 1e6,
+		pipe->scanned ? 100.0 * pipe->wire_bytes
+			/ (full * PIXCONV_BYTES_PER_PIXEL * pipe->scanned) : 0.0);
+	fbm_hist_print(&pipe->prepare_hist, "prepare (diff and convert)");
+	fbm_hist_print(&pipe->submit_hist, "submit (sink)");
+	fbm_hist_print(&pipe->latency_hist, "latency (scan to panel)");
+	fbm_governor_print(pipe->gov, fbm_now_ns());
+	pthread_mutex_unlock(&pipe->lock);
+	fflush(stdout);
+}
+
+static void* fbm_submit_thread(void* arg)
+{
+	struct fbm_pipeline* pipe = arg;
+	struct fbm_frame* frame;
+	uint64_t start, done, bytes;
+	int rc;
+
+	pthread_mutex_lock(&pipe->lock);
+	for (;;) {
+		while ((pipe->queued < 0) && !pipe->stop) {
+			pthread_cond_wait(&pipe->cond, &pipe->lock);
+		}
+		if (pipe->queued < 0) {
+			break;
+		}
+		pipe->sending = pipe->queued;
+		pipe->queued = -1;
+		frame = &pipe->frames[pipe->sending];
+		pthread_mutex_unlock(&pipe->lock);
+
+		bytes = pipe->sink->wire_bytes;
+		start = fbm_now_ns();
+		rc = fbm_sink_write(pipe->sink, frame);
+		done = fbm_now_ns();
+
+		pthread_mutex_lock(&pipe->lock);
+		fbm_hist_add(&pipe->submit_hist, (done - start) / 1000);
+		fbm_hist_add(&pipe->latency_hist, (done - frame->captured_ns) / 1000);
+		pipe->wire_bytes = pipe->sink->wire_bytes;
+		pipe->gov->sent[frame->tier]++;
+		pipe->gov->wire_bytes[frame->tier] += pipe->sink->wire_bytes - bytes;
+		pipe->sending = -1;
+		if (rc) {
+			pipe->error = rc;
+			pipe->stop = true;
+		}
+		pthread_cond_broadcast(&pipe->cond);
+	}
+	pthread_mutex_unlock(&pipe->lock);
+	return NULL;
+}
+
+// Convert the dirty rectangles into a free buffer and queue it
+static int fbm_submit_frame(struct fbm_pipeline* pipe, struct fbm_diff* diff,
+	enum pixconv_format format, struct fbm_options const* opts, uint64_t captured,
+	uint64_t scan_ns)
+{
+	struct fbm_frame* frame;
+	uint64_t start;
+	unsigned int i;
+	int idx;
+
+	// The previous frame must be on its way before this one is built, the
+	// buffer not being sent is then free
+	pthread_mutex_lock(&pipe->lock);
+	if (pipe->queued >= 0) {
+		pipe->stalls++;
+		while ((pipe->queued >= 0) && !pipe->stop) {
+			pthread_cond_wait(&pipe->cond, &pipe->lock);
+		}
+	}
+	if (pipe->stop) {
+		pthread_mutex_unlock(&pipe->lock);
+		return -1;
+	}
+	idx = (pipe->sending == 0) ? 1 : 0;
+	pthread_mutex_unlock(&pipe->lock);
+
+	start = fbm_now_ns();
+	frame = &pipe->frames[idx];
+	frame->count = fbm_diff_rects(diff, frame->rects, FBM_MAX_RECTS, opts->merge_gap);
+	frame->len = 0;
+	frame->captured_ns = captured;
+	frame->tier = pipe->gov->current;
+	for (i = 0; i < frame->count; i++) {
+
+		// The shadow holds exactly what was scanned, the source may have moved on
+		pixconv_convert(format, frame->pixels + frame->len, 0, diff->shadow,
+			diff->stride, &frame->rects[i]);
+		frame->len += (size_t)frame->rects[i].width * frame->rects[i].height
+			* PIXCONV_BYTES_PER_PIXEL;
+		pipe->pixels += (size_t)frame->rects[i].width * frame->rects[i].height;
+	}
+	pipe->rects += frame->count;
+	fbm_hist_add(&pipe->prepare_hist, (scan_ns + fbm_now_ns() - start) / 1000);
+
+	pthread_mutex_lock(&pipe->lock);
+	pipe->queued = idx;
+	pipe->sent++;
+	pthread_cond_broadcast(&pipe->cond);
+	pthread_mutex_unlock(&pipe->lock);
+	return 0;
+}
+
+static void fbm_signal(int sig)
+{
+	if (sig == SIGUSR1) {
+		fbm_report = 1;
+	} else {
+		fbm_stop = 1;
+	}
+}
+
+static void fbm_usage(char const* prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -s, --source SPEC      fb:/dev/fb0 (default), file:PATH:WxH:FORMAT,\n"
+		"                         synth:WxH:FORMAT:static|box|term|full\n"
+		"  -o, --sink SPEC        spidev[:/dev/spidev0.0] (default), file:PATH, null\n"
+		"  -r, --fps N            frames per second, 0 for as fast as possible (60)\n"
+		"  -n, --frames N         stop after N frames\n"
+		"  -t, --tile N           tile edge in pixels, 8 to 64 (16)\n"
+		"  -g, --merge-gap N      send up to N clean tiles to join two runs (1)\n"
+		"  -i, --stats N          print statistics every N seconds\n"
+		"      --spi-hz N         SPI clock (32000000)\n"
+		"      --gpiochip PATH    GPIO controller for DC and reset (/dev/gpiochip0)\n"
+		"      --dc-gpio N        DC line (24)\n"
+		"      --reset-gpio N     reset line, -1 for none (25)\n"
+		"      --rotate N         0, 90, 180 or 270 (0)\n"
+		"      --no-invert        panel glass is not inverted\n"
+		"      --no-init          skip reset and init, the panel is already set up\n"
+		"      --link-hz N        model an SPI clock on the file and null sinks\n"
+		"      --activity PATH    keyboard activity, none for a fixed rate\n"
+		"                         (/sys/firmware/picocalc/last_keypress)\n"
+		"      --idle MS:FPS      after MS without a key drop to FPS, 0 pauses until\n"
+		"                         the next key, repeat for more tiers\n"
+		"                         (5000:20 30000:5 300000:1)\n",
+		prog);
+}
+
+int main(int argc, char** argv)
+{
+	enum {
+		OPT_SPI_HZ = 256,
+		OPT_GPIOCHIP,
+		OPT_DC_GPIO,
+		OPT_RESET_GPIO,
+		OPT_ROTATE,
+		OPT_NO_INVERT,
+		OPT_NO_INIT,
+		OPT_LINK_HZ,
+		OPT_ACTIVITY,
+		OPT_IDLE,
+	};
+	static struct option const long_opts[] = {
+		{ "source", required_argument, NULL, 's' },
+		{ "sink", required_argument, NULL, 'o' },
+		{ "fps", required_argument, NULL, 'r' },
+		{ "frames", required_argument, NULL, 'n' },
+		{ "tile", required_argument, NULL, 't' },
+		{ "merge-gap", required_argument, NULL, 'g' },
+		{ "stats", required_argument, NULL, 'i' },
+		{ "spi-hz", required_argument, NULL, OPT_SPI_HZ },
+		{ "gpiochip", required_argument, NULL, OPT_GPIOCHIP },
+		{ "dc-gpio", required_argument, NULL, OPT_DC_GPIO },
+		{ "reset-gpio", required_argument, NULL, OPT_RESET_GPIO },
+		{ "rotate", required_argument, NULL, OPT_ROTATE },
+		{ "no-invert", no_argument, NULL, OPT_NO_INVERT },
+		{ "no-init", no_argument, NULL, OPT_NO_INIT },
+		{ "link-hz", required_argument, NULL, OPT_LINK_HZ },
+		{ "activity", required_argument, NULL, OPT_ACTIVITY },
+		{ "idle", required_argument, NULL, OPT_IDLE },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	struct fbm_options opts = {
+		.fps = 60,
+		.tile = 16,
+		.merge_gap = 1,
+		.spi_hz = 32000000,
+		.gpiochip = "/dev/gpiochip0",
+		.dc_gpio = 24,
+		.reset_gpio = 25,
+		.invert = true,
+		.init = true,
+		.activity = "/sys/firmware/picocalc/last_keypress",
+	};
+	static struct fbm_gov_tier const default_idle[] = {
+		{ 5000000000ull, 1000000000ull / 20 },
+		{ 30000000000ull, 1000000000ull / 5 },
+		{ 300000000000ull, 1000000000ull },
+	};
+	char const* source_spec = "fb:/dev/fb0";
+	char const* sink_spec = "spidev";
+	struct fbm_pipeline pipe = { .queued = -1, .sending = -1 };
+	struct fbm_source src;
+	struct fbm_sink sink;
+	struct fbm_diff diff;
+	struct fbm_governor gov;
+	struct sigaction sa;
+	sigset_t mask, old;
+	pthread_t thread;
+	uint64_t period, next, now, deadline, report_at = 0, captured, scan_start;
+	unsigned long long idle_ms;
+	unsigned int width, height;
+	double idle_fps;
+	int c, rc = 1;
+	bool due;
+
+	while ((c = getopt_long(argc, argv, "s:o:r:n:t:g:i:h", long_opts, NULL)) != -1) {
+		switch (c) {
+		case 's': source_spec = optarg; break;
+		case 'o': sink_spec = optarg; break;
+		case 'r': opts.fps = strtoul(optarg, NULL, 0); break;
+		case 'n': opts.frames = strtoull(optarg, NULL, 0); break;
+		case 't': opts.tile = strtoul(optarg, NULL, 0); break;
+		case 'g': opts.merge_gap = strtoul(optarg, NULL, 0); break;
+		case 'i': opts.stats_interval = strtoul(optarg, NULL, 0); break;
+		case OPT_SPI_HZ: opts.spi_hz = strtoul(optarg, NULL, 0); break;
+		case OPT_GPIOCHIP: opts.gpiochip = optarg; break;
+		case OPT_DC_GPIO: opts.dc_gpio = strtol(optarg, NULL, 0); break;
+		case OPT_RESET_GPIO: opts.reset_gpio = strtol(optarg, NULL, 0); break;
+		case OPT_ROTATE: opts.rotation = strtoul(optarg, NULL, 0); break;
+		case OPT_NO_INVERT: opts.invert = false; break;
+		case OPT_NO_INIT: opts.init = false; break;
+		case OPT_LINK_HZ: opts.link_hz = strtoul(optarg, NULL, 0); break;
+		case OPT_ACTIVITY: opts.activity = optarg; break;
+		case OPT_IDLE:
+			if ((sscanf(optarg, "%llu:%lf", &idle_ms, &idle_fps) != 2) || (idle_fps < 0)
+			 || (opts.idle_tiers == FBM_GOV_TIERS - 1) || (opts.idle_tiers
+				&& (idle_ms * 1000000ull <= opts.idle[opts.idle_tiers - 1].after_ns))) {
+				fprintf(stderr, "--idle MS:FPS, at most %u, MS rising\n", FBM_GOV_TIERS - 1);
+				return 2;
+			}
+			opts.idle[opts.idle_tiers].after_ns = idle_ms * 1000000ull;
+			opts.idle[opts.idle_tiers].period_ns = (idle_fps > 0)
+				? (uint64_t)(1e9 / idle_fps) : FBM_GOV_PAUSED;
+			opts.idle_tiers++;
+			break;
+		default:
+			fbm_usage(argv[0]);
+			return (c == 'h') ? 0 : 2;
+		}
+	}
+	if ((opts.tile < 8) || (opts.tile > 64)) {
+		fprintf(stderr, "tile must be 8 to 64 pixels\n");
+		return 2;
+	}
+	if (!opts.idle_tiers) {
+		memcpy(opts.idle, default_idle, sizeof(default_idle));
+		opts.idle_tiers = sizeof(default_idle) / sizeof(default_idle[0]);
+	}
+
+	if (fbm_source_open(&src, source_spec)) {
+		return 1;
+	}
+
+	// A larger source is cropped to the panel
+	width = (src.width < FBM_PANEL_WIDTH) ? src.width : FBM_PANEL_WIDTH;
+	height = (src.height < FBM_PANEL_HEIGHT) ? src.height : FBM_PANEL_HEIGHT;
+	if (fbm_diff_init(&diff, width, height, opts.tile, src.format)) {
+		fprintf(stderr, "out of memory\n");
+		goto out_source;
+	}
+
+	// Worst case is every pixel of the frame, in either buffer
+	pipe.frames[0].pixels = malloc((size_t)width * height * PIXCONV_BYTES_PER_PIXEL);
+	pipe.frames[1].pixels = malloc((size_t)width * height * PIXCONV_BYTES_PER_PIXEL);
+	if (!pipe.frames[0].pixels || !pipe.frames[1].pixels) {
+		fprintf(stderr, "out of memory\n");
+		goto out_buffers;
+	}
+
+	if (fbm_sink_open(&sink, sink_spec, &opts)) {
+		goto out_buffers;
+	}
+	if (opts.init && fbm_sink_init_panel(&sink)) {
+		fprintf(stderr, "panel init failed\n");
+		goto out_sink;
+	}
+	pipe.sink = &sink;
+	fbm_governor_init(&gov, &opts);
+	pipe.gov = &gov;
+
+	fprintf(stderr, "%s %ux%u %s -> %s, %u px tiles, pixconv %s\n", source_spec,
+		width, height, (src.format == PIXCONV_RGB565) ? "rgb565" : "xrgb8888",
+		sink_spec, opts.tile, pixconv_active()->name);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = fbm_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGUSR1, &sa, NULL);
+
+	// Signals go to the frame loop, never to the submit thread
+	pthread_mutex_init(&pipe.lock, NULL);
+	pthread_cond_init(&pipe.cond, NULL);
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &old);
+	if (pthread_create(&thread, NULL, fbm_submit_thread, &pipe)) {
+		fprintf(stderr, "cannot start the submit thread\n");
+		goto out_sink;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	pipe.started_ns = next = fbm_now_ns();
+	period = gov.tier[0].period_ns;
+	if (opts.stats_interval) {
+		report_at = pipe.started_ns + opts.stats_interval * 1000000000ull;
+	}
+
+	while (!fbm_stop && (!opts.frames || (pipe.scanned < opts.frames))) {
+		now = fbm_now_ns();
+		due = true;
+		if (period) {
+
+			// Statistics stay due while the panel is paused
+			deadline = (report_at && (report_at < next)) ? report_at : next;
+			if (fbm_governor_wait(&gov, deadline)) {
+				next = fbm_now_ns();
+			}
+			now = fbm_now_ns();
+			due = (now >= next);
+		}
+
+		if (due && !fbm_stop) {
+			period = fbm_governor_update(&gov, now);
+			if (period == FBM_GOV_PAUSED) {
+				next = FBM_GOV_PAUSED;
+			} else if (period) {
+				next += period;
+
+				// Behind by more than a frame, drop the backlog rather than catch up
+				if (now > next) {
+					pipe.late++;
+					next = now + period;
+				}
+			}
+
+			captured = fbm_now_ns();
+			if (src.update) {
+				src.update(&src, pipe.scanned);
+			}
+			pipe.scanned++;
+			gov.scans[gov.current]++;
+
+			scan_start = fbm_now_ns();
+			if (!fbm_diff_scan(&diff, src.pixels, src.stride)) {
+				pipe.idle++;
+			} else if (fbm_submit_frame(&pipe, &diff, src.format, &opts, captured,
+				fbm_now_ns() - scan_start)) {
+				break;
+			}
+		}
+
+		if (fbm_report || (report_at && (fbm_now_ns() >= report_at))) {
+			fbm_report = 0;
+			if (report_at) {
+				report_at += opts.stats_interval * 1000000000ull;
+			}
+			fbm_print_stats(&pipe, &diff);
+		}
+	}
+
+	// Let the last frames reach the sink
+	pthread_mutex_lock(&pipe.lock);
+	pipe.stop = true;
+	pthread_cond_broadcast(&pipe.cond);
+	pthread_mutex_unlock(&pipe.lock);
+	pthread_join(thread, NULL);
+
+	fbm_print_stats(&pipe, &diff);
+	rc = pipe.error ? 1 : 0;
+
+	fbm_governor_close(&gov);
+out_sink:
+	fbm_sink_close(&sink);
+out_buffers:
+	free(pipe.frames[0].pixels);
+	free(pipe.frames[1].pixels);
+	fbm_diff_free(&diff);
+out_source:
+	src.close(&src);
+	return rc;
+}
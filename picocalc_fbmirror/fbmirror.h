@@ -0,0 +1,215 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Framebuffer mirror for the picocalc ILI9488 panel
+ * fbmirror.h: Sources, tile diffing, sinks and statistics shared by the daemon.
+ *
+ * A frame goes source -> tile diff against a shadow copy -> span rectangles ->
+ * pixconv into one of two transfer buffers -> sink. The sink runs on its own
+ * thread, so one buffer is converted while the other is on the wire. Every
+ * buffer is allocated at startup, nothing is allocated per frame.
+ */
+
+#ifndef FBMIRROR_H_
+#define FBMIRROR_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pixconv.h"
+
+// Visible panel and the ILI9488 frame memory behind it
+#define FBM_PANEL_WIDTH		320
+#define FBM_PANEL_HEIGHT	320
+#define FBM_NATIVE_HEIGHT	480
+
+// Rectangles per frame before falling back to the bounding box
+#define FBM_MAX_RECTS		64
+
+// Log2 microsecond buckets, the last one collects everything above ~1 s
+#define FBM_HIST_BUCKETS	21
+
+// Refresh tiers, the full rate plus up to 7 idle steps
+#define FBM_GOV_TIERS		8
+
+// Tier period meaning no scans until the next keypress
+#define FBM_GOV_PAUSED		UINT64_MAX
+
+struct fbm_gov_tier
+{
+	uint64_t after_ns;
+	uint64_t period_ns;
+};
+
+struct fbm_options
+{
+	unsigned int fps;
+	uint64_t frames;
+	unsigned int tile;
+	unsigned int merge_gap;
+	unsigned int stats_interval;
+
+	// Panel wiring, used by the spidev sink
+	uint32_t spi_hz;
+	char const* gpiochip;
+	int dc_gpio;
+	int reset_gpio;
+	unsigned int rotation;
+	bool invert;
+	bool init;
+
+	// Modelled SPI clock for the file and null sinks, 0 to run flat out
+	uint32_t link_hz;
+
+	// Keyboard activity file and the idle tiers after the full rate
+	char const* activity;
+	struct fbm_gov_tier idle[FBM_GOV_TIERS - 1];
+	unsigned int idle_tiers;
+};
+
+// Source framebuffer, mapped or generated
+struct fbm_source
+{
+	char const* name;
+	enum pixconv_format format;
+	unsigned int width;
+	unsigned int height;
+	size_t stride;
+	uint8_t const* pixels;
+
+	// Called before each scan, synthetic sources draw their next frame here
+	void (*update)(struct fbm_source* src, uint64_t frame);
+	void (*close)(struct fbm_source* src);
+	void* priv;
+};
+
+int fbm_source_open(struct fbm_source* src, char const* spec);
+
+// Converted rectangles of one frame, back to back in pixels
+struct fbm_frame
+{
+	struct pixconv_rect rects[FBM_MAX_RECTS];
+	unsigned int count;
+	uint8_t* pixels;
+	size_t len;
+	uint64_t captured_ns;
+	unsigned int tier;
+};
+
+// Tile diff against the last frame sent
+struct fbm_diff
+{
+	unsigned int width;
+	unsigned int height;
+	unsigned int tile;
+	unsigned int tiles_x;
+	unsigned int tiles_y;
+	unsigned int bpp;
+	bool primed;
+
+	// Copy of what the panel shows, in the source format
+	uint8_t* shadow;
+	size_t stride;
+
+	uint8_t* dirty;
+
+	// Frames with more rectangles than fit, sent as their bounding box
+	uint64_t fallbacks;
+};
+
+int fbm_diff_init(struct fbm_diff* diff, unsigned int width, unsigned int height,
+	unsigned int tile, enum pixconv_format format);
+void fbm_diff_free(struct fbm_diff* diff);
+
+// Compare src with the shadow, copy changed tiles into it, return how many
+unsigned int fbm_diff_scan(struct fbm_diff* diff, uint8_t const* src, size_t stride);
+
+// Merge dirty tiles into at most max rectangles, clean gaps of up to
+// merge_gap tiles between two runs are sent rather than split
+unsigned int fbm_diff_rects(struct fbm_diff* diff, struct pixconv_rect* rects,
+	unsigned int max, unsigned int merge_gap);
+
+struct fbm_sink;
+
+struct fbm_sink_ops
+{
+	char const* name;
+	int (*open)(struct fbm_sink* sink, char const* arg);
+
+	// One panel command with its parameters or pixel data
+	int (*command)(struct fbm_sink* sink, uint8_t cmd, uint8_t const* data, size_t len);
+	void (*close)(struct fbm_sink* sink);
+};
+
+struct fbm_sink
+{
+	struct fbm_sink_ops const* ops;
+	struct fbm_options const* opts;
+
+	// Address mode and frame memory offset for the rotation
+	uint8_t madctl;
+	unsigned int x_offset;
+	unsigned int y_offset;
+
+	// Bytes on the wire including command overhead
+	uint64_t wire_bytes;
+	uint64_t link_deadline_ns;
+	void* priv;
+};
+
+int fbm_sink_open(struct fbm_sink* sink, char const* spec, struct fbm_options const* opts);
+int fbm_sink_init_panel(struct fbm_sink* sink);
+int fbm_sink_write(struct fbm_sink* sink, struct fbm_frame const* frame);
+void fbm_sink_close(struct fbm_sink* sink);
+
+extern struct fbm_sink_ops const fbm_sink_null;
+extern struct fbm_sink_ops const fbm_sink_file;
+extern struct fbm_sink_ops const fbm_sink_spidev;
+
+// Refresh governor: full rate while keys are pressed, slower tiers as the
+// keyboard stays idle, back to full rate on the next keypress
+struct fbm_governor
+{
+	int fd;
+	bool fifo;
+	struct fbm_gov_tier tier[FBM_GOV_TIERS];
+	unsigned int tiers;
+	unsigned int current;
+	uint64_t keypress_ns;
+	uint64_t tier_since_ns;
+
+	uint64_t time_ns[FBM_GOV_TIERS];
+	uint64_t scans[FBM_GOV_TIERS];
+	uint64_t keypresses;
+	uint64_t changes;
+
+	// Written by the submit thread under the pipeline lock
+	uint64_t sent[FBM_GOV_TIERS];
+	uint64_t wire_bytes[FBM_GOV_TIERS];
+};
+
+int fbm_governor_init(struct fbm_governor* gov, struct fbm_options const* opts);
+void fbm_governor_close(struct fbm_governor* gov);
+
+// Pick the tier for the idle time at now, returns its frame period
+uint64_t fbm_governor_update(struct fbm_governor* gov, uint64_t now);
+
+// Sleep until deadline or a keypress, returns true for a keypress
+bool fbm_governor_wait(struct fbm_governor* gov, uint64_t deadline);
+void fbm_governor_print(struct fbm_governor* gov, uint64_t now);
+
+struct fbm_hist
+{
+	uint64_t bucket[FBM_HIST_BUCKETS];
+	uint64_t count;
+	uint64_t sum_us;
+	uint64_t max_us;
+};
+
+void fbm_hist_add(struct fbm_hist* hist, uint64_t us);
+void fbm_hist_print(struct fbm_hist const* hist, char const* name);
+
+uint64_t fbm_now_ns(void);
+void fbm_sleep_until_ns(uint64_t deadline);
+
+#endif
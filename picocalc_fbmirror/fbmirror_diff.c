@@ -0,0 +1,192 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Framebuffer mirror for the picocalc ILI9488 panel
+ * fbmirror_diff.c: Tile diffing against a shadow frame and span merging.
+ *
+ * The scan walks the source once, row by row, so both buffers stream through
+ * the cache in address order. Unchanged rows cost one memcmp, which libc
+ * vectorizes. Only rows that differ are split per tile, and only the tiles
+ * that changed are copied into the shadow.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fbmirror.h"
+
+int fbm_diff_init(struct fbm_diff* diff, unsigned int width, unsigned int height,
+	unsigned int tile, enum pixconv_format format)
+{
+	memset(diff, 0, sizeof(*diff));
+	diff->width = width;
+	diff->height = height;
+	diff->tile = tile;
+	diff->tiles_x = (width + tile - 1) / tile;
+	diff->tiles_y = (height + tile - 1) / tile;
+	diff->bpp = pixconv_format_bpp(format);
+	diff->stride = (size_t)width * diff->bpp;
+
+	diff->shadow = calloc(height, diff->stride);
+	diff->dirty = calloc(diff->tiles_y, diff->tiles_x);
+	if (!diff->shadow || !diff->dirty) {
+		fbm_diff_free(diff);
+		return -1;
+	}
+	return 0;
+}
+
+void fbm_diff_free(struct fbm_diff* diff)
+{
+	free(diff->shadow);
+	free(diff->dirty);
+	diff->shadow = NULL;
+	diff->dirty = NULL;
+}
+
+unsigned int fbm_diff_scan(struct fbm_diff* diff, uint8_t const* src, size_t stride)
+{
+	size_t tile_bytes = (size_t)diff->tile * diff->bpp;
+	size_t row_bytes = diff->stride;
+	unsigned int x, y, tx, ty, count = 0;
+	uint8_t const* s;
+	uint8_t* shadow;
+	uint8_t* dirty;
+	size_t off, len;
+
+	memset(diff->dirty, 0, (size_t)diff->tiles_x * diff->tiles_y);
+
+	// Panel contents are unknown until the first full frame
+	if (!diff->primed) {
+		for (y = 0; y < diff->height; y++) {
+			memcpy(diff->shadow + y * row_bytes, src + y * stride, row_bytes);
+		}
+		memset(diff->dirty, 1, (size_t)diff->tiles_x * diff->tiles_y);
+		diff->primed = true;
+		return diff->tiles_x * diff->tiles_y;
+	}
+
+	for (y = 0; y < diff->height; y++) {
+		s = src + y * stride;
+		shadow = diff->shadow + y * row_bytes;
+		if (!memcmp(s, shadow, row_bytes)) {
+			continue;
+		}
+
+		ty = y / diff->tile;
+		dirty = diff->dirty + (size_t)ty * diff->tiles_x;
+		for (tx = 0, x = 0; tx < diff->tiles_x; tx++, x += diff->tile) {
+			off = (size_t)x * diff->bpp;
+			len = (off + tile_bytes <= row_bytes) ? tile_bytes : row_bytes - off;
+			if (memcmp(s + off, shadow + off, len)) {
+				memcpy(shadow + off, s + off, len);
+				if (!dirty[tx]) {
+					dirty[tx] = 1;
+					count++;
+				}
+			}
+		}
+	}
+
+	return count;
+}
+
+// Tile span to pixels, edge tiles clipped to the frame
+static void fbm_diff_to_pixels(struct fbm_diff const* diff, struct pixconv_rect* rect)
+{
+	unsigned int x2 = (rect->x + rect->width) * diff->tile;
+	unsigned int y2 = (rect->y + rect->height) * diff->tile;
+
+	rect->x *= diff->tile;
+	rect->y *= diff->tile;
+	rect->width = ((x2 < diff->width) ? x2 : diff->width) - rect->x;
+	rect->height = ((y2 < diff->height) ? y2 : diff->height) - rect->y;
+}
+
+unsigned int fbm_diff_rects(struct fbm_diff* diff, struct pixconv_rect* rects,
+	unsigned int max, unsigned int merge_gap)
+{
+	unsigned int tx, ty, x0, x1, gap, n, i, count = 0, prev_first = 0, row_first;
+	unsigned int bx0 = diff->tiles_x, bx1 = 0, by0 = diff->tiles_y, by1 = 0;
+	uint8_t const* dirty;
+	bool overflow = false;
+
+	for (ty = 0; ty < diff->tiles_y; ty++) {
+		dirty = diff->dirty + (size_t)ty * diff->tiles_x;
+		row_first = count;
+
+		for (tx = 0; tx < diff->tiles_x; ) {
+			if (!dirty[tx]) {
+				tx++;
+				continue;
+			}
+
+			// Run of dirty tiles, bridging short clean gaps
+			x0 = tx;
+			x1 = ++tx;
+			for (gap = 0; tx < diff->tiles_x; tx++) {
+				if (dirty[tx]) {
+					x1 = tx + 1;
+					gap = 0;
+				} else if (++gap > merge_gap) {
+					break;
+				}
+			}
+			tx = x1;
+
+			if (x0 < bx0) bx0 = x0;
+			if (x1 > bx1) bx1 = x1;
+			if (ty < by0) by0 = ty;
+			by1 = ty + 1;
+
+			if (overflow) {
+				continue;
+			}
+
+			// Same span as a rectangle ending on the row above grows it
+			for (i = prev_first; i < row_first; i++) {
+				if ((rects[i].x == x0) && (rects[i].width == x1 - x0)
+				 && (rects[i].y + rects[i].height == ty)) {
+					rects[i].height++;
+					break;
+				}
+			}
+			if (i < row_first) {
+				continue;
+			}
+
+			if (count == max) {
+				overflow = true;
+				continue;
+			}
+			rects[count++] = (struct pixconv_rect){ x0, ty, x1 - x0, 1 };
+		}
+
+		// Rectangles that did not grow on this row are closed for good. They
+		// move in front, the grown and the new ones after them stay candidates
+		n = prev_first;
+		for (i = prev_first; i < row_first; i++) {
+			if (rects[i].y + rects[i].height != ty + 1) {
+				struct pixconv_rect keep = rects[i];
+
+				memmove(&rects[n + 1], &rects[n], (i - n) * sizeof(*rects));
+				rects[n++] = keep;
+			}
+		}
+		prev_first = n;
+	}
+
+	if (!bx1) {
+		return 0;
+	}
+
+	if (overflow) {
+		diff->fallbacks++;
+		rects[0] = (struct pixconv_rect){ bx0, by0, bx1 - bx0, by1 - by0 };
+		count = 1;
+	}
+
+	for (i = 0; i < count; i++) {
+		fbm_diff_to_pixels(diff, &rects[i]);
+	}
+	return count;
+}
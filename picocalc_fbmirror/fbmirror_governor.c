@@ -0,0 +1,192 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Framebuffer mirror for the picocalc ILI9488 panel
+ * fbmirror_governor.c: Refresh rate governor driven by keyboard activity.
+ *
+ * The keyboard driver notifies /sys/firmware/picocalc/last_keypress after
+ * every drain that saw a key, so the frame loop sleeps in ppoll() on it
+ * instead of a plain timer. The file is only read when it fires or at
+ * startup. The idle tiers slow the scan rate as the keyboard stays idle,
+ * down to no scans at all for a tier rate of 0. A keypress wakes the loop at
+ * once and puts it back at the full rate.
+ *
+ * For testing, the activity file may also be a FIFO. Anything written to it
+ * counts as a keypress.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fbmirror.h"
+
+static void fbm_governor_read(struct fbm_governor* gov, uint64_t now)
+{
+	char buf[32];
+	long long ms;
+	ssize_t n;
+
+	if (gov->fifo) {
+		while (read(gov->fd, buf, sizeof(buf)) > 0) {
+		}
+		gov->keypress_ns = now;
+		return;
+	}
+
+	// Reading from the start also rearms the sysfs notification
+	n = pread(gov->fd, buf, sizeof(buf) - 1, 0);
+	if (n <= 0) {
+		return;
+	}
+	buf[n] = '\0';
+
+	// Milliseconds since the last key, -1 while a key is being reported
+	ms = strtoll(buf, NULL, 10);
+	ms = (ms < 0) ? 0 : ms;
+	gov->keypress_ns = (now > (uint64_t)ms * 1000000ull) ? now - (uint64_t)ms * 1000000ull : 0;
+}
+
+int fbm_governor_init(struct fbm_governor* gov, struct fbm_options const* opts)
+{
+	struct stat st;
+	unsigned int i;
+	uint64_t now = fbm_now_ns();
+
+	memset(gov, 0, sizeof(*gov));
+	gov->fd = -1;
+	gov->tier[0].period_ns = opts->fps ? 1000000000ull / opts->fps : 0;
+	gov->tiers = 1;
+	gov->keypress_ns = now;
+	gov->tier_since_ns = now;
+
+	// Flat out runs are benchmarks, they keep the full rate
+	if (!opts->fps || !opts->activity || !strcmp(opts->activity, "none")) {
+		return 0;
+	}
+
+	if (!stat(opts->activity, &st) && S_ISFIFO(st.st_mode)) {
+		gov->fifo = true;
+		gov->fd = open(opts->activity, O_RDWR | O_NONBLOCK);
+	} else {
+		gov->fd = open(opts->activity, O_RDONLY);
+	}
+	if (gov->fd < 0) {
+		fprintf(stderr, "%s: %s, refresh stays at the full rate\n", opts->activity,
+			strerror(errno));
+		return 0;
+	}
+
+	for (i = 0; i < opts->idle_tiers; i++) {
+		gov->tier[gov->tiers++] = opts->idle[i];
+	}
+	fbm_governor_read(gov, now);
+	return 0;
+}
+
+void fbm_governor_close(struct fbm_governor* gov)
+{
+	if (gov->fd >= 0) {
+		close(gov->fd);
+	}
+	gov->fd = -1;
+}
+
+uint64_t fbm_governor_update(struct fbm_governor* gov, uint64_t now)
+{
+	uint64_t idle = (now > gov->keypress_ns) ? now - gov->keypress_ns : 0;
+	unsigned int i, tier = 0;
+
+	for (i = 1; i < gov->tiers; i++) {
+		if (idle >= gov->tier[i].after_ns) {
+			tier = i;
+		}
+	}
+
+	if (tier != gov->current) {
+		gov->time_ns[gov->current] += now - gov->tier_since_ns;
+		gov->tier_since_ns = now;
+		gov->current = tier;
+		gov->changes++;
+	}
+	return gov->tier[tier].period_ns;
+}
+
+bool fbm_governor_wait(struct fbm_governor* gov, uint64_t deadline)
+{
+	struct pollfd pfd = {
+		.fd = gov->fd,
+		.events = gov->fifo ? POLLIN : POLLPRI,
+	};
+	uint64_t now = fbm_now_ns();
+	struct timespec ts;
+
+	if (gov->fd < 0) {
+		fbm_sleep_until_ns(deadline);
+		return false;
+	}
+	if (deadline <= now) {
+		return false;
+	}
+
+	ts.tv_sec = (deadline - now) / 1000000000ull;
+	ts.tv_nsec = (deadline - now) % 1000000000ull;
+	if (ppoll(&pfd, 1, (deadline == FBM_GOV_PAUSED) ? NULL : &ts, NULL) <= 0) {
+		return false;
+	}
+	if (!(pfd.revents & (POLLPRI | POLLIN | POLLERR))) {
+		return false;
+	}
+
+	fbm_governor_read(gov, fbm_now_ns());
+	gov->keypresses++;
+	return true;
+}
+
+void fbm_governor_print(struct fbm_governor* gov, uint64_t now)
+{
+	uint64_t time_ns, full_scans, skipped = 0, idle_scans = 0, idle_bytes = 0;
+	double full_rate;
+	unsigned int i;
+	char rate[16];
+
+	if (gov->tiers < 2) {
+		return;
+	}
+	full_rate = gov->tier[0].period_ns ? 1e9 / gov->tier[0].period_ns : 0;
+
+	printf("governor: %llu keypress wakeups, %llu tier changes, tier %u now\n",
+		(unsigned long long)gov->keypresses, (unsigned long long)gov->changes,
+		gov->current);
+	printf("  tier       rate  after s   time s    scans     sent   wire bytes\n");
+	for (i = 0; i < gov->tiers; i++) {
+		time_ns = gov->time_ns[i] + ((i == gov->current) ? now - gov->tier_since_ns : 0);
+		if (gov->tier[i].period_ns == FBM_GOV_PAUSED) {
+			snprintf(rate, sizeof(rate), "paused");
+		} else {
+			snprintf(rate, sizeof(rate), "%.1f fps", 1e9 / gov->tier[i].period_ns);
+		}
+		printf("  %4u %10s %8.1f %8.1f %8llu %8llu %12llu\n", i, rate,
+			gov->tier[i].after_ns / 1e9, time_ns / 1e9,
+			(unsigned long long)gov->scans[i], (unsigned long long)gov->sent[i],
+			(unsigned long long)gov->wire_bytes[i]);
+
+		if (i) {
+			full_scans = (uint64_t)(time_ns / 1e9 * full_rate);
+			skipped += (full_scans > gov->scans[i]) ? full_scans - gov->scans[i] : 0;
+			idle_scans += gov->scans[i];
+			idle_bytes += gov->wire_bytes[i];
+		}
+	}
+
+	// Skipped scans priced at what the idle scans actually cost
+	printf("  idle tiers skipped %llu scans, about %llu SPI bytes saved\n",
+		(unsigned long long)skipped,
+		(unsigned long long)(idle_scans ? skipped * idle_bytes / idle_scans : 0));
+}
@@ -0,0 +1,372 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Framebuffer mirror for the picocalc ILI9488 panel
+ * fbmirror_sink.c: Panel command stream and the null and file sinks.
+ *
+ * Every sink sees the same ILI9488 commands: the init sequence once, then a
+ * CASET/PASET window and a RAMWR of packed RGB666 per rectangle. Pixel data is
+ * handed over straight from the transfer buffer, sinks must not copy it to
+ * stage a transfer.
+ *
+ * spidev:/dev/spidev0.0   the panel, DC and reset driven through gpiochip
+ * file:PATH               fake panel, frame memory kept in PATH as raw RGB666
+ * null                    discard, for measuring the pipeline alone
+ *
+ * The file sink models the panel's addressing: PATH holds 320 columns by 480
+ * pages of 3 bytes (480 by 320 for the 90/270 rotations), and RAMWR fills the
+ * last window left to right, top to bottom. Writes outside it are counted as
+ * protocol errors.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "fbmirror.h"
+
+// DCS and ILI9488 commands
+#define ILI9488_CMD_EXIT_SLEEP			0x11
+#define ILI9488_CMD_EXIT_INVERT			0x20
+#define ILI9488_CMD_ENTER_INVERT		0x21
+#define ILI9488_CMD_DISPLAY_ON			0x29
+#define ILI9488_CMD_COLUMN_ADDRESS		0x2a
+#define ILI9488_CMD_PAGE_ADDRESS		0x2b
+#define ILI9488_CMD_MEMORY_WRITE		0x2c
+#define ILI9488_CMD_ADDRESS_MODE		0x36
+#define ILI9488_CMD_PIXEL_FORMAT		0x3a
+#define ILI9488_CMD_INTERFACE_MODE		0xb0
+#define ILI9488_CMD_FRAME_RATE			0xb1
+#define ILI9488_CMD_INVERSION			0xb4
+#define ILI9488_CMD_FUNCTION_CONTROL	0xb6
+#define ILI9488_CMD_ENTRY_MODE			0xb7
+#define ILI9488_CMD_POWER_CONTROL_1		0xc0
+#define ILI9488_CMD_POWER_CONTROL_2		0xc1
+#define ILI9488_CMD_VCOM_CONTROL		0xc5
+#define ILI9488_CMD_POSITIVE_GAMMA		0xe0
+#define ILI9488_CMD_NEGATIVE_GAMMA		0xe1
+#define ILI9488_CMD_ADJUST_CONTROL_3	0xf7
+
+#define ILI9488_MADCTL_BGR		(1 << 3)
+#define ILI9488_MADCTL_MV		(1 << 5)
+#define ILI9488_MADCTL_MX		(1 << 6)
+#define ILI9488_MADCTL_MY		(1 << 7)
+
+#define ILI9488_PIXEL_FORMAT_18BIT	0x66
+
+static struct fbm_sink_ops const* const fbm_sinks[] = {
+	&fbm_sink_spidev,
+	&fbm_sink_file,
+	&fbm_sink_null,
+};
+
+static int fbm_sink_command(struct fbm_sink* sink, uint8_t cmd, uint8_t const* data, size_t len)
+{
+	sink->wire_bytes += 1 + len;
+	return sink->ops->command(sink, cmd, data, len);
+}
+
+#define fbm_sink_command_bytes(sink, cmd, ...) ({ \
+	static uint8_t const d[] = { __VA_ARGS__ }; \
+	fbm_sink_command(sink, cmd, d, sizeof(d)); \
+})
+
+// Address mode and frame memory offset, as the kernel driver sets them
+static void fbm_sink_set_rotation(struct fbm_sink* sink, unsigned int rotation)
+{
+	unsigned int hidden = FBM_NATIVE_HEIGHT - FBM_PANEL_HEIGHT;
+
+	sink->x_offset = 0;
+	sink->y_offset = 0;
+	switch (rotation) {
+	case 90:
+		sink->madctl = ILI9488_MADCTL_MV;
+		break;
+	case 180:
+		sink->madctl = ILI9488_MADCTL_MY;
+		sink->y_offset = hidden;
+		break;
+	case 270:
+		sink->madctl = ILI9488_MADCTL_MV | ILI9488_MADCTL_MY | ILI9488_MADCTL_MX;
+		sink->x_offset = hidden;
+		break;
+	default:
+		sink->madctl = ILI9488_MADCTL_MX;
+		break;
+	}
+	sink->madctl |= ILI9488_MADCTL_BGR;
+}
+
+int fbm_sink_open(struct fbm_sink* sink, char const* spec, struct fbm_options const* opts)
+{
+	size_t i, len;
+
+	memset(sink, 0, sizeof(*sink));
+	sink->opts = opts;
+	fbm_sink_set_rotation(sink, opts->rotation);
+
+	for (i = 0; i < sizeof(fbm_sinks) / sizeof(fbm_sinks[0]); i++) {
+		len = strlen(fbm_sinks[i]->name);
+		if (!strncmp(spec, fbm_sinks[i]->name, len)
+		 && ((spec[len] == ':') || !spec[len])) {
+			sink->ops = fbm_sinks[i];
+			return sink->ops->open(sink, spec[len] ? spec + len + 1 : "");
+		}
+	}
+
+	fprintf(stderr, "unknown sink '%s'\n", spec);
+	return -1;
+}
+
+int fbm_sink_init_panel(struct fbm_sink* sink)
+{
+	int rc = 0;
+
+	rc |= fbm_sink_command(sink, ILI9488_CMD_EXIT_SLEEP, NULL, 0);
+	fbm_sleep_until_ns(fbm_now_ns() + 120000000ull);
+
+	rc |= fbm_sink_command_bytes(sink, ILI9488_CMD_POSITIVE_GAMMA,
+		0x00, 0x03, 0x09, 0x08, 0x16, 0x0a, 0x3f, 0x78,
+		0x4c, 0x09, 0x0a, 0x08, 0x16, 0x1a, 0x0f);
+	rc |= fbm_sink_command_bytes(sink, ILI9488_CMD_NEGATIVE_GAMMA,
+		0x00, 0x16, 0x19, 0x03, 0x0f, 0x05, 0x32, 0x45,
+		0x46, 0x04, 0x0e, 0x0d, 0x35, 0x37, 0x0f);
+	rc |= fbm_sink_command_bytes(sink, ILI9488_CMD_POWER_CONTROL_1, 0x17, 0x15);
+	rc |= fbm_sink_command_bytes(sink, ILI9488_CMD_POWER_CONTROL_2, 0x41);
+	rc |= fbm_sink_command_bytes(sink, ILI9488_CMD_VCOM_CONTROL, 0x00, 0x12, 0x80);
+	rc |= fbm_sink_command(sink, ILI9488_CMD_ADDRESS_MODE, &sink->madctl, 1);
+	rc |= fbm_sink_command_bytes(sink, ILI9488_CMD_PIXEL_FORMAT, ILI9488_PIXEL_FORMAT_18BIT);
+	rc |= fbm_sink_command_bytes(sink, ILI9488_CMD_INTERFACE_MODE, 0x00);
+	rc |= fbm_sink_command_bytes(sink, ILI9488_CMD_FRAME_RATE, 0xa0);
+	rc |= fbm_sink_command_bytes(sink, ILI9488_CMD_INVERSION, 0x02);
+	rc |= fbm_sink_command_bytes(sink, ILI9488_CMD_FUNCTION_CONTROL, 0x02, 0x02, 0x3b);
+	rc |= fbm_sink_command_bytes(sink, ILI9488_CMD_ENTRY_MODE, 0xc6);
+	rc |= fbm_sink_command_bytes(sink, ILI9488_CMD_ADJUST_CONTROL_3, 0xa9, 0x51, 0x2c, 0x82);
+	rc |= fbm_sink_command(sink, sink->opts->invert ? ILI9488_CMD_ENTER_INVERT
+		: ILI9488_CMD_EXIT_INVERT, NULL, 0);
+	rc |= fbm_sink_command(sink, ILI9488_CMD_DISPLAY_ON, NULL, 0);
+	fbm_sleep_until_ns(fbm_now_ns() + 20000000ull);
+
+	return rc ? -1 : 0;
+}
+
+int fbm_sink_write(struct fbm_sink* sink, struct fbm_frame const* frame)
+{
+	struct pixconv_rect const* rect;
+	uint8_t const* pixels = frame->pixels;
+	uint64_t start = sink->wire_bytes;
+	unsigned int i, xs, xe, ys, ye;
+	uint8_t window[4];
+	size_t len;
+
+	for (i = 0; i < frame->count; i++) {
+		rect = &frame->rects[i];
+		len = (size_t)rect->width * rect->height * PIXCONV_BYTES_PER_PIXEL;
+
+		xs = rect->x + sink->x_offset;
+		xe = xs + rect->width - 1;
+		ys = rect->y + sink->y_offset;
+		ye = ys + rect->height - 1;
+
+		window[0] = xs >> 8;
+		window[1] = xs & 0xff;
+		window[2] = xe >> 8;
+		window[3] = xe & 0xff;
+		if (fbm_sink_command(sink, ILI9488_CMD_COLUMN_ADDRESS, window, 4)) {
+			return -1;
+		}
+		window[0] = ys >> 8;
+		window[1] = ys & 0xff;
+		window[2] = ye >> 8;
+		window[3] = ye & 0xff;
+		if (fbm_sink_command(sink, ILI9488_CMD_PAGE_ADDRESS, window, 4)
+		 || fbm_sink_command(sink, ILI9488_CMD_MEMORY_WRITE, pixels, len)) {
+			return -1;
+		}
+		pixels += len;
+	}
+
+	// Stand-in sinks take as long as the modelled bus would
+	if (sink->opts->link_hz && (sink->ops != &fbm_sink_spidev)) {
+		if (sink->link_deadline_ns < fbm_now_ns()) {
+			sink->link_deadline_ns = fbm_now_ns();
+		}
+		sink->link_deadline_ns += (sink->wire_bytes - start) * 8 * 1000000000ull
+			/ sink->opts->link_hz;
+		fbm_sleep_until_ns(sink->link_deadline_ns);
+	}
+	return 0;
+}
+
+void fbm_sink_close(struct fbm_sink* sink)
+{
+	if (sink->ops && sink->ops->close) {
+		sink->ops->close(sink);
+	}
+	sink->ops = NULL;
+}
+
+static int fbm_null_open(struct fbm_sink* sink, char const* arg)
+{
+	(void)sink;
+	(void)arg;
+	return 0;
+}
+
+static int fbm_null_command(struct fbm_sink* sink, uint8_t cmd, uint8_t const* data, size_t len)
+{
+	(void)sink;
+	(void)cmd;
+	(void)data;
+	(void)len;
+	return 0;
+}
+
+struct fbm_sink_ops const fbm_sink_null = {
+	.name = "null",
+	.open = fbm_null_open,
+	.command = fbm_null_command,
+};
+
+struct fbm_fake_panel
+{
+	int fd;
+	uint8_t* gram;
+	size_t gram_len;
+	unsigned int columns;
+	unsigned int pages;
+
+	// Window from the last CASET and PASET
+	unsigned int xs, xe, ys, ye;
+	uint64_t commands;
+	uint64_t errors;
+};
+
+static int fbm_file_open(struct fbm_sink* sink, char const* arg)
+{
+	struct fbm_fake_panel* panel;
+
+	if (!*arg) {
+		fprintf(stderr, "file sink needs a path, file:PATH\n");
+		return -1;
+	}
+
+	panel = calloc(1, sizeof(*panel));
+	if (!panel) {
+		return -1;
+	}
+	sink->priv = panel;
+
+	panel->columns = FBM_PANEL_WIDTH;
+	panel->pages = FBM_NATIVE_HEIGHT;
+	if (sink->madctl & ILI9488_MADCTL_MV) {
+		panel->columns = FBM_NATIVE_HEIGHT;
+		panel->pages = FBM_PANEL_WIDTH;
+	}
+	panel->xe = panel->columns - 1;
+	panel->ye = panel->pages - 1;
+	panel->gram_len = (size_t)panel->columns * panel->pages * PIXCONV_BYTES_PER_PIXEL;
+
+	panel->fd = open(arg, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if ((panel->fd < 0) || ftruncate(panel->fd, panel->gram_len)) {
+		fprintf(stderr, "%s: %s\n", arg, strerror(errno));
+		goto out_free;
+	}
+	panel->gram = mmap(NULL, panel->gram_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		panel->fd, 0);
+	if (panel->gram == MAP_FAILED) {
+		fprintf(stderr, "%s: mmap: %s\n", arg, strerror(errno));
+		goto out_free;
+	}
+	return 0;
+
+out_free:
+	if (panel->fd >= 0) {
+		close(panel->fd);
+	}
+	free(panel);
+	sink->priv = NULL;
+	return -1;
+}
+
+static int fbm_file_command(struct fbm_sink* sink, uint8_t cmd, uint8_t const* data, size_t len)
+{
+	struct fbm_fake_panel* panel = sink->priv;
+	unsigned int width, height, start, end;
+	size_t i, pixels;
+	uint8_t* dst;
+
+	panel->commands++;
+	switch (cmd) {
+	case ILI9488_CMD_COLUMN_ADDRESS:
+	case ILI9488_CMD_PAGE_ADDRESS:
+		if (len != 4) {
+			panel->errors++;
+			break;
+		}
+		start = (data[0] << 8) | data[1];
+		end = (data[2] << 8) | data[3];
+		if ((start > end) || (end >= ((cmd == ILI9488_CMD_COLUMN_ADDRESS)
+			? panel->columns : panel->pages))) {
+			panel->errors++;
+			break;
+		}
+		if (cmd == ILI9488_CMD_COLUMN_ADDRESS) {
+			panel->xs = start;
+			panel->xe = end;
+		} else {
+			panel->ys = start;
+			panel->ye = end;
+		}
+		break;
+
+	case ILI9488_CMD_MEMORY_WRITE:
+		width = panel->xe - panel->xs + 1;
+		height = panel->ye - panel->ys + 1;
+		pixels = len / PIXCONV_BYTES_PER_PIXEL;
+		if ((len % PIXCONV_BYTES_PER_PIXEL) || (pixels > (size_t)width * height)) {
+			panel->errors++;
+			pixels = (pixels > (size_t)width * height) ? (size_t)width * height : pixels;
+		}
+
+		// Row by row through the window, a partial last row is allowed
+		for (i = 0; i < pixels; i += width) {
+			dst = panel->gram + (((size_t)(panel->ys + i / width) * panel->columns)
+				+ panel->xs) * PIXCONV_BYTES_PER_PIXEL;
+			memcpy(dst, data + i * PIXCONV_BYTES_PER_PIXEL,
+				((pixels - i < width) ? pixels - i : width) * PIXCONV_BYTES_PER_PIXEL);
+		}
+		break;
+
+	default:
+		break;
+	}
+	return 0;
+}
+
+static void fbm_file_close(struct fbm_sink* sink)
+{
+	struct fbm_fake_panel* panel = sink->priv;
+
+	if (!panel) {
+		return;
+	}
+	if (panel->errors) {
+		fprintf(stderr, "fake panel: %llu protocol errors in %llu commands\n",
+			(unsigned long long)panel->errors, (unsigned long long)panel->commands);
+	}
+	munmap(panel->gram, panel->gram_len);
+	close(panel->fd);
+	free(panel);
+	sink->priv = NULL;
+}
+
+struct fbm_sink_ops const fbm_sink_file = {
+	.name = "file",
+	.open = fbm_file_open,
+	.command = fbm_file_command,
+	.close = fbm_file_close,
+};
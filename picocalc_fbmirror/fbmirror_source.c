@@ -0,0 +1,273 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Framebuffer mirror for the picocalc ILI9488 panel
+ * fbmirror_source.c: Frame sources.
+ *
+ * fb:/dev/fb0                  Linux framebuffer, mapped read only
+ * file:PATH:WxH:FORMAT         raw frame in a file, mapped read only
+ * synth:WxH:FORMAT:PATTERN     generated frames for benchmarks
+ *
+ * FORMAT is rgb565 or xrgb8888. PATTERN is static (nothing moves), box (a
+ * bouncing 32x32 block), term (typed text that scrolls) or full (every pixel
+ * changes every frame).
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/fb.h>
+
+#include "fbmirror.h"
+
+struct fbm_source_priv
+{
+	int fd;
+	void* map;
+	size_t map_len;
+
+	// Synthetic frames
+	uint8_t* frame;
+	char pattern[16];
+	int box_x;
+	int box_y;
+	int box_dx;
+	int box_dy;
+	unsigned int text_col;
+	unsigned int text_row;
+};
+
+static void fbm_source_unmap(struct fbm_source* src)
+{
+	struct fbm_source_priv* priv = src->priv;
+
+	if (priv->map && (priv->map != MAP_FAILED)) {
+		munmap(priv->map, priv->map_len);
+	}
+	if (priv->fd >= 0) {
+		close(priv->fd);
+	}
+	free(priv->frame);
+	free(priv);
+	src->priv = NULL;
+}
+
+static int fbm_parse_format(char const* name, enum pixconv_format* format)
+{
+	if (!strcmp(name, "rgb565")) {
+		*format = PIXCONV_RGB565;
+	} else if (!strcmp(name, "xrgb8888")) {
+		*format = PIXCONV_XRGB8888;
+	} else {
+		fprintf(stderr, "unknown pixel format '%s'\n", name);
+		return -1;
+	}
+	return 0;
+}
+
+static int fbm_source_fb(struct fbm_source* src, char const* path)
+{
+	struct fbm_source_priv* priv = src->priv;
+	struct fb_var_screeninfo var;
+	struct fb_fix_screeninfo fix;
+
+	priv->fd = open(path, O_RDONLY);
+	if (priv->fd < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (ioctl(priv->fd, FBIOGET_VSCREENINFO, &var) || ioctl(priv->fd, FBIOGET_FSCREENINFO, &fix)) {
+		fprintf(stderr, "%s: not a framebuffer: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if ((var.bits_per_pixel == 16) && (var.red.offset == 11)) {
+		src->format = PIXCONV_RGB565;
+	} else if ((var.bits_per_pixel == 32) && (var.red.offset == 16)) {
+		src->format = PIXCONV_XRGB8888;
+	} else {
+		fprintf(stderr, "%s: unsupported %u bpp layout, use rgb565 or xrgb8888\n",
+			path, var.bits_per_pixel);
+		return -1;
+	}
+
+	priv->map_len = fix.smem_len;
+	priv->map = mmap(NULL, priv->map_len, PROT_READ, MAP_SHARED, priv->fd, 0);
+	if (priv->map == MAP_FAILED) {
+		fprintf(stderr, "%s: mmap: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	src->width = var.xres;
+	src->height = var.yres;
+	src->stride = fix.line_length;
+
+	// The visible page of a panned framebuffer
+	src->pixels = (uint8_t const*)priv->map + (size_t)var.yoffset * fix.line_length
+		+ (size_t)var.xoffset * (var.bits_per_pixel / 8);
+	return 0;
+}
+
+static int fbm_source_file(struct fbm_source* src, char const* path)
+{
+	struct fbm_source_priv* priv = src->priv;
+	struct stat st;
+
+	src->stride = (size_t)src->width * pixconv_format_bpp(src->format);
+	priv->map_len = src->stride * src->height;
+
+	priv->fd = open(path, O_RDONLY);
+	if ((priv->fd < 0) || fstat(priv->fd, &st)) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if ((size_t)st.st_size < priv->map_len) {
+		fprintf(stderr, "%s: %zu bytes, a %ux%u frame needs %zu\n", path,
+			(size_t)st.st_size, src->width, src->height, priv->map_len);
+		return -1;
+	}
+
+	priv->map = mmap(NULL, priv->map_len, PROT_READ, MAP_SHARED, priv->fd, 0);
+	if (priv->map == MAP_FAILED) {
+		fprintf(stderr, "%s: mmap: %s\n", path, strerror(errno));
+		return -1;
+	}
+	src->pixels = priv->map;
+	return 0;
+}
+
+static void fbm_synth_fill(struct fbm_source* src, unsigned int x, unsigned int y,
+	unsigned int width, unsigned int height, uint32_t rgb)
+{
+	struct fbm_source_priv* priv = src->priv;
+	uint16_t rgb565 = ((rgb >> 8) & 0xf800) | ((rgb >> 5) & 0x07e0) | ((rgb >> 3) & 0x001f);
+	unsigned int i, j;
+	uint8_t* row;
+
+	if ((x >= src->width) || (y >= src->height)) {
+		return;
+	}
+	width = (x + width > src->width) ? src->width - x : width;
+	height = (y + height > src->height) ? src->height - y : height;
+
+	for (j = 0; j < height; j++) {
+		row = priv->frame + (y + j) * src->stride;
+		for (i = x; i < x + width; i++) {
+			if (src->format == PIXCONV_RGB565) {
+				((uint16_t*)row)[i] = rgb565;
+			} else {
+				((uint32_t*)row)[i] = rgb;
+			}
+		}
+	}
+}
+
+static void fbm_synth_update(struct fbm_source* src, uint64_t frame)
+{
+	struct fbm_source_priv* priv = src->priv;
+	unsigned int i, y;
+
+	if (!frame) {
+		fbm_synth_fill(src, 0, 0, src->width, src->height, 0x102030);
+	}
+
+	if (!strcmp(priv->pattern, "box")) {
+		fbm_synth_fill(src, priv->box_x, priv->box_y, 32, 32, 0x102030);
+		if ((priv->box_x + priv->box_dx < 0) || (priv->box_x + priv->box_dx + 32 > (int)src->width)) {
+			priv->box_dx = -priv->box_dx;
+		}
+		if ((priv->box_y + priv->box_dy < 0) || (priv->box_y + priv->box_dy + 32 > (int)src->height)) {
+			priv->box_dy = -priv->box_dy;
+		}
+		priv->box_x += priv->box_dx;
+		priv->box_y += priv->box_dy;
+		fbm_synth_fill(src, priv->box_x, priv->box_y, 32, 32, 0xf0c020);
+
+	} else if (!strcmp(priv->pattern, "term")) {
+
+		// A glyph-like 8x16 cell per frame, a blank one now and then for words
+		if ((frame % 7) != 6) {
+			for (i = 0; i < 4; i++) {
+				fbm_synth_fill(src, priv->text_col * 8 + 1, priv->text_row * 16 + 3 + i * 3,
+					6 - ((frame + i) % 3) * 2, 2, 0xe0e0e0);
+			}
+		}
+		if (++priv->text_col * 8 >= src->width) {
+			priv->text_col = 0;
+			if (++priv->text_row * 16 >= src->height) {
+
+				// Scroll up one text line and clear the last one
+				priv->text_row--;
+				memmove(priv->frame, priv->frame + 16 * src->stride,
+					(src->height - 16) * src->stride);
+				fbm_synth_fill(src, 0, (src->height - 16), src->width, 16, 0x102030);
+			}
+		}
+
+	} else if (!strcmp(priv->pattern, "full")) {
+		for (y = 0; y < src->height; y += 8) {
+			fbm_synth_fill(src, 0, y, src->width, 8,
+				(uint32_t)((frame * 0x050301) + y * 0x010203) & 0xffffff);
+		}
+	}
+}
+
+int fbm_source_open(struct fbm_source* src, char const* spec)
+{
+	struct fbm_source_priv* priv;
+	char path[256], format[16];
+	int rc = -1;
+
+	memset(src, 0, sizeof(*src));
+	priv = calloc(1, sizeof(*priv));
+	if (!priv) {
+		return -1;
+	}
+	priv->fd = -1;
+	src->priv = priv;
+	src->close = fbm_source_unmap;
+	src->name = spec;
+
+	if (!strncmp(spec, "fb:", 3)) {
+		rc = fbm_source_fb(src, spec + 3);
+
+	} else if (!strncmp(spec, "file:", 5)) {
+		if ((sscanf(spec + 5, "%255[^:]:%ux%u:%15s", path, &src->width, &src->height,
+			format) != 4) || fbm_parse_format(format, &src->format)) {
+			fprintf(stderr, "source '%s': expected file:PATH:WxH:FORMAT\n", spec);
+		} else {
+			rc = fbm_source_file(src, path);
+		}
+
+	} else if (!strncmp(spec, "synth:", 6)) {
+		if ((sscanf(spec + 6, "%ux%u:%15[^:]:%15s", &src->width, &src->height, format,
+			priv->pattern) != 4) || fbm_parse_format(format, &src->format)
+		 || (src->width < 32) || (src->height < 32)) {
+			fprintf(stderr, "source '%s': expected synth:WxH:FORMAT:PATTERN\n", spec);
+		} else if (strcmp(priv->pattern, "static") && strcmp(priv->pattern, "box")
+		 && strcmp(priv->pattern, "term") && strcmp(priv->pattern, "full")) {
+			fprintf(stderr, "unknown pattern '%s'\n", priv->pattern);
+		} else {
+			src->stride = (size_t)src->width * pixconv_format_bpp(src->format);
+			priv->frame = calloc(src->height, src->stride);
+			priv->box_dx = 3;
+			priv->box_dy = 2;
+			src->pixels = priv->frame;
+			src->update = fbm_synth_update;
+			rc = priv->frame ? 0 : -1;
+		}
+
+	} else {
+		fprintf(stderr, "unknown source '%s'\n", spec);
+	}
+
+	if (rc) {
+		fbm_source_unmap(src);
+	}
+	return rc;
+}
@@ -0,0 +1,234 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Framebuffer mirror for the picocalc ILI9488 panel
+ * fbmirror_spidev.c: Panel on spidev, with DC and reset on the GPIO character
+ * device.
+ *
+ * A command byte goes out with DC low and its data with DC high, DC only
+ * changes when it has to. Pixel data is passed to the kernel straight from
+ * the transfer buffer in pieces of spidev's bufsiz (4096 unless spidev.bufsiz
+ * is set on the kernel command line), one SPI_IOC_MESSAGE each.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include <linux/spi/spidev.h>
+
+#include "fbmirror.h"
+
+#define FBM_SPIDEV_DEFAULT		"/dev/spidev0.0"
+#define FBM_SPIDEV_BUFSIZ_PARAM	"/sys/module/spidev/parameters/bufsiz"
+#define FBM_SPIDEV_BUFSIZ		4096
+
+// Line indexes in the GPIO request
+#define FBM_LINE_DC		0
+#define FBM_LINE_RESET	1
+
+struct fbm_spidev
+{
+	int fd;
+	int lines_fd;
+	bool has_reset;
+	int dc;
+	size_t bufsiz;
+	uint64_t ioctls;
+};
+
+static int fbm_spidev_set_line(struct fbm_spidev* spi, unsigned int line, int value)
+{
+	struct gpio_v2_line_values values = {
+		.bits = (uint64_t)!!value << line,
+		.mask = 1ull << line,
+	};
+
+	spi->ioctls++;
+	if (ioctl(spi->lines_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values)) {
+		fprintf(stderr, "spidev: gpio: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static int fbm_spidev_send(struct fbm_spidev* spi, uint32_t hz, uint8_t const* data, size_t len)
+{
+	struct spi_ioc_transfer xfer;
+	size_t n;
+
+	while (len) {
+		n = (len < spi->bufsiz) ? len : spi->bufsiz;
+		memset(&xfer, 0, sizeof(xfer));
+		xfer.tx_buf = (uintptr_t)data;
+		xfer.len = n;
+		xfer.speed_hz = hz;
+		xfer.bits_per_word = 8;
+
+		spi->ioctls++;
+		if (ioctl(spi->fd, SPI_IOC_MESSAGE(1), &xfer) < 0) {
+			fprintf(stderr, "spidev: transfer: %s\n", strerror(errno));
+			return -1;
+		}
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int fbm_spidev_command(struct fbm_sink* sink, uint8_t cmd, uint8_t const* data, size_t len)
+{
+	struct fbm_spidev* spi = sink->priv;
+	uint32_t hz = sink->opts->spi_hz;
+
+	if (spi->dc && fbm_spidev_set_line(spi, FBM_LINE_DC, 0)) {
+		return -1;
+	}
+	spi->dc = 0;
+	if (fbm_spidev_send(spi, hz, &cmd, 1)) {
+		return -1;
+	}
+	if (!len) {
+		return 0;
+	}
+
+	if (fbm_spidev_set_line(spi, FBM_LINE_DC, 1)) {
+		return -1;
+	}
+	spi->dc = 1;
+	return fbm_spidev_send(spi, hz, data, len);
+}
+
+static size_t fbm_spidev_bufsiz(void)
+{
+	unsigned long bufsiz = 0;
+	FILE* f;
+
+	f = fopen(FBM_SPIDEV_BUFSIZ_PARAM, "r");
+	if (f) {
+		if (fscanf(f, "%lu", &bufsiz) != 1) {
+			bufsiz = 0;
+		}
+		fclose(f);
+	}
+	return bufsiz ? bufsiz : FBM_SPIDEV_BUFSIZ;
+}
+
+static int fbm_spidev_request_lines(struct fbm_sink* sink, struct fbm_spidev* spi)
+{
+	struct fbm_options const* opts = sink->opts;
+	struct gpio_v2_line_request req;
+	int chip;
+
+	chip = open(opts->gpiochip, O_RDWR);
+	if (chip < 0) {
+		fprintf(stderr, "%s: %s\n", opts->gpiochip, strerror(errno));
+		return -1;
+	}
+
+	// DC starts high, reset starts released
+	memset(&req, 0, sizeof(req));
+	req.offsets[FBM_LINE_DC] = opts->dc_gpio;
+	req.num_lines = 1;
+	if (opts->reset_gpio >= 0) {
+		req.offsets[FBM_LINE_RESET] = opts->reset_gpio;
+		req.num_lines = 2;
+	}
+	strncpy(req.consumer, "picocalc_fbmirror", sizeof(req.consumer) - 1);
+	req.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+	req.config.num_attrs = 1;
+	req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+	req.config.attrs[0].attr.values = (1ull << FBM_LINE_DC) | (1ull << FBM_LINE_RESET);
+	req.config.attrs[0].mask = (1ull << req.num_lines) - 1;
+
+	if (ioctl(chip, GPIO_V2_GET_LINE_IOCTL, &req)) {
+		fprintf(stderr, "%s: lines %d/%d: %s\n", opts->gpiochip, opts->dc_gpio,
+			opts->reset_gpio, strerror(errno));
+		close(chip);
+		return -1;
+	}
+	close(chip);
+
+	spi->lines_fd = req.fd;
+	spi->has_reset = (opts->reset_gpio >= 0);
+	spi->dc = 1;
+	return 0;
+}
+
+static void fbm_spidev_close(struct fbm_sink* sink)
+{
+	struct fbm_spidev* spi = sink->priv;
+
+	if (!spi) {
+		return;
+	}
+	if (spi->lines_fd >= 0) {
+		close(spi->lines_fd);
+	}
+	if (spi->fd >= 0) {
+		close(spi->fd);
+	}
+	free(spi);
+	sink->priv = NULL;
+}
+
+static int fbm_spidev_open(struct fbm_sink* sink, char const* arg)
+{
+	struct fbm_options const* opts = sink->opts;
+	char const* path = *arg ? arg : FBM_SPIDEV_DEFAULT;
+	struct fbm_spidev* spi;
+	uint8_t mode = SPI_MODE_0, bits = 8;
+	uint32_t hz = opts->spi_hz;
+
+	spi = calloc(1, sizeof(*spi));
+	if (!spi) {
+		return -1;
+	}
+	spi->lines_fd = -1;
+	sink->priv = spi;
+
+	spi->fd = open(path, O_RDWR);
+	if (spi->fd < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		goto out_close;
+	}
+	if (ioctl(spi->fd, SPI_IOC_WR_MODE, &mode) || ioctl(spi->fd, SPI_IOC_WR_BITS_PER_WORD, &bits)
+	 || ioctl(spi->fd, SPI_IOC_WR_MAX_SPEED_HZ, &hz)) {
+		fprintf(stderr, "%s: setup: %s\n", path, strerror(errno));
+		goto out_close;
+	}
+	spi->bufsiz = fbm_spidev_bufsiz();
+
+	if (fbm_spidev_request_lines(sink, spi)) {
+		goto out_close;
+	}
+
+	// Hardware reset ahead of the init sequence
+	if (spi->has_reset && opts->init) {
+		if (fbm_spidev_set_line(spi, FBM_LINE_RESET, 0)) {
+			goto out_close;
+		}
+		fbm_sleep_until_ns(fbm_now_ns() + 20000000ull);
+		if (fbm_spidev_set_line(spi, FBM_LINE_RESET, 1)) {
+			goto out_close;
+		}
+		fbm_sleep_until_ns(fbm_now_ns() + 120000000ull);
+	}
+
+	fprintf(stderr, "%s: %u Hz, %zu byte transfers\n", path, hz, spi->bufsiz);
+	return 0;
+
+out_close:
+	fbm_spidev_close(sink);
+	return -1;
+}
+
+struct fbm_sink_ops const fbm_sink_spidev = {
+	.name = "spidev",
+	.open = fbm_spidev_open,
+	.command = fbm_spidev_command,
+	.close = fbm_spidev_close,
+};
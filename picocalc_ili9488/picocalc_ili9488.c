@@ -0,0 +1,564 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * DRM driver for the ILI9488 panel on picocalc
+ *
+ * The 320x320 panel hangs off SPI with DC on GPIO24 and reset on GPIO25.
+ * Over SPI the ILI9488 only takes 18-bit pixels, sent as three bytes each,
+ * so frames are converted here instead of going through the RGB565 path of
+ * the mipi-dbi helpers. Only the damaged rectangles of each atomic commit are
+ * converted and sent, each in its own CASET/PASET window.
+ *
+ * Without a DC GPIO the panel is driven in 3-wire 9-bit mode, which is what
+ * picocalc_ili9488_sim records.
+ */
+
+#include <linux/version.h>
+#include <linux/module.h>
+#include <linux/spi/spi.h>
+#include <linux/gpio/consumer.h>
+#include <linux/property.h>
+#include <linux/backlight.h>
+#include <linux/delay.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+
+#include <drm/drm_atomic_helper.h>
+#include <drm/drm_damage_helper.h>
+#include <drm/drm_drv.h>
+#include <drm/drm_fb_dma_helper.h>
+#include <drm/drm_fourcc.h>
+#include <drm/drm_framebuffer.h>
+#include <drm/drm_gem_atomic_helper.h>
+#include <drm/drm_gem_dma_helper.h>
+#include <drm/drm_gem_framebuffer_helper.h>
+#include <drm/drm_managed.h>
+#include <drm/drm_mipi_dbi.h>
+#include <drm/drm_modeset_helper.h>
+#include <drm/drm_print.h>
+#include <video/mipi_display.h>
+
+// fbdev emulation moved around, 6.1 (Bullseye) is the oldest kernel handled here
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
+#include <drm/drm_fb_helper.h>
+#elif LINUX_VERSION_CODE < KERNEL_VERSION(6, 4, 0)
+#include <drm/drm_fbdev_generic.h>
+#elif LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
+#include <drm/drm_fbdev_dma.h>
+#else
+#include <drm/drm_client_setup.h>
+#include <drm/drm_fbdev_dma.h>
+#endif
+
+// Panel controller commands beyond the DCS set
+#define ILI9488_CMD_INTERFACE_MODE		0xb0
+#define ILI9488_CMD_FRAME_RATE			0xb1
+#define ILI9488_CMD_INVERSION			0xb4
+#define ILI9488_CMD_FUNCTION_CONTROL	0xb6
+#define ILI9488_CMD_ENTRY_MODE			0xb7
+#define ILI9488_CMD_POWER_CONTROL_1		0xc0
+#define ILI9488_CMD_POWER_CONTROL_2		0xc1
+#define ILI9488_CMD_VCOM_CONTROL		0xc5
+#define ILI9488_CMD_POSITIVE_GAMMA		0xe0
+#define ILI9488_CMD_NEGATIVE_GAMMA		0xe1
+#define ILI9488_CMD_ADJUST_CONTROL_3	0xf7
+
+// Memory access control bits
+#define ILI9488_MADCTL_BGR		BIT(3)
+#define ILI9488_MADCTL_MV		BIT(5)
+#define ILI9488_MADCTL_MX		BIT(6)
+#define ILI9488_MADCTL_MY		BIT(7)
+
+// 18 bits per pixel on the interface and in frame memory
+#define ILI9488_PIXEL_FORMAT_18BIT	0x66
+#define ILI9488_BYTES_PER_PIXEL		3
+
+// Frame memory is 320x480, the picocalc glass shows the first 320 rows
+#define ILI9488_NATIVE_HEIGHT		480
+#define PICOCALC_LCD_WIDTH			320
+#define PICOCALC_LCD_HEIGHT			320
+#define PICOCALC_LCD_WIDTH_MM		72
+#define PICOCALC_LCD_HEIGHT_MM		72
+
+// 9-bit words per 3-wire memory write transfer before 6.7
+#define ILI9488_TX9_WORDS			4096
+
+struct ili9488_ctx
+{
+	struct mipi_dbi_dev dbidev;
+
+	// Window offset into frame memory for the current rotation
+	unsigned int x_offset;
+	unsigned int y_offset;
+	uint8_t madctl;
+	bool invert;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 7, 0)
+	// 3-wire memory writes, one 9-bit word per byte
+	uint16_t *tx_buf9;
+#endif
+
+	// Damage statistics in debugfs
+	uint64_t updates;
+	uint64_t rects;
+	uint64_t bytes;
+	uint64_t full_bytes;
+};
+
+static inline struct ili9488_ctx* ili9488_from_dbidev(struct mipi_dbi_dev* dbidev)
+{
+	return container_of(dbidev, struct ili9488_ctx, dbidev);
+}
+
+static uint32_t const ili9488_formats[] = {
+	DRM_FORMAT_XRGB8888,
+	DRM_FORMAT_RGB565,
+};
+
+// Convert one rectangle to packed RGB666, the low two bits of each byte are
+// ignored by the panel
+static void ili9488_convert(uint8_t* dst, void const* vaddr,
+	struct drm_framebuffer const* fb, struct drm_rect const* rect)
+{
+	unsigned int x, y;
+	uint16_t const* src16;
+	uint32_t const* src32;
+	uint32_t px;
+
+	for (y = rect->y1; y < rect->y2; y++) {
+		if (fb->format->format == DRM_FORMAT_RGB565) {
+			src16 = vaddr + y * fb->pitches[0] + rect->x1 * 2;
+			for (x = rect->x1; x < rect->x2; x++) {
+				px = *src16++;
+				*dst++ = (px >> 8) & 0xf8;
+				*dst++ = (px >> 3) & 0xfc;
+				*dst++ = (px << 3) & 0xf8;
+			}
+		} else {
+			src32 = vaddr + y * fb->pitches[0] + rect->x1 * 4;
+			for (x = rect->x1; x < rect->x2; x++) {
+				px = *src32++;
+				*dst++ = px >> 16;
+				*dst++ = px >> 8;
+				*dst++ = px;
+			}
+		}
+	}
+}
+
+static void ili9488_set_window(struct ili9488_ctx* ctx, struct drm_rect const* rect)
+{
+	struct mipi_dbi *dbi = &ctx->dbidev.dbi;
+	unsigned int xs = rect->x1 + ctx->x_offset;
+	unsigned int xe = rect->x2 - 1 + ctx->x_offset;
+	unsigned int ys = rect->y1 + ctx->y_offset;
+	unsigned int ye = rect->y2 - 1 + ctx->y_offset;
+
+	mipi_dbi_command(dbi, MIPI_DCS_SET_COLUMN_ADDRESS,
+		xs >> 8, xs & 0xff, xe >> 8, xe & 0xff);
+	mipi_dbi_command(dbi, MIPI_DCS_SET_PAGE_ADDRESS,
+		ys >> 8, ys & 0xff, ye >> 8, ye & 0xff);
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 7, 0)
+// Before 6.7 mipi-dbi sends memory writes as 16-bit words unless bytes are
+// swapped, which reorders each byte pair of the RGB666 stream and fails on
+// odd lengths. The command goes through mipi-dbi, the pixels as plain bytes
+static int ili9488_write_memory(struct ili9488_ctx* ctx, uint8_t const* data,
+	size_t len)
+{
+	struct mipi_dbi *dbi = &ctx->dbidev.dbi;
+	struct spi_device *spi = dbi->spi;
+	uint8_t *cmd;
+	size_t chunk, i;
+	int rc;
+
+	// Transfer buffers must be DMA safe
+	cmd = kmalloc(1, GFP_KERNEL);
+	if (!cmd) {
+		return -ENOMEM;
+	}
+	*cmd = MIPI_DCS_WRITE_MEMORY_START;
+
+	mutex_lock(&dbi->cmdlock);
+	if ((rc = dbi->command(dbi, cmd, NULL, 0))) {
+		goto out_unlock;
+	}
+
+	// 4-wire, DC high for the whole stream
+	if (dbi->dc) {
+		gpiod_set_value_cansleep(dbi->dc, 1);
+		rc = mipi_dbi_spi_transfer(spi, mipi_dbi_spi_cmd_max_speed(spi, len),
+			8, data, len);
+		goto out_unlock;
+	}
+
+	// 3-wire, each byte becomes a 9-bit word with the data bit set
+	for (; len && !rc; data += chunk, len -= chunk) {
+		chunk = min_t(size_t, len, ILI9488_TX9_WORDS);
+		for (i = 0; i < chunk; i++) {
+			ctx->tx_buf9[i] = 0x100 | data[i];
+		}
+		rc = mipi_dbi_spi_transfer(spi, mipi_dbi_spi_cmd_max_speed(spi, chunk),
+			9, ctx->tx_buf9, chunk * sizeof(*ctx->tx_buf9));
+	}
+
+out_unlock:
+	mutex_unlock(&dbi->cmdlock);
+	kfree(cmd);
+	return rc;
+}
+#else
+static int ili9488_write_memory(struct ili9488_ctx* ctx, uint8_t const* data,
+	size_t len)
+{
+	return mipi_dbi_command_buf(&ctx->dbidev.dbi, MIPI_DCS_WRITE_MEMORY_START,
+		(uint8_t *)data, len);
+}
+#endif
+
+// Send one damaged rectangle of the framebuffer
+static int ili9488_fb_dirty(struct ili9488_ctx* ctx, struct iosys_map const* map,
+	struct drm_framebuffer* fb, struct drm_rect const* rect)
+{
+	struct mipi_dbi_dev *dbidev = &ctx->dbidev;
+	size_t len = drm_rect_width(rect) * drm_rect_height(rect)
+		* ILI9488_BYTES_PER_PIXEL;
+	int rc;
+
+	if ((rc = drm_gem_fb_begin_cpu_access(fb, DMA_FROM_DEVICE))) {
+		return rc;
+	}
+	ili9488_convert((uint8_t *)dbidev->tx_buf, map->vaddr, fb, rect);
+	drm_gem_fb_end_cpu_access(fb, DMA_FROM_DEVICE);
+
+	ili9488_set_window(ctx, rect);
+	rc = ili9488_write_memory(ctx, (uint8_t *)dbidev->tx_buf, len);
+	if (rc) {
+		drm_err_once(fb->dev, "Failed to update display %d\n", rc);
+		return rc;
+	}
+
+	ctx->rects++;
+	ctx->bytes += len;
+	return 0;
+}
+
+static void ili9488_pipe_update(struct drm_simple_display_pipe* pipe,
+	struct drm_plane_state* old_state)
+{
+	struct mipi_dbi_dev *dbidev = drm_to_mipi_dbi_dev(pipe->crtc.dev);
+	struct ili9488_ctx *ctx = ili9488_from_dbidev(dbidev);
+	struct drm_plane_state *state = pipe->plane.state;
+	struct drm_shadow_plane_state *shadow = to_drm_shadow_plane_state(state);
+	struct drm_framebuffer *fb = state->fb;
+	struct drm_atomic_helper_damage_iter iter;
+	struct drm_rect rect;
+	int idx;
+
+	if (!pipe->crtc.state->active || !fb) {
+		return;
+	}
+	if (!drm_dev_enter(fb->dev, &idx)) {
+		return;
+	}
+
+	// Each clip goes out on its own, merging would resend the area between
+	drm_atomic_helper_damage_iter_init(&iter, old_state, state);
+	drm_atomic_for_each_plane_damage(&iter, &rect) {
+		if (ili9488_fb_dirty(ctx, &shadow->data[0], fb, &rect)) {
+			break;
+		}
+	}
+	ctx->updates++;
+	ctx->full_bytes += (uint64_t)fb->width * fb->height * ILI9488_BYTES_PER_PIXEL;
+
+	drm_dev_exit(idx);
+}
+
+static void ili9488_pipe_enable(struct drm_simple_display_pipe* pipe,
+	struct drm_crtc_state* crtc_state, struct drm_plane_state* plane_state)
+{
+	struct mipi_dbi_dev *dbidev = drm_to_mipi_dbi_dev(pipe->crtc.dev);
+	struct ili9488_ctx *ctx = ili9488_from_dbidev(dbidev);
+	struct drm_shadow_plane_state *shadow = to_drm_shadow_plane_state(plane_state);
+	struct drm_framebuffer *fb = plane_state->fb;
+	struct mipi_dbi *dbi = &dbidev->dbi;
+	struct drm_rect rect = {
+		.x1 = 0,
+		.x2 = fb->width,
+		.y1 = 0,
+		.y2 = fb->height,
+	};
+	int rc, idx;
+
+	if (!drm_dev_enter(pipe->crtc.dev, &idx)) {
+		return;
+	}
+
+	rc = mipi_dbi_poweron_conditional_reset(dbidev);
+	if (rc < 0) {
+		goto out_exit;
+	}
+
+	// Panel kept its setup, only the contents need sending
+	if (rc == 1) {
+		goto out_flush;
+	}
+
+	mipi_dbi_command(dbi, MIPI_DCS_EXIT_SLEEP_MODE);
+	msleep(120);
+
+	mipi_dbi_command(dbi, ILI9488_CMD_POSITIVE_GAMMA,
+		0x00, 0x03, 0x09, 0x08, 0x16, 0x0a, 0x3f, 0x78,
+		0x4c, 0x09, 0x0a, 0x08, 0x16, 0x1a, 0x0f);
+	mipi_dbi_command(dbi, ILI9488_CMD_NEGATIVE_GAMMA,
+		0x00, 0x16, 0x19, 0x03, 0x0f, 0x05, 0x32, 0x45,
+		0x46, 0x04, 0x0e, 0x0d, 0x35, 0x37, 0x0f);
+	mipi_dbi_command(dbi, ILI9488_CMD_POWER_CONTROL_1, 0x17, 0x15);
+	mipi_dbi_command(dbi, ILI9488_CMD_POWER_CONTROL_2, 0x41);
+	mipi_dbi_command(dbi, ILI9488_CMD_VCOM_CONTROL, 0x00, 0x12, 0x80);
+	mipi_dbi_command(dbi, MIPI_DCS_SET_ADDRESS_MODE, ctx->madctl);
+	mipi_dbi_command(dbi, MIPI_DCS_SET_PIXEL_FORMAT, ILI9488_PIXEL_FORMAT_18BIT);
+	mipi_dbi_command(dbi, ILI9488_CMD_INTERFACE_MODE, 0x00);
+	mipi_dbi_command(dbi, ILI9488_CMD_FRAME_RATE, 0xa0);
+	mipi_dbi_command(dbi, ILI9488_CMD_INVERSION, 0x02);
+	mipi_dbi_command(dbi, ILI9488_CMD_FUNCTION_CONTROL, 0x02, 0x02, 0x3b);
+	mipi_dbi_command(dbi, ILI9488_CMD_ENTRY_MODE, 0xc6);
+	mipi_dbi_command(dbi, ILI9488_CMD_ADJUST_CONTROL_3, 0xa9, 0x51, 0x2c, 0x82);
+	mipi_dbi_command(dbi, ctx->invert ? MIPI_DCS_ENTER_INVERT_MODE
+		: MIPI_DCS_EXIT_INVERT_MODE);
+	mipi_dbi_command(dbi, MIPI_DCS_SET_DISPLAY_ON);
+	msleep(20);
+
+out_flush:
+	// Whole frame once, damage takes over from here
+	if (!ili9488_fb_dirty(ctx, &shadow->data[0], fb, &rect)) {
+		backlight_enable(dbidev->backlight);
+	}
+out_exit:
+	drm_dev_exit(idx);
+}
+
+static struct drm_simple_display_pipe_funcs const ili9488_pipe_funcs = {
+	.mode_valid = mipi_dbi_pipe_mode_valid,
+	.enable = ili9488_pipe_enable,
+	.disable = mipi_dbi_pipe_disable,
+	.update = ili9488_pipe_update,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
+	// Before 6.2 the generic shadow plane maps the framebuffer in prepare_fb
+	DRM_GEM_SIMPLE_DISPLAY_PIPE_SHADOW_PLANE_FUNCS,
+#else
+	.begin_fb_access = mipi_dbi_pipe_begin_fb_access,
+	.end_fb_access = mipi_dbi_pipe_end_fb_access,
+	.reset_plane = mipi_dbi_pipe_reset_plane,
+	.duplicate_plane_state = mipi_dbi_pipe_duplicate_plane_state,
+	.destroy_plane_state = mipi_dbi_pipe_destroy_plane_state,
+#endif
+};
+
+static struct drm_display_mode const ili9488_mode = {
+	DRM_SIMPLE_MODE(PICOCALC_LCD_WIDTH, PICOCALC_LCD_HEIGHT,
+		PICOCALC_LCD_WIDTH_MM, PICOCALC_LCD_HEIGHT_MM),
+};
+
+// Bytes sent against bytes a full redraw per update would have sent
+static int damage_stats_show(struct seq_file* s, void* unused)
+{
+	struct ili9488_ctx *ctx = s->private;
+
+	seq_printf(s, "updates %llu\nrects %llu\nbytes %llu\nfull_bytes %llu\n",
+		READ_ONCE(ctx->updates), READ_ONCE(ctx->rects),
+		READ_ONCE(ctx->bytes), READ_ONCE(ctx->full_bytes));
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(damage_stats);
+
+static void ili9488_debugfs_init(struct drm_minor* minor)
+{
+	struct mipi_dbi_dev *dbidev = drm_to_mipi_dbi_dev(minor->dev);
+
+	mipi_dbi_debugfs_init(minor);
+	debugfs_create_file("damage_stats", 0444, minor->debugfs_root,
+		ili9488_from_dbidev(dbidev), &damage_stats_fops);
+}
+
+DEFINE_DRM_GEM_DMA_FOPS(ili9488_fops);
+
+static struct drm_driver const ili9488_driver = {
+	.driver_features = DRIVER_GEM | DRIVER_MODESET | DRIVER_ATOMIC,
+	.fops = &ili9488_fops,
+	DRM_GEM_DMA_DRIVER_OPS_VMAP,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+	DRM_FBDEV_DMA_DRIVER_OPS,
+#endif
+	.debugfs_init = ili9488_debugfs_init,
+	.name = "picocalc_ili9488",
+	.desc = "ILI9488 panel on picocalc",
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 14, 0)
+	.date = "20260101",
+#endif
+	.major = 1,
+	.minor = 0,
+};
+
+// Address mode and the frame memory offset of the visible 320 rows
+static void ili9488_set_rotation(struct ili9488_ctx* ctx, unsigned int rotation)
+{
+	unsigned int hidden = ILI9488_NATIVE_HEIGHT - PICOCALC_LCD_HEIGHT;
+
+	ctx->x_offset = 0;
+	ctx->y_offset = 0;
+	switch (rotation) {
+	case 90:
+		ctx->madctl = ILI9488_MADCTL_MV;
+		break;
+	case 180:
+		ctx->madctl = ILI9488_MADCTL_MY;
+		ctx->y_offset = hidden;
+		break;
+	case 270:
+		ctx->madctl = ILI9488_MADCTL_MV | ILI9488_MADCTL_MY | ILI9488_MADCTL_MX;
+		ctx->x_offset = hidden;
+		break;
+	default:
+		ctx->madctl = ILI9488_MADCTL_MX;
+		break;
+	}
+	ctx->madctl |= ILI9488_MADCTL_BGR;
+}
+
+static int ili9488_probe(struct spi_device* spi)
+{
+	struct device *dev = &spi->dev;
+	struct ili9488_ctx *ctx;
+	struct mipi_dbi_dev *dbidev;
+	struct drm_device *drm;
+	struct mipi_dbi *dbi;
+	struct gpio_desc *dc;
+	uint32_t rotation = 0;
+	int rc;
+
+	ctx = devm_drm_dev_alloc(dev, &ili9488_driver, struct ili9488_ctx,
+		dbidev.drm);
+	if (IS_ERR(ctx)) {
+		return PTR_ERR(ctx);
+	}
+	dbidev = &ctx->dbidev;
+	dbi = &dbidev->dbi;
+	drm = &dbidev->drm;
+
+	dbi->reset = devm_gpiod_get_optional(dev, "reset", GPIOD_OUT_HIGH);
+	if (IS_ERR(dbi->reset)) {
+		return dev_err_probe(dev, PTR_ERR(dbi->reset), "Failed to get GPIO 'reset'\n");
+	}
+
+	// 4-wire mode with a DC line, 3-wire 9-bit mode without
+	dc = devm_gpiod_get_optional(dev, "dc", GPIOD_OUT_LOW);
+	if (IS_ERR(dc)) {
+		return dev_err_probe(dev, PTR_ERR(dc), "Failed to get GPIO 'dc'\n");
+	}
+
+	// Screen backlight is optional, on picocalc it belongs to the keyboard
+	dbidev->backlight = devm_of_find_backlight(dev);
+	if (IS_ERR(dbidev->backlight)) {
+		return PTR_ERR(dbidev->backlight);
+	}
+
+	device_property_read_u32(dev, "rotation", &rotation);
+	ili9488_set_rotation(ctx, rotation);
+	ctx->invert = device_property_read_bool(dev, "invert-colors");
+
+	if ((rc = mipi_dbi_spi_init(spi, dbi, dc))) {
+		return rc;
+	}
+
+	// MISO is not wired, and frame memory takes bytes in order
+	dbi->read_commands = NULL;
+	dbi->swap_bytes = false;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	dbi->write_memory_bpw = 8;
+#else
+	// Own 9-bit words for 3-wire memory writes, see ili9488_write_memory
+	if (!dc) {
+		if (!spi_is_bpw_supported(spi, 9)) {
+			return dev_err_probe(dev, -EINVAL,
+				"3-wire mode needs 9-bit SPI words before kernel 6.7\n");
+		}
+		ctx->tx_buf9 = devm_kmalloc_array(dev, ILI9488_TX9_WORDS,
+			sizeof(*ctx->tx_buf9), GFP_KERNEL);
+		if (!ctx->tx_buf9) {
+			return -ENOMEM;
+		}
+	}
+#endif
+
+	if ((rc = mipi_dbi_dev_init_with_formats(dbidev, &ili9488_pipe_funcs,
+		ili9488_formats, ARRAY_SIZE(ili9488_formats), &ili9488_mode, rotation,
+		PICOCALC_LCD_WIDTH * PICOCALC_LCD_HEIGHT * ILI9488_BYTES_PER_PIXEL))) {
+		return rc;
+	}
+	drm->mode_config.preferred_depth = 24;
+
+	drm_mode_config_reset(drm);
+
+	if ((rc = drm_dev_register(drm, 0))) {
+		return rc;
+	}
+
+	spi_set_drvdata(spi, drm);
+
+	// 32 bpp keeps the full 18 bits the panel can show
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 4, 0)
+	drm_fbdev_generic_setup(drm, 32);
+#elif LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
+	drm_fbdev_dma_setup(drm, 32);
+#else
+	drm_client_setup_with_color_mode(drm, 32);
+#endif
+
+	return 0;
+}
+
+static void ili9488_remove(struct spi_device* spi)
+{
+	struct drm_device *drm = spi_get_drvdata(spi);
+
+	drm_dev_unplug(drm);
+	drm_atomic_helper_shutdown(drm);
+}
+
+static void ili9488_shutdown(struct spi_device* spi)
+{
+	drm_atomic_helper_shutdown(spi_get_drvdata(spi));
+}
+
+// Driver definitions
+
+static struct of_device_id const ili9488_of_match[] = {
+	{ .compatible = "picocalc_ili9488" },
+	{ }
+};
+MODULE_DEVICE_TABLE(of, ili9488_of_match);
+
+static struct spi_device_id const ili9488_id[] = {
+	{ "picocalc_ili9488", 0 },
+	{ }
+};
+MODULE_DEVICE_TABLE(spi, ili9488_id);
+
+static struct spi_driver ili9488_spi_driver = {
+	.driver = {
+		.name = "picocalc_ili9488",
+		.of_match_table = ili9488_of_match,
+	},
+	.id_table = ili9488_id,
+	.probe = ili9488_probe,
+	.remove = ili9488_remove,
+	.shutdown = ili9488_shutdown,
+};
+module_spi_driver(ili9488_spi_driver);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("ILI9488 DRM driver for picocalc");
+MODULE_VERSION("0.01");
@@ -0,0 +1,431 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * PicoCalc ILI9488 panel simulator
+ *
+ * Registers a virtual SPI controller with a simulated ILI9488 on chip select
+ * 0, so picocalc_ili9488.ko can be developed and tested on any Linux box:
+ *
+ *   insmod picocalc_ili9488_sim.ko
+ *   insmod picocalc_ili9488.ko
+ *
+ * There is no DC GPIO, so the driver talks 3-wire 9-bit SPI and the
+ * simulator sees commands and data in each word. Everything is recorded in
+ * /sys/kernel/debug/picocalc_ili9488_sim:
+ *   log      recent commands, CASET/PASET windows and RAMWR byte counts
+ *   stats    transfer, command, window and pixel counters
+ *   gram     frame memory as written, 320x480 pixels of 3 bytes
+ *   reset    write anything to clear the log and counters
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/spi/spi.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/spinlock.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/version.h>
+
+#define SIM_WIDTH			320
+#define SIM_HEIGHT			480
+#define SIM_BYTES_PER_PIXEL	3
+#define SIM_LOG_SIZE		256
+#define SIM_MAX_ARGS		16
+#define SIM_MAX_SPEED_HZ	62500000
+
+// Commands the panel model acts on
+#define SIM_CMD_CASET		0x2a
+#define SIM_CMD_PASET		0x2b
+#define SIM_CMD_RAMWR		0x2c
+#define SIM_CMD_RAMWRC		0x3c
+
+// Bit 8 of a 9-bit word is the D/C bit, set for data
+#define SIM_WORD_DATA		(1 << 8)
+
+struct sim_log_entry
+{
+	uint8_t cmd;
+	uint8_t nargs;
+	uint8_t args[4];
+	uint32_t bytes;
+};
+
+struct sim_panel
+{
+	struct platform_device *pdev;
+	struct spi_controller *ctlr;
+	struct spi_device *spi;
+	struct dentry *dir;
+
+	// Panel state and recording, shared with debugfs readers
+	spinlock_t lock;
+	uint8_t cmd;
+	bool in_cmd;
+	uint8_t args[SIM_MAX_ARGS];
+	unsigned int nargs;
+	uint32_t cmd_bytes;
+	unsigned int xs, xe, ys, ye;
+	unsigned int col, row;
+	uint8_t pixel[SIM_BYTES_PER_PIXEL];
+	unsigned int pixel_len;
+
+	uint8_t *gram;
+	struct debugfs_blob_wrapper gram_blob;
+
+	struct sim_log_entry log[SIM_LOG_SIZE];
+	unsigned int log_head;
+	unsigned int log_count;
+
+	// Counters
+	uint64_t transfers;
+	uint64_t words;
+	uint64_t raw_bytes;
+	uint64_t commands;
+	uint64_t windows;
+	uint64_t ramwr_bytes;
+	uint64_t pixels;
+	uint64_t clipped;
+};
+
+static struct sim_panel *sim_panel;
+
+// Record the command that just ended, lock held
+static void sim_cmd_end_locked(struct sim_panel *sim)
+{
+	struct sim_log_entry *entry;
+
+	if (!sim->in_cmd) {
+		return;
+	}
+	sim->in_cmd = false;
+
+	entry = &sim->log[(sim->log_head + sim->log_count) % SIM_LOG_SIZE];
+	if (sim->log_count == SIM_LOG_SIZE) {
+		sim->log_head = (sim->log_head + 1) % SIM_LOG_SIZE;
+	} else {
+		sim->log_count++;
+	}
+	entry->cmd = sim->cmd;
+	entry->nargs = min_t(unsigned int, sim->nargs, SIM_MAX_ARGS);
+	memcpy(entry->args, sim->args, sizeof(entry->args));
+	entry->bytes = sim->cmd_bytes;
+}
+
+static void sim_cmd_start_locked(struct sim_panel *sim, uint8_t cmd)
+{
+	sim_cmd_end_locked(sim);
+
+	sim->in_cmd = true;
+	sim->cmd = cmd;
+	sim->nargs = 0;
+	sim->cmd_bytes = 0;
+	memset(sim->args, 0, sizeof(sim->args));
+	sim->commands++;
+
+	// Memory write starts at the window origin, continue picks up after
+	if (cmd == SIM_CMD_RAMWR) {
+		sim->col = sim->xs;
+		sim->row = sim->ys;
+		sim->pixel_len = 0;
+	}
+}
+
+// One whole pixel at the write position, which then moves through the window
+static void sim_pixel_locked(struct sim_panel *sim)
+{
+	if ((sim->row > sim->ye) || (sim->col >= SIM_WIDTH) || (sim->row >= SIM_HEIGHT)) {
+		sim->clipped++;
+	} else {
+		memcpy(&sim->gram[(sim->row * SIM_WIDTH + sim->col) * SIM_BYTES_PER_PIXEL],
+			sim->pixel, SIM_BYTES_PER_PIXEL);
+		sim->pixels++;
+	}
+
+	if (++sim->col > sim->xe) {
+		sim->col = sim->xs;
+		sim->row++;
+	}
+}
+
+static void sim_data_locked(struct sim_panel *sim, uint8_t byte)
+{
+	sim->cmd_bytes++;
+
+	if ((sim->cmd == SIM_CMD_RAMWR) || (sim->cmd == SIM_CMD_RAMWRC)) {
+		sim->ramwr_bytes++;
+		sim->pixel[sim->pixel_len++] = byte;
+		if (sim->pixel_len == SIM_BYTES_PER_PIXEL) {
+			sim->pixel_len = 0;
+			sim_pixel_locked(sim);
+		}
+		return;
+	}
+
+	if (sim->nargs < SIM_MAX_ARGS) {
+		sim->args[sim->nargs] = byte;
+	}
+	sim->nargs++;
+
+	// Window start and end, big endian
+	if (sim->nargs == 4) {
+		if (sim->cmd == SIM_CMD_CASET) {
+			sim->xs = (sim->args[0] << 8) | sim->args[1];
+			sim->xe = (sim->args[2] << 8) | sim->args[3];
+			sim->windows++;
+		} else if (sim->cmd == SIM_CMD_PASET) {
+			sim->ys = (sim->args[0] << 8) | sim->args[1];
+			sim->ye = (sim->args[2] << 8) | sim->args[3];
+		}
+	}
+}
+
+static int sim_transfer_one(struct spi_controller *ctlr, struct spi_device *spi,
+	struct spi_transfer *xfer)
+{
+	struct sim_panel *sim = spi_controller_get_devdata(ctlr);
+	uint16_t const *words;
+	unsigned long flags;
+	unsigned int i;
+
+	if (!xfer->tx_buf) {
+		return 0;
+	}
+
+	spin_lock_irqsave(&sim->lock, flags);
+	sim->transfers++;
+
+	// Without 9-bit words there is no D/C bit, only count the bytes
+	if (xfer->bits_per_word != 9) {
+		sim->raw_bytes += xfer->len;
+		spin_unlock_irqrestore(&sim->lock, flags);
+		return 0;
+	}
+
+	words = xfer->tx_buf;
+	for (i = 0; i < xfer->len / 2; i++) {
+		sim->words++;
+		if (words[i] & SIM_WORD_DATA) {
+			sim_data_locked(sim, words[i] & 0xff);
+		} else {
+			sim_cmd_start_locked(sim, words[i] & 0xff);
+		}
+	}
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	return 0;
+}
+
+static void sim_log_print(struct seq_file *s, struct sim_log_entry const *entry)
+{
+	switch (entry->cmd) {
+	case SIM_CMD_CASET:
+	case SIM_CMD_PASET:
+		seq_printf(s, "%s %u %u\n",
+			(entry->cmd == SIM_CMD_CASET) ? "caset" : "paset",
+			(entry->args[0] << 8) | entry->args[1],
+			(entry->args[2] << 8) | entry->args[3]);
+		break;
+	case SIM_CMD_RAMWR:
+	case SIM_CMD_RAMWRC:
+		seq_printf(s, "%s %u\n",
+			(entry->cmd == SIM_CMD_RAMWR) ? "ramwr" : "ramwrc", entry->bytes);
+		break;
+	default:
+		seq_printf(s, "cmd 0x%02x %*ph\n", entry->cmd,
+			min_t(int, entry->nargs, sizeof(entry->args)), entry->args);
+		break;
+	}
+}
+
+static int log_show(struct seq_file *s, void *unused)
+{
+	struct sim_panel *sim = s->private;
+	struct sim_log_entry current_cmd;
+	unsigned long flags;
+	unsigned int i;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	for (i = 0; i < sim->log_count; i++) {
+		sim_log_print(s, &sim->log[(sim->log_head + i) % SIM_LOG_SIZE]);
+	}
+
+	// The last command is still open until the next one starts
+	if (sim->in_cmd) {
+		current_cmd.cmd = sim->cmd;
+		current_cmd.nargs = min_t(unsigned int, sim->nargs, SIM_MAX_ARGS);
+		memcpy(current_cmd.args, sim->args, sizeof(current_cmd.args));
+		current_cmd.bytes = sim->cmd_bytes;
+		sim_log_print(s, &current_cmd);
+	}
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(log);
+
+static int stats_show(struct seq_file *s, void *unused)
+{
+	struct sim_panel *sim = s->private;
+	unsigned long flags;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	seq_printf(s, "transfers %llu\nwords %llu\nraw_bytes %llu\ncommands %llu\n"
+		"windows %llu\nramwr_bytes %llu\npixels %llu\nclipped %llu\n"
+		"window %u %u %u %u\n",
+		sim->transfers, sim->words, sim->raw_bytes, sim->commands,
+		sim->windows, sim->ramwr_bytes, sim->pixels, sim->clipped,
+		sim->xs, sim->ys, sim->xe, sim->ye);
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(stats);
+
+static ssize_t reset_write(struct file *file, char const __user *ubuf,
+	size_t count, loff_t *ppos)
+{
+	struct sim_panel *sim = file->private_data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	sim->log_head = 0;
+	sim->log_count = 0;
+	sim->transfers = 0;
+	sim->words = 0;
+	sim->raw_bytes = 0;
+	sim->commands = 0;
+	sim->windows = 0;
+	sim->ramwr_bytes = 0;
+	sim->pixels = 0;
+	sim->clipped = 0;
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	return count;
+}
+
+static struct file_operations const reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = reset_write,
+	.llseek = noop_llseek,
+};
+
+static void sim_destroy(struct sim_panel *sim)
+{
+	debugfs_remove_recursive(sim->dir);
+	if (sim->spi) {
+		spi_unregister_device(sim->spi);
+	}
+	if (sim->ctlr) {
+		spi_unregister_controller(sim->ctlr);
+	}
+	platform_device_unregister(sim->pdev);
+	vfree(sim->gram);
+	kfree(sim);
+}
+
+static struct sim_panel *sim_create(void)
+{
+	struct sim_panel *sim;
+	struct spi_controller *ctlr;
+	struct spi_board_info info = {
+		.modalias = "picocalc_ili9488",
+		.max_speed_hz = 32000000,
+		.chip_select = 0,
+		.mode = SPI_MODE_0,
+	};
+	int rc;
+
+	sim = kzalloc(sizeof(*sim), GFP_KERNEL);
+	if (!sim) {
+		return ERR_PTR(-ENOMEM);
+	}
+	spin_lock_init(&sim->lock);
+	sim->xe = SIM_WIDTH - 1;
+	sim->ye = SIM_HEIGHT - 1;
+
+	sim->gram = vzalloc(SIM_WIDTH * SIM_HEIGHT * SIM_BYTES_PER_PIXEL);
+	if (!sim->gram) {
+		kfree(sim);
+		return ERR_PTR(-ENOMEM);
+	}
+	sim->gram_blob.data = sim->gram;
+	sim->gram_blob.size = SIM_WIDTH * SIM_HEIGHT * SIM_BYTES_PER_PIXEL;
+
+	sim->pdev = platform_device_register_simple("picocalc_ili9488_sim", -1, NULL, 0);
+	if (IS_ERR(sim->pdev)) {
+		rc = PTR_ERR(sim->pdev);
+		vfree(sim->gram);
+		kfree(sim);
+		return ERR_PTR(rc);
+	}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
+	ctlr = spi_alloc_master(&sim->pdev->dev, 0);
+#else
+	ctlr = spi_alloc_host(&sim->pdev->dev, 0);
+#endif
+	if (!ctlr) {
+		sim_destroy(sim);
+		return ERR_PTR(-ENOMEM);
+	}
+	spi_controller_set_devdata(ctlr, sim);
+	ctlr->bus_num = -1;
+	ctlr->num_chipselect = 1;
+	ctlr->mode_bits = SPI_CPHA | SPI_CPOL;
+	ctlr->bits_per_word_mask = SPI_BPW_MASK(8) | SPI_BPW_MASK(9) | SPI_BPW_MASK(16);
+	ctlr->max_speed_hz = SIM_MAX_SPEED_HZ;
+	ctlr->transfer_one = sim_transfer_one;
+
+	if ((rc = spi_register_controller(ctlr))) {
+		spi_controller_put(ctlr);
+		sim_destroy(sim);
+		return ERR_PTR(rc);
+	}
+	sim->ctlr = ctlr;
+
+	sim->dir = debugfs_create_dir("picocalc_ili9488_sim", NULL);
+	debugfs_create_file("log", 0444, sim->dir, sim, &log_fops);
+	debugfs_create_file("stats", 0444, sim->dir, sim, &stats_fops);
+	debugfs_create_blob("gram", 0444, sim->dir, &sim->gram_blob);
+	debugfs_create_file("reset", 0200, sim->dir, sim, &reset_fops);
+
+	// Instantiate the panel so picocalc_ili9488 binds to it
+	sim->spi = spi_new_device(ctlr, &info);
+	if (!sim->spi) {
+		sim_destroy(sim);
+		return ERR_PTR(-ENODEV);
+	}
+
+	pr_info("%s Simulated panel on spi%d.0\n", __func__, ctlr->bus_num);
+
+	return sim;
+}
+
+// Module constructor
+static int __init picocalc_ili9488_sim_init(void)
+{
+	sim_panel = sim_create();
+	if (IS_ERR(sim_panel)) {
+		int rc = PTR_ERR(sim_panel);
+
+		sim_panel = NULL;
+		return rc;
+	}
+
+	return 0;
+}
+module_init(picocalc_ili9488_sim_init);
+
+// Module destructor
+static void __exit picocalc_ili9488_sim_exit(void)
+{
+	sim_destroy(sim_panel);
+}
+module_exit(picocalc_ili9488_sim_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("PicoCalc ILI9488 panel simulator on a virtual SPI controller");
+MODULE_VERSION("0.01");
@@ -0,0 +1,38 @@
+#!/bin/bash
+# Runs the driver's KUnit suite with kunit.py in a kernel source tree.
+#
+# Links this directory into drivers/input/keyboard/picocalc_kbd, hooks its
+# Kconfig and Makefile into the keyboard directory once, then runs kunit.py
+# with the .kunitconfig next to this script. Needs a 6.0 or later tree.
+#
+#   ./picocalc_kbd/kunit.sh ~/src/linux [kunit.py arguments...]
+#
+# Runs under qemu on x86_64 by default, a later --arch overrides it.
+set -e
+
+HERE=$(dirname "$(realpath "$0")")
+KDIR=${1:?usage: kunit.sh <kernel tree> [kunit.py arguments...]}
+shift
+KDIR=$(realpath "$KDIR")
+KBD_DIR=drivers/input/keyboard
+
+if [ ! -x "$KDIR/tools/testing/kunit/kunit.py" ]; then
+    echo "kunit.sh: $KDIR is not a kernel tree with kunit.py" >&2
+    exit 2
+fi
+
+ln -sfn "$HERE" "$KDIR/$KBD_DIR/picocalc_kbd"
+if ! grep -q "picocalc_kbd/Kconfig" "$KDIR/$KBD_DIR/Kconfig"; then
+    # The keyboard menu ends with the last endif, found in the reversed file
+    tac "$KDIR/$KBD_DIR/Kconfig" | \
+        sed '0,/^endif/s||endif\n\nsource "'$KBD_DIR'/picocalc_kbd/Kconfig"|' | \
+        tac > "$KDIR/$KBD_DIR/Kconfig.tmp"
+    mv "$KDIR/$KBD_DIR/Kconfig.tmp" "$KDIR/$KBD_DIR/Kconfig"
+fi
+if ! grep -q "picocalc_kbd/" "$KDIR/$KBD_DIR/Makefile"; then
+    echo 'obj-$(CONFIG_PICOCALC_KBD) += picocalc_kbd/' >> "$KDIR/$KBD_DIR/Makefile"
+fi
+
+cd "$KDIR"
+exec ./tools/testing/kunit/kunit.py run --kunitconfig="$KBD_DIR/picocalc_kbd" \
+    --arch=x86_64 "$@"
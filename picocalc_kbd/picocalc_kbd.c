@@ -9,18 +9,132 @@
 #include <linux/input.h>
 #include <linux/interrupt.h>
 #include <linux/i2c.h>
+#include <linux/of.h>
+#include <linux/gpio/consumer.h>
+#include <linux/mutex.h>
+#include <linux/hrtimer.h>
+#include <linux/kthread.h>
+#include <linux/cpumask.h>
+#include <linux/sched.h>
+#include <uapi/linux/sched/types.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/percpu.h>
+#include <linux/jump_label.h>
+#include <linux/power_supply.h>
+#include <linux/backlight.h>
+#include <linux/leds.h>
+#include <linux/workqueue.h>
+#include <linux/idr.h>
+#include <linux/pm_runtime.h>
+#include <linux/pm_wakeup.h>
+#include <linux/miscdevice.h>
+#include <linux/vmalloc.h>
+#include <linux/eventfd.h>
+#include <linux/poll.h>
+#include <linux/mm.h>
+#include <linux/regmap.h>
+#include <linux/kref.h>
 #include "picocalc_kbd_code.h"
+#include "picocalc_kbd_ring.h"
 
 //#include "config.h"
 #include "debug_levels.h"
 
+#define CREATE_TRACE_POINTS
+#include "picocalc_kbd_trace.h"
+
+#define REG_ID_VER (0x01)
+#define REG_ID_CFG (0x02)
+#define REG_ID_INT (0x03)
+#define REG_ID_KEY (0x04)
 #define REG_ID_BAT (0x0b)
 #define REG_ID_BKL (0x05)
 #define REG_ID_FIF (0x09)
 #define REG_ID_BK2 (0x0A)
 
+#define REG_ID_LAST REG_ID_BAT
+#define KBD_NUM_REGS (REG_ID_LAST + 1)
+
 #define PICOCALC_WRITE_MASK (1<<7)
 
+// Number of pending FIFO entries in REG_ID_KEY
+#define KEY_COUNT_MASK (0x1F)
+
+// REG_ID_CFG bits
+#define CFG_OVERFLOW_ON  (1 << 0)
+#define CFG_OVERFLOW_INT (1 << 1)
+#define CFG_KEY_INT      (1 << 4)
+
+// REG_ID_INT bits
+#define INT_OVERFLOW     (1 << 0)
+#define INT_KEY          (1 << 3)
+
+// Pointer engine tick rate and motion curve, speeds in pixels per second
+#define MOUSE_RATE_HZ				60
+#define MOUSE_RATE_MIN_HZ			10
+#define MOUSE_RATE_MAX_HZ			250
+#define MOUSE_SPEED_MIN				80
+#define MOUSE_SPEED_MAX				640
+#define MOUSE_SPEED_LIMIT			4000
+#define MOUSE_ACCEL					960
+#define MOUSE_ACCEL_LIMIT			20000
+#define MOUSE_PRECISION_PCT			25
+
+// Scroll curve in hi-res wheel units per second, 120 units per detent
+#define SCROLL_DETENT				120
+#define SCROLL_SPEED_MIN			360
+#define SCROLL_SPEED_MAX			2400
+#define SCROLL_SPEED_LIMIT			12000
+#define SCROLL_ACCEL				2400
+#define SCROLL_ACCEL_LIMIT			60000
+
+// Dual-role keys and the default tap window
+#define KBD_DUAL_ROLES				8
+#define KBD_TAP_HOLD_MS				200
+#define KBD_TAP_HOLD_MAX_MS			2000
+
+// Pointer velocity and position fractions are fixed point
+#define MOUSE_FRAC_BITS				16
+
+// Backlight fade duration and minimum interval between fade writes
+#define LIGHT_FADE_MS				0
+#define LIGHT_FADE_MAX_MS			10000
+#define LIGHT_FADE_STEP_MS			20
+#define LIGHT_FADE_STEP_MIN_MS		10
+#define LIGHT_FADE_STEP_MAX_MS		1000
+
+// Idle time after the last input handler closes before polling stops
+#define KBD_AUTOSUSPEND_MS			1000
+
+// Longest a queued register write waits for the next poll cycle
+#define KBD_XFER_FLUSH_MS			16
+
+// REG_ID_BAT value bits
+#define BATTERY_CHARGING     (1 << 7)
+#define BATTERY_PERCENT_MASK (0x7F)
+
+// Battery refresh interval limits and default
+#define BATTERY_POLL_MS			30000
+#define BATTERY_POLL_MIN_MS		1000
+#define BATTERY_POLL_MAX_MS		3600000
+
+// Battery filter: fixed point fraction bits and moving average weight 1/2^n
+#define BATTERY_FILTER_FRAC		8
+#define BATTERY_FILTER_SHIFT	2
+
+// Consecutive interrupts without key events before falling back to polling
+#define KBD_IRQ_STORM_LIMIT			64
+
+// First firmware version clocked for 400 kHz fast-mode I2C
+#define KBD_FW_VERSION_FAST_I2C		0x11
+#define KBD_I2C_STANDARD_HZ			100000
+
+// I2C bit times per transaction, 9 per byte with its ACK plus start,
+// repeated start and stop. Used to estimate bus time per drain
+#define KBD_I2C_WORD_READ_BITS		47
+#define KBD_I2C_BLOCK_READ_BITS(_len)	(29 + 9 * (_len))
+
 #define KBD_BUS_TYPE		BUS_I2C
 #define KBD_VENDOR_ID		0x0001
 #define KBD_PRODUCT_ID		0x0001
@@ -33,10 +147,41 @@
 
 #define KBD_FIFO_SIZE				31
 
+// Whole key taps (press and release) that fit in the FIFO between two drains
+#define KBD_FIFO_TAPS				(KBD_FIFO_SIZE / 2)
+
 static uint32_t sysfs_gid_setting = 0; // GID of files in /sys/firmware/picocalc
 
-static uint64_t mouse_fast_move_thr_time = 150000000ull;
-static int8_t mouse_move_step = 1;
+// FIFO read mode selection. Batched reads pop several entries per transfer
+// and rely on firmware answering reads past the end of the FIFO with empty
+// entries, which no released firmware documents. Auto only uses them when
+// the device tree node sets batched-fifo
+enum kbd_fifo_mode
+{
+	KBD_FIFO_MODE_AUTO = 0,
+	KBD_FIFO_MODE_LEGACY = 1,
+	KBD_FIFO_MODE_BATCHED = 2,
+};
+
+static int fifo_mode = KBD_FIFO_MODE_AUTO;
+module_param(fifo_mode, int, 0444);
+MODULE_PARM_DESC(fifo_mode,
+	"FIFO read mode: 0 = batched if the device tree sets batched-fifo, 1 = legacy, 2 = batched");
+
+// Firmware overflow flag, not implemented by every firmware
+static bool overflow_int = false;
+module_param(overflow_int, bool, 0444);
+MODULE_PARM_DESC(overflow_int,
+	"Have firmware flag dropped key events, only for firmware that implements CFG_OVERFLOW_INT");
+
+// Raw event ring size, rounded up to a power of two, 0 leaves it out
+#define RAW_RING_MIN_ENTRIES		16
+#define RAW_RING_MAX_ENTRIES		65536
+
+static unsigned int raw_ring_entries = 0;
+module_param(raw_ring_entries, uint, 0444);
+MODULE_PARM_DESC(raw_ring_entries,
+	"Entries in the mmap raw key event ring device, 0 = no ring device");
 
 // From keyboard firmware source
 enum pico_key_state
@@ -59,16 +204,242 @@ struct key_fifo_item
 #define MOUSE_MOVE_UP    (1 << 3)
 #define MOUSE_MOVE_DOWN  (1 << 4)
 
+// Adaptive poll tiers, fastest first
+enum kbd_poll_tier
+{
+	KBD_POLL_FAST = 0,
+	KBD_POLL_MEDIUM,
+	KBD_POLL_SLOW,
+	KBD_POLL_TIERS,
+};
+
+// Default poll intervals and idle times before decaying into each tier
+#define KBD_POLL_FAST_MS			8
+#define KBD_POLL_MEDIUM_MS			20
+#define KBD_POLL_SLOW_MS			40
+#define KBD_POLL_MEDIUM_AFTER_MS	1000
+#define KBD_POLL_SLOW_AFTER_MS		10000
+#define KBD_POLL_FLOOR_MS			50
+#define KBD_POLL_MAX_MS				1000
+
+// Safety poll interval when key events are delivered by interrupt
+#define KBD_POLL_IRQ_MS				1000
+
+// Default SCHED_FIFO priority of the poller thread, 0 for SCHED_NORMAL
+#define KBD_POLL_PRIORITY			1
+
+// Default CPU time budget for reporting a full 31-entry FIFO drain
+#define KBD_DRAIN_BUDGET_US			200
+
+// Back-to-back drains while the FIFO keeps coming back full
+#define KBD_DRAIN_PASSES			4
+
+// Latency histograms in debugfs, log2 buckets
+enum kbd_hist_type
+{
+	KBD_HIST_SCHED_DELAY = 0,
+	KBD_HIST_I2C,
+	KBD_HIST_DRAIN,
+	KBD_HIST_EVENTS,
+	KBD_HIST_TYPES,
+};
+
+#define KBD_HIST_BUCKETS			32
+
+struct kbd_stats
+{
+	uint64_t hist[KBD_HIST_TYPES][KBD_HIST_BUCKETS];
+	uint64_t empty_polls;
+	uint64_t productive_polls;
+};
+
+// Statistics are only collected while enabled in debugfs
+static DEFINE_STATIC_KEY_FALSE(kbd_stats_enabled);
+
+// Screen and keyboard backlight with a kernel-side fade engine
+enum kbd_light_id
+{
+	KBD_LIGHT_SCREEN = 0,
+	KBD_LIGHT_KEYBOARD,
+	KBD_LIGHTS,
+};
+
+struct kbd_light
+{
+	uint8_t reg;
+	uint8_t level;
+	uint8_t start;
+	uint8_t target;
+	uint64_t fade_start_at;
+	unsigned int fade_ms;
+};
+
+// Dual-role key, sends one keycode when tapped and another while held
+enum kbd_dual_state
+{
+	KBD_DUAL_IDLE = 0,
+	KBD_DUAL_PENDING,
+	KBD_DUAL_HELD,
+};
+
+struct kbd_dual_role
+{
+	uint8_t scancode;
+	unsigned short tap;
+	unsigned short hold;
+	unsigned int tap_ms;
+	enum kbd_dual_state state;
+	uint64_t pressed_at;
+};
+
+// Accelerated motion along both axes, velocity and remainders fixed point
+struct kbd_motion
+{
+	uint32_t velocity;
+	int32_t frac_x;
+	int32_t frac_y;
+};
+
+struct kbd_raw_ring;
+
+// Per-device sysfs directory under /sys/firmware. The kobject has its own
+// lifetime, so it points back at the context until sysfs_shutdown
+struct kbd_sysfs
+{
+	struct kobject kobj;
+	struct kbd_ctx *ctx;
+};
+
 struct kbd_ctx
 {
-	struct work_struct work_struct;
+	// Instance number and name, "picocalc" for the first keyboard
+	int id;
+	char name[16];
+
+	// Per-device sysfs directory under /sys/firmware
+	struct kbd_sysfs *sysfs;
+
+	// last_keypress, notified after each drain that saw a key. Set and
+	// cleared under drain_lock
+	struct kernfs_node* last_keypress_kn;
+
+	struct kthread_work work_struct;
 	uint8_t version_number;
+	bool fifo_batched;
+	bool overflow_int;
+	uint32_t bus_hz;
+
+	// Interrupt bits of the firmware CFG register as found at probe,
+	// put back on removal. cfg_valid is false if CFG could not be read
+	unsigned int cfg_saved;
+	bool cfg_valid;
+
+	// Adaptive polling state and tunables
+	bool polling;
+	enum kbd_poll_tier poll_tier;
+	uint64_t last_activity_at;
+	unsigned int poll_interval_ms[KBD_POLL_TIERS];
+	unsigned int poll_after_ms[KBD_POLL_TIERS];
+	unsigned int poll_floor_ms;
+	uint64_t poll_count[KBD_POLL_TIERS];
+
+	// Dedicated poller thread driven by a high resolution timer
+	struct kthread_worker *poll_worker;
+	struct hrtimer poll_timer;
+	ktime_t poll_fired_at;
+	struct cpumask poll_cpus;
+	unsigned int poll_priority;
+	uint64_t sched_delay_count;
+	uint64_t sched_delay_total_ns;
+	uint64_t sched_delay_min_ns;
+	uint64_t sched_delay_max_ns;
+
+	// Serialises FIFO drains between poll worker and IRQ thread
+	struct mutex drain_lock;
+
+	// Interrupt delivery, polling is used if irq_mode is false
+	bool irq_mode;
+	int irq;
+	struct gpio_desc *irq_gpio;
+	unsigned int irq_idle_count;
+	uint64_t irq_count;
+
+	// Power management. Polling and the IRQ run only while an input handler
+	// has the device open, and nothing touches the bus while suspended
+	bool irq_disabled;
+	bool wake_armed;
+	bool suspended;
+
+	// Key IRQ masked by its handler while suspended, until resume
+	bool irq_wake_masked;
+
+	// Battery, refreshed in the background and low-pass filtered
+	struct power_supply *battery;
+	struct power_supply_desc battery_desc;
+	struct delayed_work battery_work;
+	struct mutex battery_lock;
+	unsigned int battery_poll_ms;
+	unsigned int battery_filtered;
+	int battery_raw;
+	int battery_capacity;
+	bool battery_charging;
+	bool battery_valid;
+
+	// Backlights, level is the last value queued to the register
+	struct kbd_light lights[KBD_LIGHTS];
+	struct mutex light_lock;
+	struct delayed_work light_fade_work;
+	bool lights_dying;
+	unsigned int light_fade_ms;
+	unsigned int light_fade_step_ms;
+	struct backlight_device *backlight;
+	struct led_classdev kbd_led;
+
+	// Deferred bus transactions, run by the poller after the FIFO drain
+	spinlock_t xfer_lock;
+	unsigned long xfer_write_pending;
+	unsigned long xfer_read_pending;
+	uint8_t xfer_write_value[KBD_NUM_REGS];
+	unsigned int xfer_depth_max;
+	uint64_t xfer_queued;
+	uint64_t xfer_coalesced;
+	uint64_t xfer_issued;
+	uint64_t xfer_cached;
+	uint64_t xfer_reads;
+
+	// CPU time budget for reporting a full FIFO drain, checked while
+	// statistics are enabled
+	unsigned int drain_budget_us;
+	uint64_t drain_over_budget;
+
+	// Extra input frames started because a drain repeated a key
+	uint64_t frames_split;
+
+	// Scancodes firmware reported pressed, checked against each new event
+	DECLARE_BITMAP(keys_down, NUM_KEYCODES);
+
+	// FIFO overflow episodes by cause, and how they were recovered
+	bool overflow_pending;
+	uint64_t overflow_at;
+	uint64_t overflows;
+	uint64_t overflow_full;
+	uint64_t overflow_flagged;
+	uint64_t overflow_inconsistent;
+	uint64_t overflow_recovered;
+	uint64_t overflow_released;
+
+	// Per-CPU latency statistics, collected while stats_enabled is set
+	struct kbd_stats __percpu *stats;
+	bool stats_enabled;
+	struct dentry *debugfs_dir;
 
 	struct i2c_client *i2c_client;
+	struct regmap *regmap;
 	struct input_dev *input_dev;
 
-	// Map from input HID scancodes to Linux keycodes
-	uint8_t *keycode_map;
+	// Map from input HID scancodes to Linux keycodes, one per scancode
+	// so lookups index directly. EVIOCSKEYCODE updates it in place
+	unsigned short *keycode_map;
 
 	// Key state and touch FIFO queue
 	uint8_t key_fifo_count;
@@ -77,8 +448,53 @@ struct kbd_ctx
         
         int mouse_mode;
         uint8_t mouse_move_dir;
+
+	// Pointer engine, ticks on its own timer while a direction is held
+	struct hrtimer mouse_timer;
+	spinlock_t report_lock;
+	bool mouse_precision;
+	uint64_t mouse_tick_at;
+	struct kbd_motion mouse_motion;
+	unsigned int mouse_rate_hz;
+	unsigned int mouse_speed_min;
+	unsigned int mouse_speed_max;
+	unsigned int mouse_accel;
+	unsigned int mouse_precision_pct;
+
+	// Scroll wheel emulation, speeds in hi-res wheel units per second
+	bool mouse_scroll_mod;
+	uint8_t mouse_scroll_dir;
+	struct kbd_motion scroll_motion;
+	int scroll_detent_x;
+	int scroll_detent_y;
+	unsigned int scroll_speed_min;
+	unsigned int scroll_speed_max;
+	unsigned int scroll_accel;
+
+	// Tap-hold engine, the index maps scancodes to dual_roles entry + 1
+	struct kbd_dual_role dual_roles[KBD_DUAL_ROLES];
+	uint8_t dual_role_index[NUM_KEYCODES];
+	unsigned int dual_role_count;
+	int dual_role_pending;
+	unsigned int tap_hold_ms;
+
+	// Sticky modifiers, a lone modifier tap latches it for the next key
+	unsigned int sticky_modifiers;
+	uint8_t sticky_down;
+	uint8_t sticky_candidate;
+	uint8_t sticky_pending;
+
+	// Raw event ring device, set and cleared under drain_lock. Open files
+	// keep it alive after the device is gone
+	struct kbd_raw_ring *raw;
 };
 
+// NULL once the device is gone
+static inline struct kbd_ctx* kbd_ctx_from_kobj(struct kobject* kobj)
+{
+	return READ_ONCE(container_of(kobj, struct kbd_sysfs, kobj)->ctx);
+}
+
 // Parse 0 to 255 from string
 static inline int parse_u8(char const* buf)
 {
@@ -91,56 +507,150 @@ static inline int parse_u8(char const* buf)
 	return result;
 }
 
-// Read a single uint8_t value from I2C register
-static inline int kbd_read_i2c_u8(struct i2c_client* i2c_client, uint8_t reg_addr,
-	uint8_t* dst)
+// Timestamp for statistics, 0 if they are disabled
+static inline uint64_t kbd_stats_now(void)
 {
-	int reg_value;
+	if (static_branch_unlikely(&kbd_stats_enabled)) {
+		return ktime_get_ns();
+	}
+	return 0;
+}
 
-	// Read value over I2C
-	if ((reg_value = i2c_smbus_read_byte_data(i2c_client, reg_addr)) < 0) {
-		dev_err(&i2c_client->dev,
+// Add a sample to the log2 histogram on this CPU
+static inline void kbd_stats_record(struct kbd_ctx* ctx, enum kbd_hist_type type,
+	uint64_t value)
+{
+	if (static_branch_unlikely(&kbd_stats_enabled) && ctx && ctx->stats
+	 && READ_ONCE(ctx->stats_enabled)) {
+		this_cpu_inc(ctx->stats->hist[type][min(fls64(value), KBD_HIST_BUCKETS - 1)]);
+	}
+}
+
+// Record time elapsed since a kbd_stats_now() timestamp
+static inline void kbd_stats_record_since(struct kbd_ctx* ctx,
+	enum kbd_hist_type type, uint64_t start)
+{
+	if (static_branch_unlikely(&kbd_stats_enabled) && start) {
+		kbd_stats_record(ctx, type, ktime_get_ns() - start);
+	}
+}
+
+// Register map access. Reads are a word read, the firmware replies with the
+// register ID followed by its value. Writes set the write bit on the register
+static int kbd_regmap_read(void* context, unsigned int reg, unsigned int* val)
+{
+	struct i2c_client* i2c_client = context;
+	int word_value;
+	uint64_t start = kbd_stats_now();
+
+	word_value = i2c_smbus_read_word_data(i2c_client, reg);
+	kbd_stats_record_since(i2c_get_clientdata(i2c_client), KBD_HIST_I2C, start);
+	if (word_value < 0) {
+		dev_err_ratelimited(&i2c_client->dev,
 			"%s Could not read from register 0x%02X, error: %d\n",
-			__func__, reg_addr, reg_value);
-		return reg_value;
+			__func__, reg, word_value);
+		return word_value;
 	}
 
-	// Assign result to buffer
-	*dst = reg_value & 0xFF;
+	*val = (word_value & 0xFF00) >> 8;
 
 	return 0;
 }
 
-// Write a single uint8_t value to I2C register
-static inline int kbd_write_i2c_u8(struct i2c_client* i2c_client, uint8_t reg_addr,
-	uint8_t src)
+static int kbd_regmap_write(void* context, unsigned int reg, unsigned int val)
 {
+	struct i2c_client* i2c_client = context;
 	int rc;
 
-	// Write value over I2C
 	if ((rc = i2c_smbus_write_byte_data(i2c_client,
-		reg_addr | PICOCALC_WRITE_MASK, src))) {
+		reg | PICOCALC_WRITE_MASK, val))) {
 
-		dev_err(&i2c_client->dev,
-			"%s Could not write to register 0x%02X, Error: %d\n",
-			__func__, reg_addr, rc);
+		dev_err_ratelimited(&i2c_client->dev,
+			"%s Could not write to register 0x%02X, error: %d\n",
+			__func__, reg, rc);
 		return rc;
 	}
 
 	return 0;
 }
 
-// Read a pair of uint8_t values from I2C register
-static inline int kbd_read_i2c_2u8(struct i2c_client* i2c_client, uint8_t reg_addr,
-	uint8_t* dst)
+// FIF entries are two bytes and popped by the FIFO readers with raw
+// transfers, so the map leaves it unreadable
+static bool kbd_regmap_readable(struct device* dev, unsigned int reg)
+{
+	switch (reg) {
+	case REG_ID_VER:
+	case REG_ID_CFG:
+	case REG_ID_INT:
+	case REG_ID_KEY:
+	case REG_ID_BKL:
+	case REG_ID_BK2:
+	case REG_ID_BAT:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool kbd_regmap_writeable(struct device* dev, unsigned int reg)
+{
+	switch (reg) {
+	case REG_ID_CFG:
+	case REG_ID_INT:
+	case REG_ID_BKL:
+	case REG_ID_BK2:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Only the config and the two backlights hold what was last written
+static bool kbd_regmap_volatile(struct device* dev, unsigned int reg)
+{
+	switch (reg) {
+	case REG_ID_CFG:
+	case REG_ID_BKL:
+	case REG_ID_BK2:
+		return false;
+	default:
+		return true;
+	}
+}
+
+// Reading the FIFO pops it, debugfs must not
+static bool kbd_regmap_precious(struct device* dev, unsigned int reg)
+{
+	return reg == REG_ID_FIF;
+}
+
+static struct regmap_config const kbd_regmap_config = {
+	.reg_bits = 8,
+	.val_bits = 8,
+	.max_register = REG_ID_LAST,
+	.reg_read = kbd_regmap_read,
+	.reg_write = kbd_regmap_write,
+	.readable_reg = kbd_regmap_readable,
+	.writeable_reg = kbd_regmap_writeable,
+	.volatile_reg = kbd_regmap_volatile,
+	.precious_reg = kbd_regmap_precious,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+	.cache_type = REGCACHE_MAPLE,
+#else
+	.cache_type = REGCACHE_RBTREE,
+#endif
+};
+
+// Pop one FIFO entry, state then scancode
+static inline int kbd_read_i2c_fifo_entry(struct i2c_client* i2c_client, uint8_t* dst)
 {
 	int word_value;
+	uint64_t start = kbd_stats_now();
 
 	// Read value over I2C
-	if ((word_value = i2c_smbus_read_word_data(i2c_client, reg_addr)) < 0) {
-		dev_err(&i2c_client->dev,
-			"%s Could not read from register 0x%02X, error: %d\n",
-			__func__, reg_addr, word_value);
+	word_value = i2c_smbus_read_word_data(i2c_client, REG_ID_FIF);
+	kbd_stats_record_since(i2c_get_clientdata(i2c_client), KBD_HIST_I2C, start);
+	if (word_value < 0) {
 		return word_value;
 	}
 
@@ -151,10 +661,100 @@ static inline int kbd_read_i2c_2u8(struct i2c_client* i2c_client, uint8_t reg_ad
 	return 0;
 }
 
-// Shared global state for global interfaces such as sysfs
-struct kbd_ctx *g_ctx;
+// Read a run of uint8_t values starting at I2C register in one transfer
+static inline int kbd_read_i2c_block(struct i2c_client* i2c_client, uint8_t reg_addr,
+	uint8_t* dst, uint16_t len)
+{
+	int rc;
+	uint64_t start = kbd_stats_now();
+	struct i2c_msg msgs[2] = {
+		{
+			.addr = i2c_client->addr,
+			.flags = 0,
+			.len = 1,
+			.buf = &reg_addr,
+		},
+		{
+			.addr = i2c_client->addr,
+			.flags = I2C_M_RD,
+			.len = len,
+			.buf = dst,
+		},
+	};
 
-void input_fw_read_fifo(struct kbd_ctx* ctx)
+	// Write register address and read all bytes with a repeated start
+	rc = i2c_transfer(i2c_client->adapter, msgs, ARRAY_SIZE(msgs));
+	kbd_stats_record_since(i2c_get_clientdata(i2c_client), KBD_HIST_I2C, start);
+	if (rc != ARRAY_SIZE(msgs)) {
+
+		rc = (rc < 0) ? rc : -EIO;
+		dev_err(&i2c_client->dev,
+			"%s Could not read %u bytes from register 0x%02X, error: %d\n",
+			__func__, len, reg_addr, rc);
+		return rc;
+	}
+
+	return 0;
+}
+
+// Copy state/scancode pairs from a batched FIFO read into the context,
+// stopping at the first empty entry
+static void input_fw_decode_fifo(struct kbd_ctx* ctx, uint8_t const* data,
+	unsigned int pending)
+{
+	uint8_t fifo_idx;
+
+	ctx->key_fifo_count = 0;
+	pending = min_t(unsigned int, pending, KBD_FIFO_SIZE);
+
+	for (fifo_idx = 0; fifo_idx < pending; fifo_idx++) {
+
+		// Stop early if the FIFO shrank meanwhile, batched-fifo firmware
+		// is expected to answer with empty entries past its end
+		if (data[fifo_idx * 2] == 0) {
+			break;
+		}
+
+		ctx->key_fifo_data[fifo_idx]._ = 0;
+		ctx->key_fifo_data[fifo_idx].state = data[fifo_idx * 2];
+		ctx->key_fifo_data[fifo_idx].scancode = data[fifo_idx * 2 + 1];
+		ctx->key_fifo_count++;
+
+		dev_info_fe(&ctx->i2c_client->dev,
+			"%s %02d: State %d Scancode %d\n",
+			__func__, fifo_idx,
+			ctx->key_fifo_data[fifo_idx].state,
+			ctx->key_fifo_data[fifo_idx].scancode);
+	}
+}
+
+// Read pending count, then pop all pending FIFO items in one transfer
+static void input_fw_read_fifo_batched(struct kbd_ctx* ctx)
+{
+	uint8_t data[KBD_FIFO_SIZE * 2];
+	unsigned int pending;
+
+	ctx->key_fifo_count = 0;
+
+	// Read number of FIFO items
+	if (regmap_read(ctx->regmap, REG_ID_KEY, &pending)) {
+		return;
+	}
+	pending = min_t(unsigned int, pending & KEY_COUNT_MASK, KBD_FIFO_SIZE);
+	if (pending == 0) {
+		return;
+	}
+
+	// Read all pending FIFO items
+	if (kbd_read_i2c_block(ctx->i2c_client, REG_ID_FIF, data, pending * 2)) {
+		return;
+	}
+
+	input_fw_decode_fifo(ctx, data, pending);
+}
+
+// Pop FIFO items one word read at a time until an empty entry
+static void input_fw_read_fifo_legacy(struct kbd_ctx* ctx)
 {
 	uint8_t fifo_idx;
 	int rc;
@@ -173,8 +773,7 @@ void input_fw_read_fifo(struct kbd_ctx* ctx)
 
         uint8_t data[2];
 		// Read 2 fifo items
-		if ((rc = kbd_read_i2c_2u8(ctx->i2c_client, 0x09,
-			(uint8_t*)&data))) {
+		if ((rc = kbd_read_i2c_fifo_entry(ctx->i2c_client, data))) {
 
 			dev_err(&ctx->i2c_client->dev,
 				"%s Could not read REG_FIF, Error: %d\n", __func__, rc);
@@ -209,135 +808,541 @@ void input_fw_read_fifo(struct kbd_ctx* ctx)
 	}
 }
 
-static void key_report_event(struct kbd_ctx* ctx,
-	struct key_fifo_item const* ev)
+static void kbd_raw_push(struct kbd_ctx* ctx);
+
+void input_fw_read_fifo(struct kbd_ctx* ctx)
 {
-	uint8_t keycode;
+	uint8_t fifo_idx;
+	uint64_t start = trace_picocalc_fifo_read_enabled() ? ktime_get_ns() : 0;
 
-	// Only handle key pressed, held, or released events
-	if ((ev->state != KEY_STATE_PRESSED) && (ev->state != KEY_STATE_RELEASED)
-	 && (ev->state != KEY_STATE_HOLD)) {
-		return;
+	if (ctx->fifo_batched) {
+		input_fw_read_fifo_batched(ctx);
+	} else {
+		input_fw_read_fifo_legacy(ctx);
 	}
 
-        /* right shift */
-        if (ev->scancode == 0xA3)
-        {
-            if (ev->state == KEY_STATE_PRESSED)
-            {
-                ctx->mouse_mode = !ctx->mouse_mode;
-            }
-            return;
-        }
+	// Raw ring readers see items as read, ahead of input processing
+	kbd_raw_push(ctx);
 
-        if (ctx->mouse_mode)
-        {
-            switch(ev->scancode)
-            {
-            /* KEY_BACKSPACE */
-/*
-            case '\b':
-                  if (ev->state == KEY_STATE_PRESSED)
-                  {
-                      input_report_abs(ctx->input_dev, ABS_X, 0);
-                      input_report_abs(ctx->input_dev, ABS_Y, 0);
-                  } 
-                  return;
-*/
-            /* KEY_RIGHT */
-            case 0xb7:
-                  if (ev->state == KEY_STATE_PRESSED)
-                  {
-                      if (!(ctx->mouse_move_dir & MOUSE_MOVE_RIGHT))
-	                  ctx->last_keypress_at = ktime_get_boottime_ns();
-                      ctx->mouse_move_dir |= MOUSE_MOVE_RIGHT;
-                  }
-                  else if (ev->state == KEY_STATE_RELEASED)
-                  {
-                      ctx->mouse_move_dir &= ~MOUSE_MOVE_RIGHT;
-                  }
-                  return;
-            /* KEY_LEFT */
-            case 0xb4:
-                  if (ev->state == KEY_STATE_PRESSED)
-                  {
-                      if (!(ctx->mouse_move_dir & MOUSE_MOVE_LEFT))
-	                  ctx->last_keypress_at = ktime_get_boottime_ns();
-                      ctx->mouse_move_dir |= MOUSE_MOVE_LEFT;
-                  }
-                  else if (ev->state == KEY_STATE_RELEASED)
-                  {
-	              ctx->last_keypress_at = ktime_get_boottime_ns();
-                      ctx->mouse_move_dir &= ~MOUSE_MOVE_LEFT;
-                  }
-                  return;
-            /* KEY_DOWN */
-            case 0xb6:
-                  if (ev->state == KEY_STATE_PRESSED)
-                  {
-                      if (!(ctx->mouse_move_dir & MOUSE_MOVE_DOWN))
-	                  ctx->last_keypress_at = ktime_get_boottime_ns();
-                      ctx->mouse_move_dir |= MOUSE_MOVE_DOWN;
-                  }
-                  else if (ev->state == KEY_STATE_RELEASED)
-                  {
-                      ctx->mouse_move_dir &= ~MOUSE_MOVE_DOWN;
-                  }
-                  return;
-            /* KEY_UP */
-            case 0xb5:
-                  if (ev->state == KEY_STATE_PRESSED)
-                  {
-                      if (!(ctx->mouse_move_dir & MOUSE_MOVE_UP))
-	                  ctx->last_keypress_at = ktime_get_boottime_ns();
-                      ctx->mouse_move_dir |= MOUSE_MOVE_UP;
-                  }
-                  else if (ev->state == KEY_STATE_RELEASED)
-                  {
-                      ctx->mouse_move_dir &= ~MOUSE_MOVE_UP;
-                  }
-                  return;
-            /* KEY_RIGHTBRACE */
-            case ']':
-	          input_report_key(ctx->input_dev, BTN_LEFT, ev->state == KEY_STATE_PRESSED);
-                  return;
-            /* KEY_LEFTBRACE */
-            case '[':
-	          input_report_key(ctx->input_dev, BTN_RIGHT, ev->state == KEY_STATE_PRESSED);
-                  return;
-            default:
-                     break;
-            }
-        }
+	if (start) {
+		trace_picocalc_fifo_read(ctx->i2c_client, ctx->key_fifo_count,
+			ctx->fifo_batched, ktime_get_ns() - start);
+	}
+	if (trace_picocalc_fifo_item_enabled()) {
+		for (fifo_idx = 0; fifo_idx < ctx->key_fifo_count; fifo_idx++) {
+			trace_picocalc_fifo_item(ctx->i2c_client, fifo_idx,
+				ctx->key_fifo_data[fifo_idx].state,
+				ctx->key_fifo_data[fifo_idx].scancode);
+		}
+	}
+}
 
-	// Post key scan event
-	input_event(ctx->input_dev, EV_MSC, MSC_SCAN, ev->scancode);
+// Probe firmware version and pick FIFO read mode and bus speed checks
+static void input_fw_probe(struct i2c_client* i2c_client, struct kbd_ctx* ctx)
+{
+	uint32_t bus_hz;
+	unsigned int version;
 
-	// Map input scancode to Linux input keycode
+	if (regmap_read(ctx->regmap, REG_ID_VER, &version)) {
+		dev_warn(&i2c_client->dev,
+			"%s Could not read firmware version, assuming legacy firmware\n",
+			__func__);
+		version = 0;
+	}
+	ctx->version_number = version;
 
-	keycode = keycodes[ev->scancode];
+	switch (fifo_mode) {
+	case KBD_FIFO_MODE_LEGACY:
+		ctx->fifo_batched = false;
+		break;
+	case KBD_FIFO_MODE_BATCHED:
+		ctx->fifo_batched = true;
+		break;
+	default:
+		ctx->fifo_batched = device_property_read_bool(&i2c_client->dev,
+			"batched-fifo");
+		break;
+	}
 
-	//keycode = ev->scancode;
-	dev_info_fe(&ctx->i2c_client->dev,
-		"%s state %d, scancode %d mapped to keycode %d\n",
-		__func__, ev->state, ev->scancode, keycode);
-	//printk("state %d, scancode %d mapped to keycode %d\n",
-	//	ev->state, ev->scancode, keycode);
+	// Fast-mode bus clock is set on the adapter through the dts overlay
+	if (!i2c_client->adapter->dev.of_node
+	 || of_property_read_u32(i2c_client->adapter->dev.of_node,
+		"clock-frequency", &bus_hz) || !bus_hz) {
+		bus_hz = KBD_I2C_STANDARD_HZ;
+	}
+	ctx->bus_hz = bus_hz;
+	if ((bus_hz > KBD_I2C_STANDARD_HZ)
+	 && (ctx->version_number < KBD_FW_VERSION_FAST_I2C)) {
+		dev_warn(&i2c_client->dev,
+			"%s I2C bus runs at %u Hz but firmware 0x%02X only supports %u Hz\n",
+			__func__, bus_hz, ctx->version_number, KBD_I2C_STANDARD_HZ);
+	}
 
-	// Scancode mapped to ignored keycode
-	if (keycode == 0) {
-		return;
+	// Keep the interrupt setup found in firmware, to restore on removal
+	ctx->cfg_valid = !regmap_read(ctx->regmap, REG_ID_CFG, &ctx->cfg_saved);
 
-	// Scancode converted to keycode not in map
-	} else if (keycode == KEY_UNKNOWN) {
+	// Have firmware flag dropped events, checked after a full drain
+	ctx->overflow_int = overflow_int && ctx->cfg_valid
+		&& !regmap_update_bits(ctx->regmap, REG_ID_CFG,
+			CFG_OVERFLOW_INT, CFG_OVERFLOW_INT);
+
+	dev_info(&i2c_client->dev,
+		"%s firmware version 0x%02X, %s FIFO reads\n",
+		__func__, ctx->version_number,
+		ctx->fifo_batched ? "batched" : "legacy");
+}
+
+// Advance one accelerated motion by dt, returns the speed after precision scaling
+static uint32_t mouse_motion_advance(struct kbd_motion* m, uint8_t dir,
+	unsigned int accel, unsigned int speed_max, unsigned int pct,
+	uint64_t dt_ns, int* dx, int* dy)
+{
+	uint64_t velocity, step;
+	int dir_x, dir_y;
+
+	// Accelerate towards top speed, precision scales the result
+	velocity = m->velocity + div_u64(((uint64_t)accel << MOUSE_FRAC_BITS) * dt_ns,
+		NSEC_PER_SEC);
+	velocity = min_t(uint64_t, velocity, (uint64_t)speed_max << MOUSE_FRAC_BITS);
+	m->velocity = velocity;
+	velocity = div_u64(velocity * pct, 100);
+	step = div_u64(velocity * dt_ns, NSEC_PER_SEC);
+
+	// Carry sub-unit remainders into the next tick
+	dir_x = !!(dir & MOUSE_MOVE_RIGHT) - !!(dir & MOUSE_MOVE_LEFT);
+	dir_y = !!(dir & MOUSE_MOVE_DOWN) - !!(dir & MOUSE_MOVE_UP);
+	m->frac_x += dir_x * (int32_t)step;
+	m->frac_y += dir_y * (int32_t)step;
+	*dx = m->frac_x / (1 << MOUSE_FRAC_BITS);
+	*dy = m->frac_y / (1 << MOUSE_FRAC_BITS);
+	m->frac_x -= *dx * (1 << MOUSE_FRAC_BITS);
+	m->frac_y -= *dy * (1 << MOUSE_FRAC_BITS);
+
+	return velocity >> MOUSE_FRAC_BITS;
+}
+
+// Pointer tick, reports whole pixels of movement and hi-res wheel units
+static enum hrtimer_restart mouse_timer_function(struct hrtimer *timer)
+{
+	struct kbd_ctx *ctx = container_of(timer, struct kbd_ctx, mouse_timer);
+	uint64_t now = ktime_get_ns();
+	uint64_t dt_ns;
+	unsigned int pct;
+	uint32_t speed;
+	int dx, dy, detents;
+	bool report = false;
+
+	spin_lock(&ctx->report_lock);
+
+	if (!ctx->mouse_mode || !(ctx->mouse_move_dir | ctx->mouse_scroll_dir)) {
+		spin_unlock(&ctx->report_lock);
+		return HRTIMER_NORESTART;
+	}
+
+	// Long delays would turn into a jump, limit to a tenth of a second
+	dt_ns = min_t(uint64_t, now - ctx->mouse_tick_at, NSEC_PER_SEC / 10);
+	ctx->mouse_tick_at = now;
+	pct = ctx->mouse_precision ? READ_ONCE(ctx->mouse_precision_pct) : 100;
+
+	if (ctx->mouse_move_dir) {
+		speed = mouse_motion_advance(&ctx->mouse_motion, ctx->mouse_move_dir,
+			READ_ONCE(ctx->mouse_accel), READ_ONCE(ctx->mouse_speed_max), pct,
+			dt_ns, &dx, &dy);
+		if (dx) {
+			input_report_rel(ctx->input_dev, REL_X, dx);
+		}
+		if (dy) {
+			input_report_rel(ctx->input_dev, REL_Y, dy);
+		}
+		if (dx || dy) {
+			trace_picocalc_mouse_move(ctx->i2c_client, dx, dy, speed);
+			report = true;
+		}
+	}
+
+	if (ctx->mouse_scroll_dir) {
+		speed = mouse_motion_advance(&ctx->scroll_motion, ctx->mouse_scroll_dir,
+			READ_ONCE(ctx->scroll_accel), READ_ONCE(ctx->scroll_speed_max), pct,
+			dt_ns, &dx, &dy);
+
+		// Wheel up is positive, legacy detents follow the hi-res total
+		if (dy) {
+			input_report_rel(ctx->input_dev, REL_WHEEL_HI_RES, -dy);
+			ctx->scroll_detent_y -= dy;
+			detents = ctx->scroll_detent_y / SCROLL_DETENT;
+			if (detents) {
+				input_report_rel(ctx->input_dev, REL_WHEEL, detents);
+				ctx->scroll_detent_y -= detents * SCROLL_DETENT;
+			}
+		}
+		if (dx) {
+			input_report_rel(ctx->input_dev, REL_HWHEEL_HI_RES, dx);
+			ctx->scroll_detent_x += dx;
+			detents = ctx->scroll_detent_x / SCROLL_DETENT;
+			if (detents) {
+				input_report_rel(ctx->input_dev, REL_HWHEEL, detents);
+				ctx->scroll_detent_x -= detents * SCROLL_DETENT;
+			}
+		}
+		if (dx || dy) {
+			trace_picocalc_mouse_scroll(ctx->i2c_client, dx, -dy, speed);
+			report = true;
+		}
+	}
+
+	if (report) {
+		input_sync(ctx->input_dev);
+	}
+
+	spin_unlock(&ctx->report_lock);
+
+	hrtimer_forward_now(timer,
+		ns_to_ktime(NSEC_PER_SEC / READ_ONCE(ctx->mouse_rate_hz)));
+	return HRTIMER_RESTART;
+}
+
+// Direction key in mouse mode, scrolls while the scroll modifier is held.
+// The first press of either starts the pointer timer
+static void mouse_move_key(struct kbd_ctx* ctx, uint8_t dir,
+	enum pico_key_state state, bool scroll)
+{
+	uint8_t *dirs = scroll ? &ctx->mouse_scroll_dir : &ctx->mouse_move_dir;
+	struct kbd_motion *m = scroll ? &ctx->scroll_motion : &ctx->mouse_motion;
+	bool idle = !(ctx->mouse_move_dir | ctx->mouse_scroll_dir);
+	uint64_t now;
+
+	// Release stops the direction whichever way it was started
+	if (state == KEY_STATE_RELEASED) {
+		ctx->mouse_move_dir &= ~dir;
+		ctx->mouse_scroll_dir &= ~dir;
+		return;
+	}
+	if ((state != KEY_STATE_PRESSED) || (*dirs & dir)) {
+		return;
+	}
+
+	now = ktime_get_ns();
+	ctx->last_keypress_at = ktime_get_boottime_ns();
+
+	// Each motion restarts from its initial speed
+	if (!*dirs) {
+		m->velocity = READ_ONCE(scroll ? ctx->scroll_speed_min
+			: ctx->mouse_speed_min) << MOUSE_FRAC_BITS;
+		m->frac_x = 0;
+		m->frac_y = 0;
+	}
+	*dirs |= dir;
+
+	// Backdate the first tick by one period so a tap moves right away
+	if (idle) {
+		ctx->scroll_detent_x = 0;
+		ctx->scroll_detent_y = 0;
+		ctx->mouse_tick_at = now - NSEC_PER_SEC / READ_ONCE(ctx->mouse_rate_hz);
+		hrtimer_start(&ctx->mouse_timer, 0, HRTIMER_MODE_REL_SOFT);
+	}
+}
+
+// Modifier keycodes that can be made sticky, bit position is the index
+static unsigned short const kbd_modifier_keys[] = {
+	KEY_LEFTCTRL, KEY_LEFTSHIFT, KEY_LEFTALT, KEY_LEFTMETA,
+	KEY_RIGHTCTRL, KEY_RIGHTSHIFT, KEY_RIGHTALT, KEY_RIGHTMETA,
+};
+
+static uint8_t input_modifier_bit(unsigned short keycode)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kbd_modifier_keys); i++) {
+		if (kbd_modifier_keys[i] == keycode) {
+			return 1 << i;
+		}
+	}
+	return 0;
+}
+
+// Report a key press and release as two frames so neither is merged away
+static void input_tap_key(struct kbd_ctx* ctx, unsigned short keycode)
+{
+	input_report_key(ctx->input_dev, keycode, 1);
+	input_sync(ctx->input_dev);
+	input_report_key(ctx->input_dev, keycode, 0);
+}
+
+// Commit the pending dual-role key to its hold keycode, report lock held
+static void input_dual_role_resolve_hold(struct kbd_ctx* ctx)
+{
+	struct kbd_dual_role *role;
+
+	if (ctx->dual_role_pending < 0) {
+		return;
+	}
+	role = &ctx->dual_roles[ctx->dual_role_pending];
+	role->state = KBD_DUAL_HELD;
+	ctx->dual_role_pending = -1;
+	if (role->hold) {
+		input_report_key(ctx->input_dev, role->hold, 1);
+	}
+}
+
+// Tap-hold handling, returns true if the event belonged to a dual-role key.
+// A tap inside the key's window sends the tap keycode on release. Firmware
+// HOLD/LONG_HOLD, another key pressed first, or a release past the window
+// commits to the hold keycode
+static bool input_dual_role_consumes(struct kbd_ctx* ctx,
+	struct key_fifo_item const* ev)
+{
+	struct kbd_dual_role *role;
+	uint8_t index = ctx->dual_role_index[ev->scancode];
+	unsigned short keycode;
+	uint64_t now;
+
+	// Typing another key while a dual-role key is down means it is held
+	if ((ev->state == KEY_STATE_PRESSED) && (ctx->dual_role_pending >= 0)
+	 && (ctx->dual_roles[ctx->dual_role_pending].scancode != ev->scancode)) {
+		input_dual_role_resolve_hold(ctx);
+	}
+
+	if (index == 0) {
+		return false;
+	}
+	role = &ctx->dual_roles[index - 1];
+	now = ktime_get_boottime_ns();
+
+	switch (ev->state) {
+	case KEY_STATE_PRESSED:
+		if (role->state == KBD_DUAL_IDLE) {
+			input_dual_role_resolve_hold(ctx);
+			role->state = KBD_DUAL_PENDING;
+			role->pressed_at = now;
+			ctx->dual_role_pending = index - 1;
+		}
+		break;
+	case KEY_STATE_HOLD:
+	case KEY_STATE_LONG_HOLD:
+		if (role->state == KBD_DUAL_PENDING) {
+			input_dual_role_resolve_hold(ctx);
+		}
+		break;
+	case KEY_STATE_RELEASED:
+		if (role->state == KBD_DUAL_PENDING) {
+
+			// Held past the window without a hold event is still a hold,
+			// sent as a lone hold key tap. Without a hold key it taps
+			ctx->dual_role_pending = -1;
+			keycode = role->tap;
+			if (role->hold
+			 && (now - role->pressed_at >= (uint64_t)role->tap_ms * NSEC_PER_MSEC)) {
+				keycode = role->hold;
+			}
+			if (keycode) {
+				input_tap_key(ctx, keycode);
+			}
+		} else if ((role->state == KBD_DUAL_HELD) && role->hold) {
+			input_report_key(ctx->input_dev, role->hold, 0);
+		}
+		role->state = KBD_DUAL_IDLE;
+		break;
+	default:
+		break;
+	}
+
+	ctx->last_keypress_at = now;
+	return true;
+}
+
+// Track modifier taps. Modifiers are still reported normally, only a press
+// and release with no other key in between latches them
+static void input_modifiers_track(struct kbd_ctx* ctx,
+	unsigned short keycode, enum pico_key_state state)
+{
+	uint8_t bit = input_modifier_bit(keycode);
+
+	if (!bit) {
+		if (state == KEY_STATE_PRESSED) {
+			ctx->sticky_candidate = 0;
+		}
+		return;
+	}
+
+	if (state == KEY_STATE_PRESSED) {
+		ctx->sticky_down |= bit;
+		ctx->sticky_candidate = bit;
+	} else if (state == KEY_STATE_RELEASED) {
+		ctx->sticky_down &= ~bit;
+
+		// Tapping a latched modifier again unlatches it
+		if (READ_ONCE(ctx->sticky_modifiers) && (ctx->sticky_candidate == bit)) {
+			ctx->sticky_pending ^= bit;
+		}
+		ctx->sticky_candidate = 0;
+	}
+}
+
+// Press latched modifiers that are not physically down ahead of a key press,
+// returns the set that input_modifiers_reset must release
+static uint8_t input_modifiers_apply_pending(struct kbd_ctx* ctx,
+	unsigned short keycode, enum pico_key_state state)
+{
+	uint8_t applied;
+	int i;
+
+	if ((state != KEY_STATE_PRESSED) || input_modifier_bit(keycode)
+	 || !ctx->sticky_pending) {
+		return 0;
+	}
+
+	applied = ctx->sticky_pending & ~ctx->sticky_down;
+	ctx->sticky_pending = 0;
+	for (i = 0; i < ARRAY_SIZE(kbd_modifier_keys); i++) {
+		if (applied & (1 << i)) {
+			input_report_key(ctx->input_dev, kbd_modifier_keys[i], 1);
+		}
+	}
+	return applied;
+}
+
+static void input_modifiers_reset(struct kbd_ctx* ctx, uint8_t applied)
+{
+	int i;
+
+	// Release in a later frame, or the latch and its key would merge away
+	if (applied) {
+		input_sync(ctx->input_dev);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(kbd_modifier_keys); i++) {
+		if (applied & (1 << i)) {
+			input_report_key(ctx->input_dev, kbd_modifier_keys[i], 0);
+		}
+	}
+}
+
+// Handle one FIFO item, returns what was done with it for tracing
+static enum kbd_key_action key_process_event(struct kbd_ctx* ctx,
+	struct key_fifo_item const* ev, unsigned short* mapped)
+{
+	unsigned short keycode;
+	uint8_t sticky;
+
+	// Only handle key pressed, held, or released events
+	if ((ev->state != KEY_STATE_PRESSED) && (ev->state != KEY_STATE_RELEASED)
+	 && (ev->state != KEY_STATE_HOLD) && (ev->state != KEY_STATE_LONG_HOLD)) {
+		return KBD_KEY_IGNORED;
+	}
+
+        /* right shift */
+        if (ev->scancode == 0xA3)
+        {
+            if (ev->state == KEY_STATE_PRESSED)
+            {
+                ctx->mouse_mode = !ctx->mouse_mode;
+                ctx->mouse_move_dir = 0;
+                ctx->mouse_scroll_dir = 0;
+                ctx->mouse_precision = false;
+                ctx->mouse_scroll_mod = false;
+            }
+            return KBD_KEY_MOUSE_TOGGLE;
+        }
+
+        if (ctx->mouse_mode)
+        {
+            switch(ev->scancode)
+            {
+            /* KEY_BACKSPACE */
+/*
+            case '\b':
+                  if (ev->state == KEY_STATE_PRESSED)
+                  {
+                      input_report_abs(ctx->input_dev, ABS_X, 0);
+                      input_report_abs(ctx->input_dev, ABS_Y, 0);
+                  } 
+                  return;
+*/
+            /* KEY_RIGHT */
+            case 0xb7:
+                  mouse_move_key(ctx, MOUSE_MOVE_RIGHT, ev->state,
+                      ctx->mouse_scroll_mod);
+                  return KBD_KEY_MOUSE;
+            /* KEY_LEFT */
+            case 0xb4:
+                  mouse_move_key(ctx, MOUSE_MOVE_LEFT, ev->state,
+                      ctx->mouse_scroll_mod);
+                  return KBD_KEY_MOUSE;
+            /* KEY_DOWN */
+            case 0xb6:
+                  mouse_move_key(ctx, MOUSE_MOVE_DOWN, ev->state,
+                      ctx->mouse_scroll_mod);
+                  return KBD_KEY_MOUSE;
+            /* KEY_UP */
+            case 0xb5:
+                  mouse_move_key(ctx, MOUSE_MOVE_UP, ev->state,
+                      ctx->mouse_scroll_mod);
+                  return KBD_KEY_MOUSE;
+            /* KEY_SEMICOLON, slow pointer while held. Modifiers pass
+               through so ctrl-click and alt-drag keep working */
+            case ';':
+                  ctx->mouse_precision = (ev->state != KEY_STATE_RELEASED);
+                  return KBD_KEY_MOUSE;
+            /* KEY_APOSTROPHE, arrows scroll while held */
+            case '\'':
+                  ctx->mouse_scroll_mod = (ev->state != KEY_STATE_RELEASED);
+                  return KBD_KEY_MOUSE;
+            /* KEY_PAGEUP */
+            case 0xd6:
+                  mouse_move_key(ctx, MOUSE_MOVE_UP, ev->state, true);
+                  return KBD_KEY_MOUSE;
+            /* KEY_PAGEDOWN */
+            case 0xd7:
+                  mouse_move_key(ctx, MOUSE_MOVE_DOWN, ev->state, true);
+                  return KBD_KEY_MOUSE;
+            /* KEY_RIGHTBRACE */
+            case ']':
+                  if ((ev->state == KEY_STATE_PRESSED) || (ev->state == KEY_STATE_RELEASED))
+	              input_report_key(ctx->input_dev, BTN_LEFT, ev->state == KEY_STATE_PRESSED);
+                  return KBD_KEY_MOUSE;
+            /* KEY_LEFTBRACE */
+            case '[':
+                  if ((ev->state == KEY_STATE_PRESSED) || (ev->state == KEY_STATE_RELEASED))
+	              input_report_key(ctx->input_dev, BTN_RIGHT, ev->state == KEY_STATE_PRESSED);
+                  return KBD_KEY_MOUSE;
+            default:
+                     break;
+            }
+        }
+
+	// Post key scan event
+	input_event(ctx->input_dev, EV_MSC, MSC_SCAN, ev->scancode);
+
+	// Dual-role keys report their own tap or hold keycode
+	if (input_dual_role_consumes(ctx, ev)) {
+		return KBD_KEY_DUAL_ROLE;
+	}
+
+	// Map input scancode to Linux input keycode, may be remapped at runtime
+	keycode = READ_ONCE(ctx->keycode_map[ev->scancode]);
+	*mapped = keycode;
+
+	//keycode = ev->scancode;
+	dev_info_fe(&ctx->i2c_client->dev,
+		"%s state %d, scancode %d mapped to keycode %d\n",
+		__func__, ev->state, ev->scancode, keycode);
+	//printk("state %d, scancode %d mapped to keycode %d\n",
+	//	ev->state, ev->scancode, keycode);
+
+	// Scancode mapped to ignored keycode
+	if (keycode == 0) {
+		return KBD_KEY_IGNORED;
+
+	// Scancode converted to keycode not in map
+	} else if (keycode == KEY_UNKNOWN) {
 		dev_warn(&ctx->i2c_client->dev,
 			"%s Could not get Keycode for Scancode: [0x%02X]\n",
 			__func__, ev->scancode);
-		return;
+		return KBD_KEY_UNMAPPED;
 	}
 
 	// Update last keypress time
-	g_ctx->last_keypress_at = ktime_get_boottime_ns();
+	ctx->last_keypress_at = ktime_get_boottime_ns();
 
 /*
 	if (keycode == KEY_STOP) {
@@ -360,406 +1365,2633 @@ static void key_report_event(struct kbd_ctx* ctx,
 	}
     */
 
+	// Ignore hold keys at this point
+	if ((ev->state == KEY_STATE_HOLD) || (ev->state == KEY_STATE_LONG_HOLD)) {
+		return KBD_KEY_HOLD;
+	}
+
 	// Subsystem key handling
     /*
 	if (input_fw_consumes_keycode(ctx, &keycode, keycode, ev->state)
 	 || input_touch_consumes_keycode(ctx, &keycode, keycode, ev->state)
-	 || input_modifiers_consumes_keycode(ctx, &keycode, keycode, ev->state)
 	 || input_meta_consumes_keycode(ctx, &keycode, keycode, ev->state)) {
 		return;
 	}
     */
+	input_modifiers_track(ctx, keycode, ev->state);
+
+	// Apply pending sticky modifiers
+	sticky = input_modifiers_apply_pending(ctx, keycode, ev->state);
+
+	// Report key to input system
+	input_report_key(ctx->input_dev, keycode, ev->state == KEY_STATE_PRESSED);
+
+	// Reset sticky modifiers
+	input_modifiers_reset(ctx, sticky);
+
+	return KBD_KEY_REPORTED;
+}
+
+static void key_report_event(struct kbd_ctx* ctx,
+	struct key_fifo_item const* ev)
+{
+	unsigned short keycode = 0;
+	enum kbd_key_action action;
+
+	action = key_process_event(ctx, ev, &keycode);
+	trace_picocalc_key_report(ctx->i2c_client, ev->scancode, ev->state,
+		keycode, ctx->mouse_mode, action);
+}
+
+static void input_workqueue_handler(struct kthread_work *work_struct_ptr);
+
+// Poll timer expired, hand the FIFO drain to the dedicated poller thread
+static enum hrtimer_restart kbd_timer_function(struct hrtimer *timer)
+{
+	struct kbd_ctx *ctx = container_of(timer, struct kbd_ctx, poll_timer);
+
+	ctx->poll_fired_at = ktime_get();
+	kthread_queue_work(ctx->poll_worker, &ctx->work_struct);
+
+	return HRTIMER_NORESTART;
+}
+
+// Pick the next poll tier from idle time and re-arm the poll timer
+static void kbd_poll_rearm(struct kbd_ctx* ctx, bool active)
+{
+	uint64_t now, idle_ms;
+	unsigned int interval_ms;
+	enum kbd_poll_tier tier;
+
+	now = ktime_get_boottime_ns();
+	if (active) {
+		ctx->last_activity_at = now;
+	}
+	idle_ms = div_u64(now - ctx->last_activity_at, NSEC_PER_MSEC);
+
+	// Decay through slower tiers while idle, first activity jumps back to fast
+	tier = KBD_POLL_FAST;
+	if (idle_ms >= READ_ONCE(ctx->poll_after_ms[KBD_POLL_SLOW])) {
+		tier = KBD_POLL_SLOW;
+	} else if (idle_ms >= READ_ONCE(ctx->poll_after_ms[KBD_POLL_MEDIUM])) {
+		tier = KBD_POLL_MEDIUM;
+	}
+	ctx->poll_tier = tier;
+
+	// Never poll slower than the floor, it bounds first-key latency
+	interval_ms = min(READ_ONCE(ctx->poll_interval_ms[tier]),
+		READ_ONCE(ctx->poll_floor_ms));
+
+	// Interrupts bound latency instead, poll only as a safety net
+	if (READ_ONCE(ctx->irq_mode)) {
+		interval_ms = KBD_POLL_IRQ_MS;
+	}
+
+	// Poll fast for a while after an overflow, interrupts included
+	if (ctx->overflow_at && (now - ctx->overflow_at
+		< (uint64_t)READ_ONCE(ctx->poll_after_ms[KBD_POLL_MEDIUM]) * NSEC_PER_MSEC)) {
+		tier = KBD_POLL_FAST;
+		ctx->poll_tier = tier;
+		interval_ms = READ_ONCE(ctx->poll_interval_ms[KBD_POLL_FAST]);
+	}
+
+	// Slower tiers allow some slack so the wakeup can be coalesced
+	if (READ_ONCE(ctx->polling)) {
+		hrtimer_start_range_ns(&ctx->poll_timer, ms_to_ktime(interval_ms),
+			(tier == KBD_POLL_FAST) ? 0 : (uint64_t)interval_ms * NSEC_PER_MSEC / 8,
+			HRTIMER_MODE_REL);
+	}
+}
+
+// Stop polling. The worker re-arms the timer, so both are torn down twice
+static void kbd_poll_stop(struct kbd_ctx* ctx)
+{
+	WRITE_ONCE(ctx->polling, false);
+	hrtimer_cancel(&ctx->poll_timer);
+	kthread_cancel_work_sync(&ctx->work_struct);
+	hrtimer_cancel(&ctx->poll_timer);
+	kthread_cancel_work_sync(&ctx->work_struct);
+}
+
+// Apply CPU affinity and scheduling policy to the poller thread
+static int kbd_poll_apply_sched(struct kbd_ctx* ctx)
+{
+	int rc;
+	struct sched_attr attr = {
+		.size = sizeof(attr),
+	};
+
+	if (READ_ONCE(ctx->poll_priority) > 0) {
+		attr.sched_policy = SCHED_FIFO;
+		attr.sched_priority = READ_ONCE(ctx->poll_priority);
+	} else {
+		attr.sched_policy = SCHED_NORMAL;
+	}
+
+	if ((rc = sched_setattr_nocheck(ctx->poll_worker->task, &attr))) {
+		return rc;
+	}
+
+	return set_cpus_allowed_ptr(ctx->poll_worker->task, &ctx->poll_cpus);
+}
+
+static void kbd_poll_worker_destroy(void *data)
+{
+	struct kbd_ctx *ctx = data;
+
+	kthread_destroy_worker(ctx->poll_worker);
+}
+
+// Create the poller thread and its timer
+static int kbd_poll_probe(struct i2c_client* i2c_client, struct kbd_ctx* ctx)
+{
+	int rc;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 14, 0)
+	ctx->poll_worker = kthread_create_worker(0, "%s_kbd", ctx->name);
+#else
+	ctx->poll_worker = kthread_run_worker(0, "%s_kbd", ctx->name);
+#endif
+	if (IS_ERR(ctx->poll_worker)) {
+		dev_err(&i2c_client->dev,
+			"%s Could not create poller thread\n", __func__);
+		return PTR_ERR(ctx->poll_worker);
+	}
+	if ((rc = devm_add_action_or_reset(&i2c_client->dev,
+		kbd_poll_worker_destroy, ctx))) {
+		return rc;
+	}
+
+	// High priority on any CPU by default
+	ctx->poll_priority = KBD_POLL_PRIORITY;
+	cpumask_copy(&ctx->poll_cpus, cpu_possible_mask);
+	if ((rc = kbd_poll_apply_sched(ctx))) {
+		dev_warn(&i2c_client->dev,
+			"%s Could not set poller scheduling, error: %d\n", __func__, rc);
+	}
+
+	kthread_init_work(&ctx->work_struct, input_workqueue_handler);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
+	hrtimer_init(&ctx->poll_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	ctx->poll_timer.function = kbd_timer_function;
+#else
+	hrtimer_setup(&ctx->poll_timer, kbd_timer_function, CLOCK_MONOTONIC,
+		HRTIMER_MODE_REL);
+#endif
+
+	return 0;
+}
+
+// Report one FIFO item, report lock held. A key that changes twice in one
+// frame would only show its final state, so a fast tap or repeat starts a
+// new frame
+static void input_report_item(struct kbd_ctx* ctx,
+	struct key_fifo_item const* ev, unsigned long* frame_keys)
+{
+	if ((ev->state == KEY_STATE_PRESSED) || (ev->state == KEY_STATE_RELEASED)) {
+		if (__test_and_set_bit(ev->scancode, frame_keys)) {
+			input_sync(ctx->input_dev);
+			bitmap_zero(frame_keys, NUM_KEYCODES);
+			__set_bit(ev->scancode, frame_keys);
+			ctx->frames_split++;
+		}
+	}
+
+	key_report_event(ctx, ev);
+}
+
+// Report a release firmware never sent, report lock held
+static void input_release_lost(struct kbd_ctx* ctx, uint8_t scancode,
+	unsigned long* frame_keys)
+{
+	struct key_fifo_item release = {
+		.state = KEY_STATE_RELEASED,
+		.scancode = scancode,
+	};
+
+	input_report_item(ctx, &release, frame_keys);
+	ctx->overflow_released++;
+}
+
+// Check one FIFO item against the keys firmware reported down, report lock
+// held. Returns true if events for this key were lost. A second press means
+// the release went missing, so that release is reported first
+static bool input_track_item(struct kbd_ctx* ctx,
+	struct key_fifo_item const* ev, unsigned long* frame_keys)
+{
+	switch (ev->state) {
+	case KEY_STATE_PRESSED:
+		if (__test_and_set_bit(ev->scancode, ctx->keys_down)) {
+			input_release_lost(ctx, ev->scancode, frame_keys);
+			return true;
+		}
+		break;
+	case KEY_STATE_HOLD:
+	case KEY_STATE_LONG_HOLD:
+		return !__test_and_set_bit(ev->scancode, ctx->keys_down);
+	case KEY_STATE_RELEASED:
+		return !__test_and_clear_bit(ev->scancode, ctx->keys_down);
+	default:
+		break;
+	}
+
+	return false;
+}
+
+// Report the items of one FIFO read in as few frames as possible, the
+// pointer timer reports in between drains. Sets *inconsistent if events for
+// a key were lost
+static void input_report_fifo(struct kbd_ctx* ctx, bool* inconsistent)
+{
+	DECLARE_BITMAP(frame_keys, NUM_KEYCODES);
+	struct key_fifo_item const* ev;
+	uint8_t fifo_idx;
+
+	if (ctx->key_fifo_count == 0) {
+		return;
+	}
+
+	bitmap_zero(frame_keys, NUM_KEYCODES);
+	spin_lock_bh(&ctx->report_lock);
+	for (fifo_idx = 0; fifo_idx < ctx->key_fifo_count; fifo_idx++) {
+		ev = &ctx->key_fifo_data[fifo_idx];
+		if (input_track_item(ctx, ev, frame_keys)) {
+			*inconsistent = true;
+		}
+		input_report_item(ctx, ev, frame_keys);
+	}
+
+	// Synchronize input system
+	input_sync(ctx->input_dev);
+	spin_unlock_bh(&ctx->report_lock);
+}
+
+// Read the key FIFO once and report all items, returns the number read
+static uint8_t input_drain_pass(struct kbd_ctx* ctx, bool* inconsistent)
+{
+	uint8_t count;
+	uint64_t start = kbd_stats_now();
+	uint64_t report_start, report_ns, budget_ns;
+
+	input_fw_read_fifo(ctx);
+	count = ctx->key_fifo_count;
+
+	report_start = kbd_stats_now();
+	input_report_fifo(ctx, inconsistent);
+
+	if (static_branch_unlikely(&kbd_stats_enabled) && READ_ONCE(ctx->stats_enabled)) {
+		kbd_stats_record_since(ctx, KBD_HIST_DRAIN, start);
+		kbd_stats_record(ctx, KBD_HIST_EVENTS, count);
+		if (count) {
+			this_cpu_inc(ctx->stats->productive_polls);
+		} else {
+			this_cpu_inc(ctx->stats->empty_polls);
+		}
+
+		// Check CPU cost of reporting against the budget, which is for a
+		// full FIFO and scaled down for smaller drains
+		if (count && report_start) {
+			report_ns = ktime_get_ns() - report_start;
+			budget_ns = div_u64((uint64_t)READ_ONCE(ctx->drain_budget_us)
+				* NSEC_PER_USEC * count, KBD_FIFO_SIZE);
+			if (report_ns > budget_ns) {
+				ctx->drain_over_budget++;
+				dev_warn_ratelimited(&ctx->i2c_client->dev,
+					"%s Reporting %u events took %llu ns, over %llu ns budget\n",
+					__func__, count, report_ns, budget_ns);
+			}
+		}
+	}
+
+	// Reset pending FIFO count
+	ctx->key_fifo_count = 0;
+
+	return count;
+}
+
+// Events were lost, or may have been. Keys are released once the FIFO has
+// been caught up with, as their release may have been among the lost events
+static void input_overflow_recover(struct kbd_ctx* ctx, bool full,
+	bool caught_up, bool flagged, bool inconsistent)
+{
+	DECLARE_BITMAP(frame_keys, NUM_KEYCODES);
+	unsigned int scancode, released = 0;
+
+	// One episode lasts until the FIFO is caught up with
+	if ((full || inconsistent) && !ctx->overflow_pending) {
+		ctx->overflows++;
+	}
+	if (full && !ctx->overflow_pending) {
+		ctx->overflow_pending = true;
+		ctx->overflow_full++;
+	}
+	if (flagged) {
+		ctx->overflow_flagged++;
+	}
+	if (inconsistent) {
+		ctx->overflow_inconsistent++;
+	}
+	ctx->overflow_at = ktime_get_boottime_ns();
+
+	// Still full after back-to-back drains, the next poll continues
+	if (!caught_up) {
+		return;
+	}
+
+	if (ctx->overflow_pending) {
+		bitmap_zero(frame_keys, NUM_KEYCODES);
+		spin_lock_bh(&ctx->report_lock);
+		for_each_set_bit(scancode, ctx->keys_down, NUM_KEYCODES) {
+			input_release_lost(ctx, scancode, frame_keys);
+			released++;
+		}
+		bitmap_zero(ctx->keys_down, NUM_KEYCODES);
+		if (released) {
+			input_sync(ctx->input_dev);
+		}
+		spin_unlock_bh(&ctx->report_lock);
+
+		ctx->overflow_pending = false;
+		ctx->overflow_recovered++;
+	}
+
+	if (inconsistent || released) {
+		dev_warn_ratelimited(&ctx->i2c_client->dev,
+			"%s Key events lost, released %u keys\n", __func__, released);
+	}
+	trace_picocalc_fifo_overflow(ctx->i2c_client, full, flagged, inconsistent,
+		released);
+}
+
+// Read the key FIFO and report all items, returns true if any were pending.
+// A full FIFO may have dropped events behind it, so it is read again right
+// away and the poller stays in the fast tier for a while
+static bool input_drain_and_report(struct kbd_ctx* ctx)
+{
+	unsigned int passes = 0, int_flags;
+	uint8_t count;
+	bool active = false, full = false, flagged = false, inconsistent = false;
+	uint64_t keypress_at = ctx->last_keypress_at;
+
+	do {
+		count = input_drain_pass(ctx, &inconsistent);
+		active |= (count > 0);
+		full = (count >= KBD_FIFO_SIZE);
+	} while (full && (++passes < KBD_DRAIN_PASSES));
+
+	// Firmware flags dropped events when overflow interrupts are enabled
+	if (passes && ctx->overflow_int
+	 && !regmap_read(ctx->regmap, REG_ID_INT, &int_flags)
+	 && (int_flags & INT_OVERFLOW)) {
+		flagged = true;
+		regmap_write(ctx->regmap, REG_ID_INT, 0);
+	}
+
+	if (passes || inconsistent || ctx->overflow_pending) {
+		input_overflow_recover(ctx, passes > 0, !full, flagged, inconsistent);
+	}
+
+	// Wake poll() on last_keypress, once per drain however many keys came
+	if ((ctx->last_keypress_at != keypress_at) && ctx->last_keypress_kn) {
+		sysfs_notify_dirent(ctx->last_keypress_kn);
+	}
+
+	return active;
+}
+
+static void battery_read_complete(struct kbd_ctx* ctx, int raw);
+
+// Number of transactions waiting in the queue, lock held
+static inline unsigned int kbd_xfer_depth_locked(struct kbd_ctx* ctx)
+{
+	return hweight_long(ctx->xfer_write_pending)
+		+ hweight_long(ctx->xfer_read_pending);
+}
+
+// Make sure the next poll cycle, which flushes the queue, comes soon
+static void kbd_xfer_kick(struct kbd_ctx* ctx)
+{
+	// Held until resume, which flushes the queue
+	if (READ_ONCE(ctx->suspended)) {
+		return;
+	}
+
+	// Nobody has the keyboard open, run one poll cycle just for the queue.
+	// The cycle measures its scheduling delay from now
+	if (!READ_ONCE(ctx->polling)) {
+		ctx->poll_fired_at = ktime_get();
+		kthread_queue_work(ctx->poll_worker, &ctx->work_struct);
+		return;
+	}
+
+	if (hrtimer_get_remaining(&ctx->poll_timer) > ms_to_ktime(KBD_XFER_FLUSH_MS)) {
+		hrtimer_start(&ctx->poll_timer, ms_to_ktime(KBD_XFER_FLUSH_MS),
+			HRTIMER_MODE_REL);
+	}
+}
+
+// Queue a register write, a pending write to the same register is replaced
+static void kbd_xfer_write(struct kbd_ctx* ctx, uint8_t reg, uint8_t value)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->xfer_lock, flags);
+	if (__test_and_set_bit(reg, &ctx->xfer_write_pending)) {
+		ctx->xfer_coalesced++;
+	}
+	ctx->xfer_write_value[reg] = value;
+	ctx->xfer_queued++;
+	ctx->xfer_depth_max = max(ctx->xfer_depth_max, kbd_xfer_depth_locked(ctx));
+	spin_unlock_irqrestore(&ctx->xfer_lock, flags);
+
+	kbd_xfer_kick(ctx);
+}
+
+// Queue a low priority register read, it rides along the next poll cycle
+static void kbd_xfer_read(struct kbd_ctx* ctx, uint8_t reg)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->xfer_lock, flags);
+	__set_bit(reg, &ctx->xfer_read_pending);
+	ctx->xfer_depth_max = max(ctx->xfer_depth_max, kbd_xfer_depth_locked(ctx));
+	spin_unlock_irqrestore(&ctx->xfer_lock, flags);
+}
+
+// Run queued transactions, called after the FIFO drain with drain_lock held
+static void kbd_xfer_flush(struct kbd_ctx* ctx)
+{
+	unsigned long flags, writes, reads;
+	uint8_t values[KBD_NUM_REGS];
+	unsigned int reg, value;
+	bool changed;
+	int rc;
+
+	spin_lock_irqsave(&ctx->xfer_lock, flags);
+	writes = ctx->xfer_write_pending;
+	reads = ctx->xfer_read_pending;
+	memcpy(values, ctx->xfer_write_value, sizeof(values));
+	ctx->xfer_write_pending = 0;
+	ctx->xfer_read_pending = 0;
+	spin_unlock_irqrestore(&ctx->xfer_lock, flags);
+
+	// Latest value of each register only. Cached registers skip a write of
+	// the value they already hold
+	for_each_set_bit(reg, &writes, KBD_NUM_REGS) {
+		changed = true;
+		if (kbd_regmap_volatile(NULL, reg)) {
+			rc = regmap_write(ctx->regmap, reg, values[reg]);
+		} else {
+			rc = regmap_update_bits_check(ctx->regmap, reg, 0xff, values[reg],
+				&changed);
+		}
+		if (rc) {
+			continue;
+		}
+		if (changed) {
+			ctx->xfer_issued++;
+		} else {
+			ctx->xfer_cached++;
+		}
+	}
+
+	for_each_set_bit(reg, &reads, KBD_NUM_REGS) {
+		if (regmap_read(ctx->regmap, reg, &value)) {
+			continue;
+		}
+		ctx->xfer_reads++;
+
+		switch (reg) {
+		case REG_ID_BAT:
+			battery_read_complete(ctx, value);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+static void input_workqueue_handler(struct kthread_work *work_struct_ptr)
+{
+	struct kbd_ctx *ctx;
+	bool active;
+	uint64_t delay_ns;
+
+	// Get keyboard context from work struct
+	ctx = container_of(work_struct_ptr, struct kbd_ctx, work_struct);
+
+	mutex_lock(&ctx->drain_lock);
+
+	// Scheduling delay from timer expiry to poller thread start
+	delay_ns = ktime_to_ns(ktime_sub(ktime_get(), ctx->poll_fired_at));
+	if (ctx->sched_delay_count++ == 0 || delay_ns < ctx->sched_delay_min_ns) {
+		ctx->sched_delay_min_ns = delay_ns;
+	}
+	if (delay_ns > ctx->sched_delay_max_ns) {
+		ctx->sched_delay_max_ns = delay_ns;
+	}
+	ctx->sched_delay_total_ns += delay_ns;
+	kbd_stats_record(ctx, KBD_HIST_SCHED_DELAY, delay_ns);
+
+	ctx->poll_count[ctx->poll_tier]++;
+
+	active = input_drain_and_report(ctx);
+
+	// Key FIFO goes first, then queued backlight writes and battery reads
+	kbd_xfer_flush(ctx);
+
+	// Held pointer keys count as activity so their release is seen promptly
+	kbd_poll_rearm(ctx, active || ctx->mouse_move_dir || ctx->mouse_scroll_dir);
+
+	mutex_unlock(&ctx->drain_lock);
+}
+
+// Key interrupt from firmware, drain the FIFO right away
+static irqreturn_t input_irq_handler(int irq, void *param)
+{
+	struct kbd_ctx *ctx = param;
+	bool active, asserted;
+
+	// Key press woke the system, the FIFO is read after resume. The flag
+	// cannot be cleared without the bus, so mask the line until then or a
+	// level-triggered interrupt fires again right away
+	if (READ_ONCE(ctx->suspended)) {
+		pm_wakeup_event(&ctx->i2c_client->dev, 0);
+		if (!ctx->irq_wake_masked) {
+			disable_irq_nosync(irq);
+			ctx->irq_wake_masked = true;
+		}
+		return IRQ_HANDLED;
+	}
+
+	mutex_lock(&ctx->drain_lock);
+
+	ctx->irq_count++;
+
+	active = input_drain_and_report(ctx);
+
+	// Clear client interrupt flag
+	regmap_write(ctx->regmap, REG_ID_INT, 0);
+
+	// Line should be released once the FIFO is empty and the flag cleared
+	asserted = ctx->irq_gpio && (gpiod_get_value_cansleep(ctx->irq_gpio) > 0);
+	if (active && !asserted) {
+		ctx->irq_idle_count = 0;
+	} else if (++ctx->irq_idle_count >= KBD_IRQ_STORM_LIMIT) {
+
+		// Line stuck asserted or firing with nothing to read, fall back to polling
+		dev_warn(&ctx->i2c_client->dev,
+			"%s IRQ %d fired %u times without key events, falling back to polling\n",
+			__func__, irq, ctx->irq_idle_count);
+		disable_irq_nosync(irq);
+		ctx->irq_mode = false;
+		active = true;
+	}
+
+	// Restart key polling tiers from this activity
+	if (active) {
+		kbd_poll_rearm(ctx, true);
+	}
+
+	mutex_unlock(&ctx->drain_lock);
+
+	return IRQ_HANDLED;
+}
+
+// Set up optional interrupt delivery from "interrupts" or "irq-gpios"
+static int input_irq_probe(struct i2c_client* i2c_client, struct kbd_ctx* ctx)
+{
+	int rc, irq;
+	unsigned long irq_flags;
+
+	ctx->irq_mode = false;
+
+	ctx->irq_gpio = devm_gpiod_get_optional(&i2c_client->dev, "irq", GPIOD_IN);
+	if (IS_ERR(ctx->irq_gpio)) {
+		return dev_err_probe(&i2c_client->dev, PTR_ERR(ctx->irq_gpio),
+			"%s Could not get irq GPIO\n", __func__);
+	}
+
+	// Interrupt from the "interrupts" property keeps its trigger type
+	irq = i2c_client->irq;
+	irq_flags = IRQF_ONESHOT;
+	if ((irq <= 0) && ctx->irq_gpio) {
+		irq = gpiod_to_irq(ctx->irq_gpio);
+		irq_flags |= IRQF_TRIGGER_FALLING;
+	}
+	if (irq <= 0) {
+		dev_info(&i2c_client->dev,
+			"%s No interrupt described, polling key FIFO\n", __func__);
+		return 0;
+	}
+
+	if ((rc = devm_request_threaded_irq(&i2c_client->dev,
+		irq, NULL, input_irq_handler, irq_flags,
+		i2c_client->name, ctx))) {
+
+		dev_warn(&i2c_client->dev,
+			"Could not claim IRQ %d; error %d, polling key FIFO\n", irq, rc);
+		return 0;
+	}
+
+	// Enable key interrupts in firmware, overflow ones were set up before
+	if (regmap_update_bits(ctx->regmap, REG_ID_CFG, CFG_KEY_INT, CFG_KEY_INT)) {
+
+		dev_warn(&i2c_client->dev,
+			"%s Could not enable firmware interrupts, polling key FIFO\n",
+			__func__);
+		devm_free_irq(&i2c_client->dev, irq, ctx);
+		return 0;
+	}
+
+	ctx->irq = irq;
+	ctx->irq_mode = true;
+	dev_info(&i2c_client->dev, "%s Using IRQ %d for key events\n", __func__, irq);
+
+	// Stays off until the device is opened
+	disable_irq(irq);
+	ctx->irq_disabled = true;
+
+	// A key press can wake the system, toggled through power/wakeup
+	if (device_property_read_bool(&i2c_client->dev, "wakeup-source")) {
+		device_init_wakeup(&i2c_client->dev, true);
+	}
+
+	return 0;
+}
+
+// Enable or disable the key IRQ once, no-op when polling
+static void kbd_irq_enable(struct kbd_ctx* ctx, bool enable)
+{
+	if (!ctx->irq_mode || (enable != ctx->irq_disabled)) {
+		return;
+	}
+	if (enable) {
+		enable_irq(ctx->irq);
+	} else {
+		disable_irq(ctx->irq);
+	}
+	ctx->irq_disabled = !enable;
+}
+
+static int picocalc_kbd_runtime_resume(struct device *dev);
+
+// Input handlers opening the device resume it, which starts polling
+static int kbd_input_open(struct input_dev *input_dev)
+{
+	struct kbd_ctx *ctx = input_get_drvdata(input_dev);
+
+	return pm_runtime_resume_and_get(&ctx->i2c_client->dev);
+}
+
+static void kbd_input_close(struct input_dev *input_dev)
+{
+	struct kbd_ctx *ctx = input_get_drvdata(input_dev);
+
+	pm_runtime_mark_last_busy(&ctx->i2c_client->dev);
+	pm_runtime_put_autosuspend(&ctx->i2c_client->dev);
+}
+
+// Instance numbers, released when the device goes away
+static DEFINE_IDA(picocalc_ida);
+
+static void kbd_ctx_release_id(void *data)
+{
+	struct kbd_ctx *ctx = data;
+
+	ida_free(&picocalc_ida, ctx->id);
+}
+
+// Keys, buttons and wheel axes the device reports. Autorepeat is left to
+// the caller
+static void input_set_key_capabilities(struct kbd_ctx* ctx)
+{
+	int i;
+
+	// Initialize input device keycodes, the default setkeycode handler
+	// rewrites the per-device map and keeps keybit in step with it
+	ctx->input_dev->keycode = ctx->keycode_map;
+	ctx->input_dev->keycodesize = sizeof(ctx->keycode_map[0]);
+	ctx->input_dev->keycodemax = NUM_KEYCODES;
+
+	// Set input device keycode bits
+	for (i = 0; i < NUM_KEYCODES; i++) {
+		__set_bit(ctx->keycode_map[i], ctx->input_dev->keybit);
+	}
+	__clear_bit(KEY_RESERVED, ctx->input_dev->keybit);
+	__set_bit(EV_KEY, ctx->input_dev->evbit);
+
+	// Set input device capabilities
+	input_set_capability(ctx->input_dev, EV_MSC, MSC_SCAN);
+	input_set_capability(ctx->input_dev, EV_REL, REL_X);
+	input_set_capability(ctx->input_dev, EV_REL, REL_Y);
+	input_set_capability(ctx->input_dev, EV_REL, REL_WHEEL);
+	input_set_capability(ctx->input_dev, EV_REL, REL_HWHEEL);
+	input_set_capability(ctx->input_dev, EV_REL, REL_WHEEL_HI_RES);
+	input_set_capability(ctx->input_dev, EV_REL, REL_HWHEEL_HI_RES);
+/*
+	input_set_capability(ctx->input_dev, EV_ABS, ABS_X);
+	input_set_capability(ctx->input_dev, EV_ABS, ABS_Y);
+        input_set_abs_params(ctx->input_dev, ABS_X, 0, 320, 4, 8);
+        input_set_abs_params(ctx->input_dev, ABS_Y, 0, 320, 4, 8);
+*/
+	input_set_capability(ctx->input_dev, EV_KEY, BTN_LEFT);
+	input_set_capability(ctx->input_dev, EV_KEY, BTN_RIGHT);
+}
+
+int input_probe(struct i2c_client* i2c_client)
+{
+	struct kbd_ctx *ctx;
+	int rc;
+
+	// Allocate keyboard context (managed by device lifetime)
+	ctx = devm_kzalloc(&i2c_client->dev, sizeof(*ctx), GFP_KERNEL);
+	if (!ctx) {
+		return -ENOMEM;
+	}
+
+	// First keyboard keeps the historic names, later ones get a number
+	if ((rc = ida_alloc(&picocalc_ida, GFP_KERNEL)) < 0) {
+		return rc;
+	}
+	ctx->id = rc;
+	if ((rc = devm_add_action_or_reset(&i2c_client->dev, kbd_ctx_release_id, ctx))) {
+		return rc;
+	}
+	if (ctx->id == 0) {
+		strscpy(ctx->name, "picocalc", sizeof(ctx->name));
+	} else {
+		snprintf(ctx->name, sizeof(ctx->name), "picocalc%d", ctx->id);
+	}
+
+	// Per-CPU statistics, looked up from the I2C client by the bus helpers
+	ctx->stats = devm_alloc_percpu(&i2c_client->dev, struct kbd_stats);
+	if (!ctx->stats) {
+		return -ENOMEM;
+	}
+	i2c_set_clientdata(i2c_client, ctx);
+
+	// Allocate and copy keycode array
+	ctx->keycode_map = devm_kmemdup(&i2c_client->dev, keycodes, sizeof(keycodes),
+		GFP_KERNEL);
+	if (!ctx->keycode_map) {
+		return -ENOMEM;
+	}
+
+	// Initialize keyboard context
+	ctx->i2c_client = i2c_client;
+	ctx->last_keypress_at = ktime_get_boottime_ns();
+	ctx->last_activity_at = ctx->last_keypress_at;
+
+	// All register access goes through the map, which also shows up in
+	// debugfs under regmap/
+	ctx->regmap = devm_regmap_init(&i2c_client->dev, NULL, i2c_client,
+		&kbd_regmap_config);
+	if (IS_ERR(ctx->regmap)) {
+		return dev_err_probe(&i2c_client->dev, PTR_ERR(ctx->regmap),
+			"%s Could not set up register map\n", __func__);
+	}
+
+	// Initialize adaptive poll tiers
+	ctx->poll_tier = KBD_POLL_FAST;
+	ctx->poll_interval_ms[KBD_POLL_FAST] = KBD_POLL_FAST_MS;
+	ctx->poll_interval_ms[KBD_POLL_MEDIUM] = KBD_POLL_MEDIUM_MS;
+	ctx->poll_interval_ms[KBD_POLL_SLOW] = KBD_POLL_SLOW_MS;
+	ctx->poll_after_ms[KBD_POLL_FAST] = 0;
+	ctx->poll_after_ms[KBD_POLL_MEDIUM] = KBD_POLL_MEDIUM_AFTER_MS;
+	ctx->poll_after_ms[KBD_POLL_SLOW] = KBD_POLL_SLOW_AFTER_MS;
+	ctx->poll_floor_ms = KBD_POLL_FLOOR_MS;
+	ctx->drain_budget_us = KBD_DRAIN_BUDGET_US;
+
+	// No dual-role keys until configured
+	ctx->dual_role_pending = -1;
+	ctx->tap_hold_ms = KBD_TAP_HOLD_MS;
+
+	// Run subsystem probes
+	input_fw_probe(i2c_client, ctx);
+    /*
+	if ((rc = input_rtc_probe(i2c_client, ctx))) {
+		dev_err(&i2c_client->dev, "picocalc_kbd: input_rtc_probe failed\n");
+		return rc;
+	}
+	if ((rc = input_display_probe(i2c_client, ctx))) {
+		dev_err(&i2c_client->dev, "picocalc_kbd: input_display_probe failed\n");
+		return rc;
+	}
+	if ((rc = input_modifiers_probe(i2c_client, ctx))) {
+		dev_err(&i2c_client->dev, "picocalc_kbd: input_modifiers_probe failed\n");
+		return rc;
+	}
+	if ((rc = input_touch_probe(i2c_client, ctx))) {
+		dev_err(&i2c_client->dev, "picocalc_kbd: input_touch_probe failed\n");
+		return rc;
+	}
+	if ((rc = input_meta_probe(i2c_client, ctx))) {
+		dev_err(&i2c_client->dev, "picocalc_kbd: input_meta_probe failed\n");
+		return rc;
+	}
+    */
+
+	// Allocate input device
+	if ((ctx->input_dev = devm_input_allocate_device(&i2c_client->dev)) == NULL) {
+		dev_err(&i2c_client->dev,
+			"%s Could not devm_input_allocate_device BBQX0KBD.\n", __func__);
+		return -ENOMEM;
+	}
+
+	// Initialize input device
+	ctx->input_dev->name = i2c_client->name;
+	ctx->input_dev->open = kbd_input_open;
+	ctx->input_dev->close = kbd_input_close;
+	input_set_drvdata(ctx->input_dev, ctx);
+	ctx->input_dev->id.bustype = KBD_BUS_TYPE;
+	ctx->input_dev->id.vendor  = KBD_VENDOR_ID;
+	ctx->input_dev->id.product = KBD_PRODUCT_ID;
+	ctx->input_dev->id.version = KBD_VERSION_ID;
+
+	input_set_key_capabilities(ctx);
+	__set_bit(EV_REP, ctx->input_dev->evbit);
+
+        ctx->mouse_mode = FALSE;
+        ctx->mouse_move_dir = 0;
+
+	// Pointer engine reports from softirq context on its own timer
+	spin_lock_init(&ctx->report_lock);
+	ctx->mouse_rate_hz = MOUSE_RATE_HZ;
+	ctx->mouse_speed_min = MOUSE_SPEED_MIN;
+	ctx->mouse_speed_max = MOUSE_SPEED_MAX;
+	ctx->mouse_accel = MOUSE_ACCEL;
+	ctx->mouse_precision_pct = MOUSE_PRECISION_PCT;
+	ctx->scroll_speed_min = SCROLL_SPEED_MIN;
+	ctx->scroll_speed_max = SCROLL_SPEED_MAX;
+	ctx->scroll_accel = SCROLL_ACCEL;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
+	hrtimer_init(&ctx->mouse_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+	ctx->mouse_timer.function = mouse_timer_function;
+#else
+	hrtimer_setup(&ctx->mouse_timer, mouse_timer_function, CLOCK_MONOTONIC,
+		HRTIMER_MODE_REL_SOFT);
+#endif
+
+	mutex_init(&ctx->drain_lock);
+	spin_lock_init(&ctx->xfer_lock);
+	if ((rc = kbd_poll_probe(i2c_client, ctx))) {
+		return rc;
+	}
+
+	// Request IRQ handler for I2C client, falls back to polling without one
+	if ((rc = input_irq_probe(i2c_client, ctx))) {
+		return rc;
+	}
+
+	// Polling starts when the first input handler opens the device
+	pm_runtime_set_autosuspend_delay(&i2c_client->dev, KBD_AUTOSUSPEND_MS);
+	pm_runtime_use_autosuspend(&i2c_client->dev);
+	if ((rc = devm_pm_runtime_enable(&i2c_client->dev))) {
+		return rc;
+	}
+
+	// Without runtime PM the device simply stays active
+	if (!IS_ENABLED(CONFIG_PM)) {
+		picocalc_kbd_runtime_resume(&i2c_client->dev);
+	}
+
+	// Register input device with input subsystem
+	dev_info(&i2c_client->dev,
+		"%s registering input device", __func__);
+	if ((rc = input_register_device(ctx->input_dev))) {
+		dev_err(&i2c_client->dev,
+			"Failed to register input device, error: %d\n", rc);
+		return rc;
+	}
+
+	return 0;
+}
+
+void input_shutdown(struct i2c_client* i2c_client)
+{
+	struct kbd_ctx *ctx = i2c_get_clientdata(i2c_client);
+
+	// Run subsystem shutdowns
+    /*
+	input_meta_shutdown(i2c_client, ctx);
+	input_touch_shutdown(i2c_client, ctx);
+	input_modifiers_shutdown(i2c_client, ctx);
+	input_display_shutdown(i2c_client, ctx);
+	input_rtc_shutdown(i2c_client, ctx);
+	input_fw_shutdown(i2c_client, ctx);
+    */
+
+	// Stop all activity, the context is freed by the device-specific
+	// memory manager. Later runtime PM calls find nothing to do
+	WRITE_ONCE(ctx->suspended, true);
+	kbd_irq_enable(ctx, false);
+	ctx->irq_mode = false;
+	kbd_poll_stop(ctx);
+	hrtimer_cancel(&ctx->mouse_timer);
+
+	// A queue-only cycle kicked before suspended was seen may still be
+	// sitting on the poller, wait it out so none outlives the context
+	kthread_flush_worker(ctx->poll_worker);
+	kthread_cancel_work_sync(&ctx->work_struct);
+
+	// Hand firmware back with the interrupt setup it had
+	if (ctx->cfg_valid) {
+		regmap_update_bits(ctx->regmap, REG_ID_CFG,
+			CFG_KEY_INT | CFG_OVERFLOW_INT,
+			ctx->cfg_saved & (CFG_KEY_INT | CFG_OVERFLOW_INT));
+	}
+}
+
+uint32_t params_get_sysfs_gid(void)
+{
+	return sysfs_gid_setting;
+}
+
+// Read battery percent over I2C
+static int read_battery_percent(struct kbd_ctx* ctx)
+{
+	int rc;
+	unsigned int percent;
+
+	// Make sure I2C client was initialized
+	if ((ctx == NULL) || (ctx->regmap == NULL)) {
+		return -EINVAL;
+	}
+
+	// Read battery level
+	if ((rc = regmap_read(ctx->regmap, REG_ID_BAT, &percent)) < 0) {
+		return rc;
+	}
+
+	// Calculate raw battery level
+	return percent;
+}
+
+// Fold a raw battery reading into the cache, returns true if userspace
+// should be told (capacity or charging state changed)
+static bool battery_update(struct kbd_ctx* ctx, int raw)
+{
+	bool charging = raw & BATTERY_CHARGING;
+	unsigned int sample = (raw & BATTERY_PERCENT_MASK) << BATTERY_FILTER_FRAC;
+	int capacity;
+	bool changed;
+
+	mutex_lock(&ctx->battery_lock);
+
+	// Exponential moving average, restarted when the charger is plugged
+	// or unplugged since the firmware estimate jumps then
+	if (!ctx->battery_valid || (charging != ctx->battery_charging)) {
+		ctx->battery_filtered = sample;
+	} else {
+		ctx->battery_filtered += ((int)sample - (int)ctx->battery_filtered)
+			/ (1 << BATTERY_FILTER_SHIFT);
+	}
+	capacity = min_t(int, DIV_ROUND_CLOSEST(ctx->battery_filtered,
+		1 << BATTERY_FILTER_FRAC), 100);
+
+	changed = !ctx->battery_valid || (capacity != ctx->battery_capacity)
+		|| (charging != ctx->battery_charging);
+
+	ctx->battery_raw = raw;
+	ctx->battery_capacity = capacity;
+	ctx->battery_charging = charging;
+	ctx->battery_valid = true;
+
+	mutex_unlock(&ctx->battery_lock);
+
+	return changed;
+}
+
+// Battery register read by the poller thread
+static void battery_read_complete(struct kbd_ctx* ctx, int raw)
+{
+	if (battery_update(ctx, raw) && ctx->battery) {
+		power_supply_changed(ctx->battery);
+	}
+}
+
+// Background battery refresh at a low rate, piggybacked on a poll cycle
+static void battery_work_handler(struct work_struct *work)
+{
+	struct kbd_ctx *ctx = container_of(to_delayed_work(work), struct kbd_ctx,
+		battery_work);
+
+	// Runs a poll cycle for it if nobody has the keyboard open
+	kbd_xfer_read(ctx, REG_ID_BAT);
+	kbd_xfer_kick(ctx);
+
+	queue_delayed_work(system_power_efficient_wq, &ctx->battery_work,
+		msecs_to_jiffies(READ_ONCE(ctx->battery_poll_ms)));
+}
+
+static enum power_supply_property battery_props[] = {
+	POWER_SUPPLY_PROP_STATUS,
+	POWER_SUPPLY_PROP_PRESENT,
+	POWER_SUPPLY_PROP_CAPACITY,
+	POWER_SUPPLY_PROP_SCOPE,
+};
+
+// Power supply properties, served from the cache
+static int battery_get_property(struct power_supply *psy,
+	enum power_supply_property psp, union power_supply_propval *val)
+{
+	struct kbd_ctx *ctx = power_supply_get_drvdata(psy);
+	int rc = 0;
+
+	mutex_lock(&ctx->battery_lock);
+
+	if (!ctx->battery_valid && (psp != POWER_SUPPLY_PROP_SCOPE)) {
+		mutex_unlock(&ctx->battery_lock);
+		return -ENODATA;
+	}
+
+	switch (psp) {
+	case POWER_SUPPLY_PROP_STATUS:
+		if (!ctx->battery_charging) {
+			val->intval = POWER_SUPPLY_STATUS_DISCHARGING;
+		} else if (ctx->battery_capacity >= 100) {
+			val->intval = POWER_SUPPLY_STATUS_FULL;
+		} else {
+			val->intval = POWER_SUPPLY_STATUS_CHARGING;
+		}
+		break;
+	case POWER_SUPPLY_PROP_PRESENT:
+		val->intval = 1;
+		break;
+	case POWER_SUPPLY_PROP_CAPACITY:
+		val->intval = ctx->battery_capacity;
+		break;
+	case POWER_SUPPLY_PROP_SCOPE:
+		val->intval = POWER_SUPPLY_SCOPE_SYSTEM;
+		break;
+	default:
+		rc = -EINVAL;
+		break;
+	}
+
+	mutex_unlock(&ctx->battery_lock);
+
+	return rc;
+}
+
+int battery_probe(struct i2c_client* i2c_client)
+{
+	struct kbd_ctx *ctx = i2c_get_clientdata(i2c_client);
+	struct power_supply_config cfg = {
+		.drv_data = ctx,
+	};
+	int raw;
+
+	mutex_init(&ctx->battery_lock);
+	ctx->battery_poll_ms = BATTERY_POLL_MS;
+	INIT_DELAYED_WORK(&ctx->battery_work, battery_work_handler);
+
+	// Seed the cache so the first reads do not hit the bus
+	mutex_lock(&ctx->drain_lock);
+	raw = read_battery_percent(ctx);
+	mutex_unlock(&ctx->drain_lock);
+	if (raw >= 0) {
+		battery_update(ctx, raw);
+	}
+
+	// Supply names must be unique, so they carry the instance name
+	ctx->battery_desc.name = devm_kasprintf(&i2c_client->dev, GFP_KERNEL,
+		"%s-battery", ctx->name);
+	if (!ctx->battery_desc.name) {
+		return -ENOMEM;
+	}
+	ctx->battery_desc.type = POWER_SUPPLY_TYPE_BATTERY;
+	ctx->battery_desc.properties = battery_props;
+	ctx->battery_desc.num_properties = ARRAY_SIZE(battery_props);
+	ctx->battery_desc.get_property = battery_get_property;
+
+	ctx->battery = devm_power_supply_register(&i2c_client->dev,
+		&ctx->battery_desc, &cfg);
+	if (IS_ERR(ctx->battery)) {
+		dev_err(&i2c_client->dev,
+			"%s Could not register battery, error: %ld\n",
+			__func__, PTR_ERR(ctx->battery));
+		return PTR_ERR(ctx->battery);
+	}
+
+	queue_delayed_work(system_power_efficient_wq, &ctx->battery_work,
+		msecs_to_jiffies(ctx->battery_poll_ms));
+
+	return 0;
+}
+
+void battery_shutdown(struct i2c_client* i2c_client)
+{
+	struct kbd_ctx *ctx = i2c_get_clientdata(i2c_client);
+
+	cancel_delayed_work_sync(&ctx->battery_work);
+}
+
+// Current level of a light, interpolated while fading, lock held
+static uint8_t light_level_at(struct kbd_light const* light, uint64_t now)
+{
+	uint64_t elapsed_ms;
+	int delta;
+
+	if ((light->fade_ms == 0) || (light->start == light->target)) {
+		return light->target;
+	}
+
+	elapsed_ms = div_u64(now - light->fade_start_at, NSEC_PER_MSEC);
+	if (elapsed_ms >= light->fade_ms) {
+		return light->target;
+	}
+
+	delta = (int)light->target - (int)light->start;
+	return light->start + (int)div_s64((int64_t)delta * (int64_t)elapsed_ms, light->fade_ms);
+}
+
+// Fade engine tick, writes at most one value per light per step
+static void light_fade_work_handler(struct work_struct *work)
+{
+	struct kbd_ctx *ctx = container_of(to_delayed_work(work), struct kbd_ctx,
+		light_fade_work);
+	uint64_t now = ktime_get_boottime_ns();
+	bool fading = false;
+	uint8_t level;
+	int i;
+
+	mutex_lock(&ctx->light_lock);
+
+	for (i = 0; i < KBD_LIGHTS; i++) {
+		struct kbd_light *light = &ctx->lights[i];
+
+		if (light->fade_ms == 0) {
+			continue;
+		}
+
+		level = light_level_at(light, now);
+		if (level != light->level) {
+			light->level = level;
+			kbd_xfer_write(ctx, light->reg, level);
+		}
+
+		if (level == light->target) {
+			light->fade_ms = 0;
+		} else {
+			fading = true;
+		}
+	}
+
+	if (fading) {
+		queue_delayed_work(system_power_efficient_wq, &ctx->light_fade_work,
+			msecs_to_jiffies(READ_ONCE(ctx->light_fade_step_ms)));
+	}
+
+	mutex_unlock(&ctx->light_lock);
+}
+
+// Move a light to a new level, fading over light_fade_ms if set
+static void light_set(struct kbd_ctx* ctx, enum kbd_light_id id, uint8_t target)
+{
+	struct kbd_light *light = &ctx->lights[id];
+	uint64_t now = ktime_get_boottime_ns();
+	unsigned int fade_ms = READ_ONCE(ctx->light_fade_ms);
+
+	mutex_lock(&ctx->light_lock);
+
+	// Nothing may queue fades or writes once the lights are torn down
+	if (ctx->lights_dying) {
+		mutex_unlock(&ctx->light_lock);
+		return;
+	}
+
+	// Start from wherever a running fade has got to
+	light->start = light_level_at(light, now);
+	light->target = target;
+	light->fade_start_at = now;
+	light->fade_ms = 0;
+
+	if ((fade_ms == 0) || (light->start == target)) {
+		if (light->level != target) {
+			light->level = target;
+			kbd_xfer_write(ctx, light->reg, target);
+		}
+	} else {
+		light->fade_ms = fade_ms;
+		mod_delayed_work(system_power_efficient_wq, &ctx->light_fade_work, 0);
+	}
+
+	mutex_unlock(&ctx->light_lock);
+}
+
+// Target level of a light, which is where it ends up after any fade
+static uint8_t light_get(struct kbd_ctx* ctx, enum kbd_light_id id)
+{
+	uint8_t target;
+
+	mutex_lock(&ctx->light_lock);
+	target = ctx->lights[id].target;
+	mutex_unlock(&ctx->light_lock);
+
+	return target;
+}
+
+static int backlight_update_status(struct backlight_device *bd)
+{
+	struct kbd_ctx *ctx = bl_get_data(bd);
+
+	light_set(ctx, KBD_LIGHT_SCREEN, backlight_get_brightness(bd));
+	return 0;
+}
+
+static int backlight_get_brightness_cached(struct backlight_device *bd)
+{
+	struct kbd_ctx *ctx = bl_get_data(bd);
+
+	return light_get(ctx, KBD_LIGHT_SCREEN);
+}
+
+static struct backlight_ops const backlight_ops = {
+	.options = BL_CORE_SUSPENDRESUME,
+	.update_status = backlight_update_status,
+	.get_brightness = backlight_get_brightness_cached,
+};
+
+static int kbd_led_set(struct led_classdev *cdev, enum led_brightness value)
+{
+	struct kbd_ctx *ctx = container_of(cdev, struct kbd_ctx, kbd_led);
+
+	light_set(ctx, KBD_LIGHT_KEYBOARD, value);
+	return 0;
+}
+
+static enum led_brightness kbd_led_get(struct led_classdev *cdev)
+{
+	struct kbd_ctx *ctx = container_of(cdev, struct kbd_ctx, kbd_led);
+
+	return light_get(ctx, KBD_LIGHT_KEYBOARD);
+}
+
+int lights_probe(struct i2c_client* i2c_client)
+{
+	struct kbd_ctx *ctx = i2c_get_clientdata(i2c_client);
+	struct backlight_properties props = {
+		.type = BACKLIGHT_RAW,
+		.max_brightness = 0xff,
+	};
+	char const *name, *led_name;
+	unsigned int level;
+	int i, rc;
+
+	mutex_init(&ctx->light_lock);
+	INIT_DELAYED_WORK(&ctx->light_fade_work, light_fade_work_handler);
+	ctx->light_fade_ms = LIGHT_FADE_MS;
+	ctx->light_fade_step_ms = LIGHT_FADE_STEP_MS;
+	ctx->lights[KBD_LIGHT_SCREEN].reg = REG_ID_BKL;
+	ctx->lights[KBD_LIGHT_KEYBOARD].reg = REG_ID_BK2;
+
+	// Seed the levels and the register cache with what the firmware has
+	for (i = 0; i < KBD_LIGHTS; i++) {
+		mutex_lock(&ctx->drain_lock);
+		rc = regmap_read(ctx->regmap, ctx->lights[i].reg, &level);
+		mutex_unlock(&ctx->drain_lock);
+		if (rc) {
+			level = 0xff;
+		}
+		ctx->lights[i].level = level;
+		ctx->lights[i].start = level;
+		ctx->lights[i].target = level;
+	}
+
+	// Class device names carry the instance name, unique per keyboard
+	name = devm_kasprintf(&i2c_client->dev, GFP_KERNEL, "%s-backlight", ctx->name);
+	led_name = devm_kasprintf(&i2c_client->dev, GFP_KERNEL, "%s::kbd_backlight",
+		ctx->name);
+	if (!name || !led_name) {
+		return -ENOMEM;
+	}
+
+	props.brightness = ctx->lights[KBD_LIGHT_SCREEN].level;
+	ctx->backlight = devm_backlight_device_register(&i2c_client->dev,
+		name, &i2c_client->dev, ctx, &backlight_ops, &props);
+	if (IS_ERR(ctx->backlight)) {
+		dev_err(&i2c_client->dev,
+			"%s Could not register backlight, error: %ld\n",
+			__func__, PTR_ERR(ctx->backlight));
+		return PTR_ERR(ctx->backlight);
+	}
+
+	ctx->kbd_led.name = led_name;
+	ctx->kbd_led.max_brightness = 0xff;
+	ctx->kbd_led.brightness = ctx->lights[KBD_LIGHT_KEYBOARD].level;
+	ctx->kbd_led.brightness_set_blocking = kbd_led_set;
+	ctx->kbd_led.brightness_get = kbd_led_get;
+	// Not devm, unregistering sets the LED off, which has to happen
+	// before lights_shutdown stops the fade work
+	if ((rc = led_classdev_register(&i2c_client->dev, &ctx->kbd_led))) {
+		dev_err(&i2c_client->dev,
+			"%s Could not register keyboard LED, error: %d\n", __func__, rc);
+		return rc;
+	}
+
+	return 0;
+}
+
+void lights_shutdown(struct i2c_client* i2c_client)
+{
+	struct kbd_ctx *ctx = i2c_get_clientdata(i2c_client);
+
+	led_classdev_unregister(&ctx->kbd_led);
+
+	// The backlight class device outlives this until devm cleanup
+	mutex_lock(&ctx->light_lock);
+	ctx->lights_dying = true;
+	mutex_unlock(&ctx->light_lock);
+
+	cancel_delayed_work_sync(&ctx->light_fade_work);
+}
+
+static int parse_and_set_light(struct kbd_ctx* ctx, char const* buf, size_t count,
+	enum kbd_light_id id)
+{
+	int parsed;
+
+	// Parse string entry
+	if ((parsed = parse_u8(buf)) < 0) {
+		return -EINVAL;
+	}
+
+	// Set light through its class device so both views stay in sync
+	if (id == KBD_LIGHT_SCREEN) {
+		backlight_device_set_brightness(ctx->backlight, parsed);
+	} else {
+		led_set_brightness_sync(&ctx->kbd_led, parsed);
+	}
+
+	return count;
+}
+
+// Sysfs entries
+
+// Battery percent approximate
+static ssize_t battery_percent_show(struct kobject *kobj, struct kobj_attribute *attr,
+	char *buf)
+{
+	struct kbd_ctx *ctx = kbd_ctx_from_kobj(kobj);
+	int percent;
+
+	// Serve the cached raw value, the battery worker keeps it fresh
+	mutex_lock(&ctx->battery_lock);
+	percent = ctx->battery_valid ? ctx->battery_raw : -ENODATA;
+	mutex_unlock(&ctx->battery_lock);
+
+	if (percent < 0) {
+		return percent;
+	}
+
+	// Format into buffer
+	return sprintf(buf, "%d\n", percent);
+}
+struct kobj_attribute battery_percent_attr
+	= __ATTR(battery_percent, 0444, battery_percent_show, NULL);
+
+// Keyboard backlight value
+static ssize_t keyboard_backlight_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	struct kbd_ctx *ctx = kbd_ctx_from_kobj(kobj);
+
+	return sprintf(buf, "%u\n", light_get(ctx, KBD_LIGHT_KEYBOARD));
+}
+static ssize_t __used keyboard_backlight_store(struct kobject *kobj,
+	struct kobj_attribute *attr, char const *buf, size_t count)
+{
+	return parse_and_set_light(kbd_ctx_from_kobj(kobj), buf, count,
+		KBD_LIGHT_KEYBOARD);
+}
+struct kobj_attribute keyboard_backlight_attr
+	= __ATTR(keyboard_backlight, 0664, keyboard_backlight_show, keyboard_backlight_store);
+
+// screen backlight value
+static ssize_t screen_backlight_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	struct kbd_ctx *ctx = kbd_ctx_from_kobj(kobj);
+
+	return sprintf(buf, "%u\n", light_get(ctx, KBD_LIGHT_SCREEN));
+}
+static ssize_t __used screen_backlight_store(struct kobject *kobj,
+	struct kobj_attribute *attr, char const *buf, size_t count)
+{
+	return parse_and_set_light(kbd_ctx_from_kobj(kobj), buf, count,
+		KBD_LIGHT_SCREEN);
+}
+struct kobj_attribute screen_backlight_attr
+	= __ATTR(screen_backlight, 0664, screen_backlight_show, screen_backlight_store);
+
+// Time since last keypress in milliseconds. poll() for POLLPRI wakes on the
+// next keypress, then seek to 0 and read again
+static ssize_t last_keypress_show(struct kobject *kobj, struct kobj_attribute *attr,
+	char *buf)
+{
+	struct kbd_ctx *ctx = kbd_ctx_from_kobj(kobj);
+	uint64_t last_keypress_ms;
+
+	// Get time in ns
+	last_keypress_ms = ktime_get_boottime_ns();
+	if (ctx->last_keypress_at < last_keypress_ms) {
+		last_keypress_ms -= ctx->last_keypress_at;
+
+		// Calculate time in milliseconds
+		last_keypress_ms = div_u64(last_keypress_ms, 1000000);
+
+		// Format into buffer
+		return sprintf(buf, "%lld\n", last_keypress_ms);
+	}
+
+	return sprintf(buf, "-1\n");
+}
+struct kobj_attribute last_keypress_attr
+	= __ATTR(last_keypress, 0444, last_keypress_show, NULL);
+
+// Parse an unsigned integer within [min, max] from string
+static inline int parse_uint_range(char const* buf, unsigned int min,
+	unsigned int max, unsigned int* dst)
+{
+	unsigned int result;
+
+	if (kstrtouint(buf, 10, &result) || (result < min) || (result > max)) {
+		return -EINVAL;
+	}
+	*dst = result;
+	return 0;
+}
+
+// Read/write unsigned tunable backed by a keyboard context field
+#define PICOCALC_UINT_ATTR(_name, _field, _min, _max)				\
+static ssize_t _name##_show(struct kobject *kobj,				\
+	struct kobj_attribute *attr, char *buf)					\
+{										\
+	struct kbd_ctx *ctx = kbd_ctx_from_kobj(kobj);				\
+										\
+	return sprintf(buf, "%u\n", READ_ONCE(ctx->_field));			\
+}										\
+static ssize_t _name##_store(struct kobject *kobj,				\
+	struct kobj_attribute *attr, char const *buf, size_t count)		\
+{										\
+	struct kbd_ctx *ctx = kbd_ctx_from_kobj(kobj);				\
+	unsigned int value;							\
+										\
+	if (parse_uint_range(buf, _min, _max, &value)) {			\
+		return -EINVAL;							\
+	}									\
+	WRITE_ONCE(ctx->_field, value);						\
+	return count;								\
+}										\
+struct kobj_attribute _name##_attr						\
+	= __ATTR(_name, 0664, _name##_show, _name##_store)
+
+// Firmware version reported by the keyboard
+static ssize_t firmware_version_show(struct kobject *kobj, struct kobj_attribute *attr,
+	char *buf)
+{
+	struct kbd_ctx *ctx = kbd_ctx_from_kobj(kobj);
+
+	return sprintf(buf, "0x%02x\n", ctx->version_number);
+}
+struct kobj_attribute firmware_version_attr
+	= __ATTR(firmware_version, 0444, firmware_version_show, NULL);
+
+// FIFO read mode in use
+static ssize_t fifo_mode_show(struct kobject *kobj, struct kobj_attribute *attr,
+	char *buf)
+{
+	struct kbd_ctx *ctx = kbd_ctx_from_kobj(kobj);
+
+	return sprintf(buf, "%s\n", ctx->fifo_batched ? "batched" : "legacy");
+}
+struct kobj_attribute fifo_mode_attr
+	= __ATTR(fifo_mode, 0444, fifo_mode_show, NULL);
+
+// Key event delivery mode in use
+static ssize_t input_mode_show(struct kobject *kobj, struct kobj_attribute *attr,
+	char *buf)
+{
+	struct kbd_ctx *ctx = kbd_ctx_from_kobj(kobj);
+
+	return sprintf(buf, "%s\n", READ_ONCE(ctx->irq_mode) ? "irq" : "poll");
+}
+struct kobj_attribute input_mode_attr
+	= __ATTR(input_mode, 0444, input_mode_show, NULL);
+
+// Number of key interrupts handled
+static ssize_t irq_count_show(struct kobject *kobj, struct kobj_attribute *attr,
+	char *buf)
+{
+	struct kbd_ctx *ctx = kbd_ctx_from_kobj(kobj);
+
+	return sprintf(buf, "%llu\n", READ_ONCE(ctx->irq_count));
+}
+struct kobj_attribute irq_count_attr
+	= __ATTR(irq_count, 0444, irq_count_show, NULL);
+
+// CPUs the poller thread may run on, as a CPU list
+static ssize_t poll_cpus_show(struct kobject *kobj, struct kobj_attribute *attr,
+	char *buf)
+{
+	struct kbd_ctx *ctx = kbd_ctx_from_kobj(kobj);
+
+	return sprintf(buf, "%*pbl\n", cpumask_pr_args(&ctx->poll_cpus));
+}
+static ssize_t poll_cpus_store(struct kobject *kobj, struct kobj_attribute *attr,
+	char const *buf, size_t count)
+{
+	struct kbd_ctx *ctx = kbd_ctx_from_kobj(kobj);
+	int rc;
+	cpumask_var_t cpus;
+
+	if (!alloc_cpumask_var(&cpus, GFP_KERNEL)) {
+		return -ENOMEM;
+	}
+	if (cpulist_parse(buf, cpus) || !cpumask_intersects(cpus, cpu_online_mask)) {
+		rc = -EINVAL;
+	} else {
+		cpumask_copy(&ctx->poll_cpus, cpus);
+		rc = kbd_poll_apply_sched(ctx);
+	}
+	free_cpumask_var(cpus);
+
+	return rc ? rc : count;
+}
+struct kobj_attribute poll_cpus_attr
+	= __ATTR(poll_cpus, 0664, poll_cpus_show, poll_cpus_store);
+
+// SCHED_FIFO priority of the poller thread, 0 for SCHED_NORMAL
+static ssize_t poll_priority_show(struct kobject *kobj, struct kobj_attribute *attr,
+	char *buf)
+{
+	struct kbd_ctx *ctx = kbd_ctx_from_kobj(kobj);
+
+	return sprintf(buf, "%u\n", READ_ONCE(ctx->poll_priority));
+}
+static ssize_t poll_priority_store(struct kobject *kobj, struct kobj_attribute *attr,
+	char const *buf, size_t count)
+{
+	struct kbd_ctx *ctx = kbd_ctx_from_kobj(kobj);
+	int rc;
+	unsigned int priority;
+
+	if (parse_uint_range(buf, 0, MAX_RT_PRIO - 1, &priority)) {
+		return -EINVAL;
+	}
+
+	WRITE_ONCE(ctx->poll_priority, priority);
+	if ((rc = kbd_poll_apply_sched(ctx))) {
+		return rc;
+	}
+	return count;
+}
+struct kobj_attribute poll_priority_attr
+	= __ATTR(poll_priority, 0664, poll_priority_show, poll_priority_store);
+
+// Poller scheduling delay: count min_ns avg_ns max_ns, write 0 to reset
+static ssize_t sched_delay_show(struct kobject *kobj, struct kobj_attribute *attr,
+	char *buf)
+{
+	struct kbd_ctx *ctx = kbd_ctx_from_kobj(kobj);
+	uint64_t count, total, min, max;
+
+	mutex_lock(&ctx->drain_lock);
+	count = ctx->sched_delay_count;
+	total = ctx->sched_delay_total_ns;
+	min = ctx->sched_delay_min_ns;
+	max = ctx->sched_delay_max_ns;
+	mutex_unlock(&ctx->drain_lock);
+
+	return sprintf(buf, "%llu %llu %llu %llu\n",
+		count, min, count ? div64_u64(total, count) : 0, max);
+}
+static ssize_t sched_delay_store(struct kobject *kobj, struct kobj_attribute *attr,
+	char const *buf, size_t count)
+{
+	struct kbd_ctx *ctx = kbd_ctx_from_kobj(kobj);
+	unsigned int value;
+
+	if (parse_uint_range(buf, 0, 0, &value)) {
+		return -EINVAL;
+	}
+
+	mutex_lock(&ctx->drain_lock);
+	ctx->sched_delay_count = 0;
+	ctx->sched_delay_total_ns = 0;
+	ctx->sched_delay_min_ns = 0;
+	ctx->sched_delay_max_ns = 0;
+	mutex_unlock(&ctx->drain_lock);
+
+	return count;
+}
+struct kobj_attribute sched_delay_attr
+	= __ATTR(sched_delay, 0664, sched_delay_show, sched_delay_store);
+
+// Poll interval per tier, idle time before decaying, and latency floor
+PICOCALC_UINT_ATTR(poll_fast_ms, poll_interval_ms[KBD_POLL_FAST], 1, KBD_POLL_MAX_MS);
+PICOCALC_UINT_ATTR(poll_medium_ms, poll_interval_ms[KBD_POLL_MEDIUM], 1, KBD_POLL_MAX_MS);
+PICOCALC_UINT_ATTR(poll_slow_ms, poll_interval_ms[KBD_POLL_SLOW], 1, KBD_POLL_MAX_MS);
+PICOCALC_UINT_ATTR(poll_medium_after_ms, poll_after_ms[KBD_POLL_MEDIUM], 0, UINT_MAX);
+PICOCALC_UINT_ATTR(poll_slow_after_ms, poll_after_ms[KBD_POLL_SLOW], 0, UINT_MAX);
+PICOCALC_UINT_ATTR(poll_floor_ms, poll_floor_ms, 1, KBD_POLL_MAX_MS);
+
+// Drain reporting budget for a full FIFO, and number of drains that went
+// over their share of it while statistics were enabled
+PICOCALC_UINT_ATTR(drain_budget_us, drain_budget_us, 1, USEC_PER_SEC);
+
+static ssize_t drain_over_budget_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	struct kbd_ctx *ctx = kbd_ctx_from_kobj(kobj);
+
+	return sprintf(buf, "%llu\n", READ_ONCE(ctx->drain_over_budget));
+}
+struct kobj_attribute drain_over_budget_attr
+	= __ATTR(drain_over_budget, 0444, drain_over_budget_show, NULL);
+
+static ssize_t frames_split_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	struct kbd_ctx *ctx = kbd_ctx_from_kobj(kobj);
+
+	return sprintf(buf, "%llu\n", READ_ONCE(ctx->frames_split));
+}
+struct kobj_attribute frames_split_attr
+	= __ATTR(frames_split, 0444, frames_split_show, NULL);
+
+// FIFO overflow episodes: overflows full flagged inconsistent recovered released
+static ssize_t overflow_stats_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	struct kbd_ctx *ctx = kbd_ctx_from_kobj(kobj);
+
+	return sprintf(buf, "%llu %llu %llu %llu %llu %llu\n",
+		READ_ONCE(ctx->overflows), READ_ONCE(ctx->overflow_full),
+		READ_ONCE(ctx->overflow_flagged), READ_ONCE(ctx->overflow_inconsistent),
+		READ_ONCE(ctx->overflow_recovered), READ_ONCE(ctx->overflow_released));
+}
+struct kobj_attribute overflow_stats_attr
+	= __ATTR(overflow_stats, 0444, overflow_stats_show, NULL);
+
+// Bus time to drain a full FIFO at the adapter clock. Legacy reads take one
+// word read per entry plus the empty one that ends the drain, batched reads
+// the count and one block read
+static unsigned int kbd_drain_bus_us(struct kbd_ctx* ctx)
+{
+	unsigned int bits;
+
+	if (ctx->fifo_batched) {
+		bits = KBD_I2C_WORD_READ_BITS + KBD_I2C_BLOCK_READ_BITS(KBD_FIFO_SIZE * 2);
+	} else {
+		bits = (KBD_FIFO_SIZE + 1) * KBD_I2C_WORD_READ_BITS;
+	}
+	return DIV_ROUND_UP_ULL((uint64_t)bits * USEC_PER_SEC, ctx->bus_hz);
+}
+
+// Sustained typing rate delivered without loss. Typing keeps the poller in
+// the fast tier, and every drain empties a FIFO that holds KBD_FIFO_TAPS taps.
+// The next poll is timed from the end of the drain, so bus time adds to the
+// poll interval. On slow links it can be the larger part
+static ssize_t max_keys_per_sec_show(struct kobject *kobj,
+	struct kobj_attribute *attr, char *buf)
+{
+	struct kbd_ctx *ctx = kbd_ctx_from_kobj(kobj);
+	unsigned int interval_ms, period_us;
+
+	interval_ms = min(READ_ONCE(ctx->poll_interval_ms[KBD_POLL_FAST]),
+		READ_ONCE(ctx->poll_floor_ms));
+	period_us = interval_ms * USEC_PER_MSEC + kbd_drain_bus_us(ctx);
+
+	return sprintf(buf, "%ld\n", KBD_FIFO_TAPS * USEC_PER_SEC / period_us);
+}
+struct kobj_attribute max_keys_per_sec_attr
+	= __ATTR(max_keys_per_sec, 0444, max_keys_per_sec_show, NULL);
+
+// Battery refresh interval
+PICOCALC_UINT_ATTR(battery_poll_ms, battery_poll_ms, BATTERY_POLL_MIN_MS, BATTERY_POLL_MAX_MS);
+
+// Pointer tick rate, speed curve in pixels per second and precision scale
+PICOCALC_UINT_ATTR(mouse_rate_hz, mouse_rate_hz, MOUSE_RATE_MIN_HZ, MOUSE_RATE_MAX_HZ);
+PICOCALC_UINT_ATTR(mouse_speed_min, mouse_speed_min, 1, MOUSE_SPEED_LIMIT);
+PICOCALC_UINT_ATTR(mouse_speed_max, mouse_speed_max, 1, MOUSE_SPEED_LIMIT);
+PICOCALC_UINT_ATTR(mouse_accel, mouse_accel, 0, MOUSE_ACCEL_LIMIT);
+PICOCALC_UINT_ATTR(mouse_precision_pct, mouse_precision_pct, 1, 100);
+
+// Scroll speed curve in hi-res wheel units per second
+PICOCALC_UINT_ATTR(scroll_speed_min, scroll_speed_min, 1, SCROLL_SPEED_LIMIT);
+PICOCALC_UINT_ATTR(scroll_speed_max, scroll_speed_max, 1, SCROLL_SPEED_LIMIT);
+PICOCALC_UINT_ATTR(scroll_accel, scroll_accel, 0, SCROLL_ACCEL_LIMIT);
+
+// Default tap window for dual-role keys and sticky modifier switch
+PICOCALC_UINT_ATTR(tap_hold_ms, tap_hold_ms, 1, KBD_TAP_HOLD_MAX_MS);
+PICOCALC_UINT_ATTR(sticky_modifiers, sticky_modifiers, 0, 1);
+
+// Dual-role keys, one "scancode tap hold tap_ms" line per key
+static ssize_t dual_role_show(struct kobject *kobj, struct kobj_attribute *attr,
+	char *buf)
+{
+	struct kbd_ctx *ctx = kbd_ctx_from_kobj(kobj);
+	struct kbd_dual_role *role;
+	ssize_t len = 0;
+	unsigned int i;
+
+	spin_lock_bh(&ctx->report_lock);
+	for (i = 0; i < ctx->dual_role_count; i++) {
+		role = &ctx->dual_roles[i];
+		len += scnprintf(buf + len, PAGE_SIZE - len, "0x%02x %u %u %u\n",
+			role->scancode, role->tap, role->hold, role->tap_ms);
+	}
+	spin_unlock_bh(&ctx->report_lock);
+
+	return len;
+}
+
+// Rebuild the scancode index after the table changed, report lock held
+static void dual_role_reindex(struct kbd_ctx* ctx)
+{
+	unsigned int i;
+
+	memset(ctx->dual_role_index, 0, sizeof(ctx->dual_role_index));
+	for (i = 0; i < ctx->dual_role_count; i++) {
+		ctx->dual_role_index[ctx->dual_roles[i].scancode] = i + 1;
+	}
+}
+
+// Write "scancode tap hold [tap_ms]" to set a key, "scancode 0 0" to remove
+// it, or "clear" to remove all. Keys held down are released first. Keycodes
+// must already be advertised by the keymap, evdev clients that have the
+// device open never see capabilities added later
+static ssize_t dual_role_store(struct kobject *kobj, struct kobj_attribute *attr,
+	char const *buf, size_t count)
+{
+	struct kbd_ctx *ctx = kbd_ctx_from_kobj(kobj);
+	struct kbd_dual_role *role;
+	unsigned int tap, hold, tap_ms, i;
+	int scancode, fields;
+
+	spin_lock_bh(&ctx->report_lock);
+
+	// Release hold keycodes and drop any pending tap before editing
+	for (i = 0; i < ctx->dual_role_count; i++) {
+		role = &ctx->dual_roles[i];
+		if ((role->state == KBD_DUAL_HELD) && role->hold) {
+			input_report_key(ctx->input_dev, role->hold, 0);
+			input_sync(ctx->input_dev);
+		}
+		role->state = KBD_DUAL_IDLE;
+	}
+	ctx->dual_role_pending = -1;
+
+	if (sysfs_streq(buf, "clear")) {
+		ctx->dual_role_count = 0;
+		dual_role_reindex(ctx);
+		spin_unlock_bh(&ctx->report_lock);
+		return count;
+	}
+
+	tap_ms = READ_ONCE(ctx->tap_hold_ms);
+	fields = sscanf(buf, "%i %u %u %u", &scancode, &tap, &hold, &tap_ms);
+	if ((fields < 3) || (scancode < 0) || (scancode >= NUM_KEYCODES) || (tap > KEY_MAX)
+	 || (hold > KEY_MAX) || (tap_ms == 0) || (tap_ms > KBD_TAP_HOLD_MAX_MS)) {
+		spin_unlock_bh(&ctx->report_lock);
+		return -EINVAL;
+	}
+	if ((tap && !test_bit(tap, ctx->input_dev->keybit))
+	 || (hold && !test_bit(hold, ctx->input_dev->keybit))) {
+		spin_unlock_bh(&ctx->report_lock);
+		return -EINVAL;
+	}
+
+	// Replace or remove an existing entry, otherwise append
+	i = ctx->dual_role_index[scancode];
+	if (i) {
+		i--;
+	} else if ((tap || hold) && (ctx->dual_role_count < KBD_DUAL_ROLES)) {
+		i = ctx->dual_role_count++;
+	} else if (tap || hold) {
+		spin_unlock_bh(&ctx->report_lock);
+		return -ENOSPC;
+	} else {
+		spin_unlock_bh(&ctx->report_lock);
+		return count;
+	}
+
+	if (!tap && !hold) {
+		ctx->dual_roles[i] = ctx->dual_roles[--ctx->dual_role_count];
+	} else {
+		role = &ctx->dual_roles[i];
+		role->scancode = scancode;
+		role->tap = tap;
+		role->hold = hold;
+		role->tap_ms = tap_ms;
+		role->state = KBD_DUAL_IDLE;
+	}
+	dual_role_reindex(ctx);
+
+	spin_unlock_bh(&ctx->report_lock);
+
+	return count;
+}
+struct kobj_attribute dual_role_attr
+	= __ATTR(dual_role, 0664, dual_role_show, dual_role_store);
+
+// Backlight fade duration for new levels and minimum interval between fade writes
+PICOCALC_UINT_ATTR(backlight_fade_ms, light_fade_ms, 0, LIGHT_FADE_MAX_MS);
+PICOCALC_UINT_ATTR(backlight_fade_step_ms, light_fade_step_ms,
+	LIGHT_FADE_STEP_MIN_MS, LIGHT_FADE_STEP_MAX_MS);
+
+// Transaction queue: depth max_depth queued coalesced issued reads cached
+static ssize_t xfer_stats_show(struct kobject *kobj, struct kobj_attribute *attr,
+	char *buf)
+{
+	struct kbd_ctx *ctx = kbd_ctx_from_kobj(kobj);
+	unsigned long flags;
+	unsigned int depth, depth_max;
+	uint64_t queued, coalesced;
+
+	spin_lock_irqsave(&ctx->xfer_lock, flags);
+	depth = kbd_xfer_depth_locked(ctx);
+	depth_max = ctx->xfer_depth_max;
+	queued = ctx->xfer_queued;
+	coalesced = ctx->xfer_coalesced;
+	spin_unlock_irqrestore(&ctx->xfer_lock, flags);
+
+	return sprintf(buf, "%u %u %llu %llu %llu %llu %llu\n", depth, depth_max,
+		queued, coalesced, READ_ONCE(ctx->xfer_issued),
+		READ_ONCE(ctx->xfer_reads), READ_ONCE(ctx->xfer_cached));
+}
+struct kobj_attribute xfer_stats_attr
+	= __ATTR(xfer_stats, 0444, xfer_stats_show, NULL);
+
+// Number of polls done in each tier: fast medium slow
+static ssize_t poll_counts_show(struct kobject *kobj, struct kobj_attribute *attr,
+	char *buf)
+{
+	struct kbd_ctx *ctx = kbd_ctx_from_kobj(kobj);
+
+	return sprintf(buf, "%llu %llu %llu\n",
+		READ_ONCE(ctx->poll_count[KBD_POLL_FAST]),
+		READ_ONCE(ctx->poll_count[KBD_POLL_MEDIUM]),
+		READ_ONCE(ctx->poll_count[KBD_POLL_SLOW]));
+}
+struct kobj_attribute poll_counts_attr
+	= __ATTR(poll_counts, 0444, poll_counts_show, NULL);
+
+// Sysfs attributes (entries)
+static struct attribute *picocalc_attrs[] = {
+	&battery_percent_attr.attr,
+	&screen_backlight_attr.attr,
+	&last_keypress_attr.attr,
+	&keyboard_backlight_attr.attr,
+	&firmware_version_attr.attr,
+	&fifo_mode_attr.attr,
+	&input_mode_attr.attr,
+	&irq_count_attr.attr,
+	&poll_fast_ms_attr.attr,
+	&poll_medium_ms_attr.attr,
+	&poll_slow_ms_attr.attr,
+	&poll_medium_after_ms_attr.attr,
+	&poll_slow_after_ms_attr.attr,
+	&poll_floor_ms_attr.attr,
+	&poll_counts_attr.attr,
+	&poll_cpus_attr.attr,
+	&poll_priority_attr.attr,
+	&sched_delay_attr.attr,
+	&drain_budget_us_attr.attr,
+	&drain_over_budget_attr.attr,
+	&frames_split_attr.attr,
+	&max_keys_per_sec_attr.attr,
+	&overflow_stats_attr.attr,
+	&battery_poll_ms_attr.attr,
+	&xfer_stats_attr.attr,
+	&mouse_rate_hz_attr.attr,
+	&mouse_speed_min_attr.attr,
+	&mouse_speed_max_attr.attr,
+	&mouse_accel_attr.attr,
+	&mouse_precision_pct_attr.attr,
+	&scroll_speed_min_attr.attr,
+	&scroll_speed_max_attr.attr,
+	&scroll_accel_attr.attr,
+	&tap_hold_ms_attr.attr,
+	&sticky_modifiers_attr.attr,
+	&dual_role_attr.attr,
+	&backlight_fade_ms_attr.attr,
+	&backlight_fade_step_ms_attr.attr,
+	NULL,
+};
+static struct attribute_group picocalc_attr_group = {
+	.attrs = picocalc_attrs
+};
+
+static void picocalc_get_ownership
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 6, 0)
+(struct kobject *kobj, kuid_t *uid, kgid_t *gid)
+#else
+(struct kobject const *kobj, kuid_t *uid, kgid_t *gid)
+#endif
+{
+	if (gid != NULL) {
+		gid->val = params_get_sysfs_gid();
+	}
+}
+
+static void picocalc_kobj_release(struct kobject *kobj)
+{
+	kfree(container_of(kobj, struct kbd_sysfs, kobj));
+}
+
+// Attributes only run while the back-pointer to the context is set
+static ssize_t picocalc_attr_show(struct kobject *kobj, struct attribute *attr,
+	char *buf)
+{
+	if (!kbd_ctx_from_kobj(kobj)) {
+		return -ENODEV;
+	}
+	return kobj_sysfs_ops.show(kobj, attr, buf);
+}
+
+static ssize_t picocalc_attr_store(struct kobject *kobj, struct attribute *attr,
+	char const *buf, size_t count)
+{
+	if (!kbd_ctx_from_kobj(kobj)) {
+		return -ENODEV;
+	}
+	return kobj_sysfs_ops.store(kobj, attr, buf, count);
+}
+
+static struct sysfs_ops const picocalc_sysfs_ops = {
+	.show = picocalc_attr_show,
+	.store = picocalc_attr_store,
+};
+
+static struct kobj_type picocalc_ktype = {
+	.release = picocalc_kobj_release,
+	.get_ownership = picocalc_get_ownership,
+	.sysfs_ops = &picocalc_sysfs_ops
+};
+
+int sysfs_probe(struct i2c_client* i2c_client)
+{
+	struct kbd_ctx *ctx = i2c_get_clientdata(i2c_client);
+	struct kbd_sysfs *sysfs;
+	int rc;
+
+	// Freed by the kobject release, which may run after the device is gone
+	sysfs = kzalloc(sizeof(*sysfs), GFP_KERNEL);
+	if (!sysfs) {
+		return -ENOMEM;
+	}
+	sysfs->ctx = ctx;
+
+	// Create sysfs entries for this keyboard with custom type
+	rc = kobject_init_and_add(&sysfs->kobj, &picocalc_ktype, firmware_kobj,
+		"%s", ctx->name);
+	if (rc < 0) {
+		kobject_put(&sysfs->kobj);
+		return rc;
+	}
+
+	// Create sysfs attributes
+	if (sysfs_create_group(&sysfs->kobj, &picocalc_attr_group)) {
+		kobject_put(&sysfs->kobj);
+		return -ENOMEM;
+	}
+	ctx->sysfs = sysfs;
+
+	// Keypresses are pollable without a lookup per notification
+	mutex_lock(&ctx->drain_lock);
+	ctx->last_keypress_kn = sysfs_get_dirent(sysfs->kobj.sd, "last_keypress");
+	mutex_unlock(&ctx->drain_lock);
+
+	return 0;
+}
+
+void sysfs_shutdown(struct i2c_client* i2c_client)
+{
+	struct kbd_ctx *ctx = i2c_get_clientdata(i2c_client);
+	struct kernfs_node* kn;
+
+	// The poller may still be draining, stop it notifying first
+	mutex_lock(&ctx->drain_lock);
+	kn = ctx->last_keypress_kn;
+	ctx->last_keypress_kn = NULL;
+	mutex_unlock(&ctx->drain_lock);
+	sysfs_put(kn);
+
+	// Remove sysfs entry. Deleting it waits for running show/store calls
+	// and stops new ones, then the back-pointer goes for anything still
+	// holding the kobject. It is freed on its last put
+	if (ctx->sysfs) {
+		kobject_del(&ctx->sysfs->kobj);
+		WRITE_ONCE(ctx->sysfs->ctx, NULL);
+		kobject_put(&ctx->sysfs->kobj);
+		ctx->sysfs = NULL;
+	}
+}
+
+// Debugfs entries
+
+static char const* const kbd_hist_names[KBD_HIST_TYPES] = {
+	[KBD_HIST_SCHED_DELAY] = "timer_to_worker_ns",
+	[KBD_HIST_I2C] = "i2c_transaction_ns",
+	[KBD_HIST_DRAIN] = "fifo_drain_ns",
+	[KBD_HIST_EVENTS] = "events_per_drain",
+};
+
+// Sum all CPUs and print non-empty buckets as [low, high) ranges
+static int histograms_show(struct seq_file *s, void *unused)
+{
+	struct kbd_ctx *ctx = s->private;
+	uint64_t sum[KBD_HIST_BUCKETS], empty = 0, productive = 0;
+	int type, bucket, cpu;
+
+	for (type = 0; type < KBD_HIST_TYPES; type++) {
+		memset(sum, 0, sizeof(sum));
+		for_each_possible_cpu(cpu) {
+			struct kbd_stats *stats = per_cpu_ptr(ctx->stats, cpu);
+			for (bucket = 0; bucket < KBD_HIST_BUCKETS; bucket++) {
+				sum[bucket] += READ_ONCE(stats->hist[type][bucket]);
+			}
+		}
+
+		seq_printf(s, "%s:\n", kbd_hist_names[type]);
+		for (bucket = 0; bucket < KBD_HIST_BUCKETS; bucket++) {
+			if (sum[bucket]) {
+				seq_printf(s, "  [%llu, %llu) %llu\n",
+					bucket ? (1ull << (bucket - 1)) : 0, 1ull << bucket,
+					sum[bucket]);
+			}
+		}
+	}
+
+	for_each_possible_cpu(cpu) {
+		empty += READ_ONCE(per_cpu_ptr(ctx->stats, cpu)->empty_polls);
+		productive += READ_ONCE(per_cpu_ptr(ctx->stats, cpu)->productive_polls);
+	}
+	seq_printf(s, "empty_polls %llu\nproductive_polls %llu\n", empty, productive);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(histograms);
+
+// Clear all statistics on write
+static ssize_t reset_write(struct file *file, char const __user *buf,
+	size_t count, loff_t *ppos)
+{
+	struct kbd_ctx *ctx = file->private_data;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		memset(per_cpu_ptr(ctx->stats, cpu), 0, sizeof(struct kbd_stats));
+	}
+
+	return count;
+}
+
+static struct file_operations const reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = reset_write,
+	.llseek = noop_llseek,
+};
+
+// Statistics collection switch, a static key keeps it free while off.
+// The key is shared, each keyboard holds one reference while enabled
+static DEFINE_MUTEX(stats_enable_lock);
+
+static int stats_enable_get(void *data, u64 *val)
+{
+	struct kbd_ctx *ctx = data;
+
+	*val = READ_ONCE(ctx->stats_enabled);
+	return 0;
+}
+
+static int stats_enable_set(void *data, u64 val)
+{
+	struct kbd_ctx *ctx = data;
+
+	mutex_lock(&stats_enable_lock);
+	if (val && !ctx->stats_enabled) {
+		static_branch_inc(&kbd_stats_enabled);
+	} else if (!val && ctx->stats_enabled) {
+		static_branch_dec(&kbd_stats_enabled);
+	}
+	WRITE_ONCE(ctx->stats_enabled, !!val);
+	mutex_unlock(&stats_enable_lock);
+
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(stats_enable_fops, stats_enable_get, stats_enable_set, "%llu\n");
+
+void debugfs_probe(struct i2c_client* i2c_client)
+{
+	struct kbd_ctx *ctx = i2c_get_clientdata(i2c_client);
+
+	// Debugfs is optional, failures are not fatal
+	ctx->debugfs_dir = debugfs_create_dir(ctx->id ? ctx->name : "picocalc_kbd", NULL);
+	debugfs_create_file_unsafe("enable", 0644, ctx->debugfs_dir, ctx,
+		&stats_enable_fops);
+	debugfs_create_file("histograms", 0444, ctx->debugfs_dir, ctx,
+		&histograms_fops);
+	debugfs_create_file("reset", 0200, ctx->debugfs_dir, ctx,
+		&reset_fops);
+}
+
+void debugfs_shutdown(struct i2c_client* i2c_client)
+{
+	struct kbd_ctx *ctx = i2c_get_clientdata(i2c_client);
 
-	// Ignore hold keys at this point
-	if (ev->state == KEY_STATE_HOLD) {
-		return;
-	}
+	debugfs_remove_recursive(ctx->debugfs_dir);
+	ctx->debugfs_dir = NULL;
+	stats_enable_set(ctx, 0);
+}
 
-/*
-	// Apply pending sticky modifiers
-	keycode = input_modifiers_apply_pending(ctx, keycode);
-*/
+// Raw event ring
 
-	// Report key to input system
-	input_report_key(ctx->input_dev, keycode, ev->state == KEY_STATE_PRESSED);
+// Mapped read-only by user space. The poller is the only producer, readers
+// are tracked to signal their eventfds. Each open file holds a reference,
+// so the ring outlives the device, which only marks it dead
+struct kbd_raw_ring
+{
+	struct kref ref;
+	struct miscdevice misc;
+	char name[24];
+	struct device *dev;
+	struct picocalc_ring_header *ring;
+	struct picocalc_ring_event *events;
+	size_t size;
+	wait_queue_head_t wait;
+	spinlock_t lock;
+	struct list_head files;
+	bool dead;
+};
 
-	// Reset sticky modifiers
-//	input_modifiers_reset(ctx);
+struct kbd_raw_file
+{
+	struct kbd_raw_ring *raw;
+	struct list_head node;
+	struct eventfd_ctx *eventfd;
+
+	// Tail published by the reader, under the ring lock
+	uint64_t seen;
+};
+
+static void kbd_raw_ring_release(struct kref *ref)
+{
+	struct kbd_raw_ring *raw = container_of(ref, struct kbd_raw_ring, ref);
+
+	// Pages of existing mappings hold their own references
+	vfree(raw->ring);
+	put_device(raw->dev);
+	kfree(raw);
 }
 
-static void input_workqueue_handler(struct work_struct *work_struct_ptr)
+// Publish the items just read from the FIFO, drain_lock held
+static void kbd_raw_push(struct kbd_ctx* ctx)
 {
-	struct kbd_ctx *ctx;
+	struct kbd_raw_ring *raw = ctx->raw;
+	struct picocalc_ring_header *ring;
+	struct picocalc_ring_event *ev;
+	struct kbd_raw_file *rf;
+	uint64_t head, now;
 	uint8_t fifo_idx;
 
-	// Get keyboard context from work struct
-	ctx = container_of(work_struct_ptr, struct kbd_ctx, work_struct);
+	if (!raw || !ctx->key_fifo_count) {
+		return;
+	}
+	ring = raw->ring;
 
-	input_fw_read_fifo(ctx);
-	// Process FIFO items
+	head = ring->head;
+	now = ktime_get_ns();
 	for (fifo_idx = 0; fifo_idx < ctx->key_fifo_count; fifo_idx++) {
-		key_report_event(ctx, &ctx->key_fifo_data[fifo_idx]);
+		ev = &raw->events[(head + fifo_idx) & (ring->entries - 1)];
+		ev->timestamp_ns = now;
+		ev->state = ctx->key_fifo_data[fifo_idx].state;
+		ev->scancode = ctx->key_fifo_data[fifo_idx].scancode;
 	}
 
-	if (ctx->mouse_mode)
-        {
-            uint64_t press_time = ktime_get_boottime_ns() - ctx->last_keypress_at;
-            if (press_time <= mouse_fast_move_thr_time)
-            {
-                mouse_move_step = 1;
-            }
-            else if (press_time <= 3 * mouse_fast_move_thr_time)
-            {
-                mouse_move_step = 2;
-            }
-            else
-            {
-                mouse_move_step = 4;
-            }
-
-            if (ctx->mouse_move_dir & MOUSE_MOVE_LEFT)
-            {
-                input_report_rel(ctx->input_dev, REL_X, -mouse_move_step);
-            } 
-            if (ctx->mouse_move_dir & MOUSE_MOVE_RIGHT)
-            {
-                input_report_rel(ctx->input_dev, REL_X, mouse_move_step);
-            } 
-            if (ctx->mouse_move_dir & MOUSE_MOVE_DOWN)
-            {
-                input_report_rel(ctx->input_dev, REL_Y, mouse_move_step);
-            } 
-            if (ctx->mouse_move_dir & MOUSE_MOVE_UP)
-            {
-                input_report_rel(ctx->input_dev, REL_Y, -mouse_move_step);
-            } 
-        }
+	// Entries are visible before the head that covers them
+	smp_store_release(&ring->head, head + ctx->key_fifo_count);
 
-	// Reset pending FIFO count
-	ctx->key_fifo_count = 0;
+	wake_up_interruptible_poll(&raw->wait, EPOLLIN | EPOLLRDNORM);
 
-	// Synchronize input system and clear client interrupt flag
-	input_sync(ctx->input_dev);
-    /*
-	if (kbd_write_i2c_u8(ctx->i2c_client, REG_INT, 0)) {
-		return;
+	spin_lock(&raw->lock);
+	list_for_each_entry(rf, &raw->files, node) {
+		if (rf->eventfd) {
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 8, 0)
+			eventfd_signal(rf->eventfd, 1);
+#else
+			eventfd_signal(rf->eventfd);
+#endif
+		}
 	}
-    */
-}
-static void kbd_timer_function(struct timer_list *data);
-DEFINE_TIMER(g_kbd_timer,kbd_timer_function);
-
-static void kbd_timer_function(struct timer_list *data)
-{
-    data = NULL;
-    schedule_work(&g_ctx->work_struct);
-    mod_timer(&g_kbd_timer, jiffies + HZ / 128);
+	spin_unlock(&raw->lock);
 }
 
-int input_probe(struct i2c_client* i2c_client)
+// Readers keep the keyboard polled, like an open input device. misc_open
+// holds the misc device lock, so the ring cannot be shut down meanwhile
+static int kbd_raw_open(struct inode *inode, struct file *file)
 {
-	int rc, i;
+	struct kbd_raw_ring *raw = container_of(file->private_data,
+		struct kbd_raw_ring, misc);
+	struct kbd_raw_file *rf;
+	int rc;
 
-	// Allocate keyboard context (managed by device lifetime)
-	g_ctx = devm_kzalloc(&i2c_client->dev, sizeof(*g_ctx), GFP_KERNEL);
-	if (!g_ctx) {
+	rf = kzalloc(sizeof(*rf), GFP_KERNEL);
+	if (!rf) {
 		return -ENOMEM;
 	}
+	rf->raw = raw;
+	rf->seen = smp_load_acquire(&raw->ring->head);
 
-	// Allocate and copy keycode array
-	g_ctx->keycode_map = devm_kmemdup(&i2c_client->dev, keycodes, NUM_KEYCODES,
-		GFP_KERNEL);
-	if (!g_ctx->keycode_map) {
-		return -ENOMEM;
+	if ((rc = pm_runtime_resume_and_get(raw->dev)) < 0) {
+		kfree(rf);
+		return rc;
 	}
 
-	// Initialize keyboard context
-	g_ctx->i2c_client = i2c_client;
-	g_ctx->last_keypress_at = ktime_get_boottime_ns();
+	kref_get(&raw->ref);
+	spin_lock(&raw->lock);
+	list_add_tail(&rf->node, &raw->files);
+	spin_unlock(&raw->lock);
 
-	// Run subsystem probes
-    /*
-	if ((rc = input_fw_probe(i2c_client, g_ctx))) {
-		dev_err(&i2c_client->dev, "picocalc_kbd: input_fw_probe failed\n");
-		return rc;
-	}
-	if ((rc = input_rtc_probe(i2c_client, g_ctx))) {
-		dev_err(&i2c_client->dev, "picocalc_kbd: input_rtc_probe failed\n");
-		return rc;
-	}
-	if ((rc = input_display_probe(i2c_client, g_ctx))) {
-		dev_err(&i2c_client->dev, "picocalc_kbd: input_display_probe failed\n");
-		return rc;
+	file->private_data = rf;
+	return stream_open(inode, file);
+}
+
+static int kbd_raw_release(struct inode *inode, struct file *file)
+{
+	struct kbd_raw_file *rf = file->private_data;
+	struct kbd_raw_ring *raw = rf->raw;
+	bool dead;
+
+	spin_lock(&raw->lock);
+	list_del(&rf->node);
+	dead = raw->dead;
+	spin_unlock(&raw->lock);
+
+	if (rf->eventfd) {
+		eventfd_ctx_put(rf->eventfd);
 	}
-	if ((rc = input_modifiers_probe(i2c_client, g_ctx))) {
-		dev_err(&i2c_client->dev, "picocalc_kbd: input_modifiers_probe failed\n");
-		return rc;
+
+	// Shutdown already dropped the runtime PM references of open files
+	if (!dead) {
+		pm_runtime_mark_last_busy(raw->dev);
+		pm_runtime_put_autosuspend(raw->dev);
 	}
-	if ((rc = input_touch_probe(i2c_client, g_ctx))) {
-		dev_err(&i2c_client->dev, "picocalc_kbd: input_touch_probe failed\n");
-		return rc;
+	kfree(rf);
+	kref_put(&raw->ref, kbd_raw_ring_release);
+
+	return 0;
+}
+
+// Map the header and events read-only, user space never writes the ring
+static int kbd_raw_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct kbd_raw_file *rf = file->private_data;
+
+	if (READ_ONCE(rf->raw->dead)) {
+		return -ENODEV;
 	}
-	if ((rc = input_meta_probe(i2c_client, g_ctx))) {
-		dev_err(&i2c_client->dev, "picocalc_kbd: input_meta_probe failed\n");
-		return rc;
+	if (vma->vm_flags & VM_WRITE) {
+		return -EPERM;
 	}
-    */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
+	vma->vm_flags &= ~VM_MAYWRITE;
+#else
+	vm_flags_clear(vma, VM_MAYWRITE);
+#endif
 
-	// Allocate input device
-	if ((g_ctx->input_dev = devm_input_allocate_device(&i2c_client->dev)) == NULL) {
-		dev_err(&i2c_client->dev,
-			"%s Could not devm_input_allocate_device BBQX0KBD.\n", __func__);
-		return -ENOMEM;
-	}
+	return remap_vmalloc_range(vma, rf->raw->ring, vma->vm_pgoff);
+}
 
-	// Initialize input device
-	g_ctx->input_dev->name = i2c_client->name;
-	g_ctx->input_dev->id.bustype = KBD_BUS_TYPE;
-	g_ctx->input_dev->id.vendor  = KBD_VENDOR_ID;
-	g_ctx->input_dev->id.product = KBD_PRODUCT_ID;
-	g_ctx->input_dev->id.version = KBD_VERSION_ID;
+// Readable while the head is past the tail the reader last published, hung
+// up once the device is gone. Poll itself never consumes anything, so a
+// wakeup for another file in the set does not hide events
+static __poll_t kbd_raw_poll(struct file *file, poll_table *wait)
+{
+	struct kbd_raw_file *rf = file->private_data;
+	struct kbd_raw_ring *raw = rf->raw;
+	uint64_t head, seen;
 
-	// Initialize input device keycodes
-	g_ctx->input_dev->keycode = keycodes; //g_ctx->keycode_map;
-	g_ctx->input_dev->keycodesize = sizeof(keycodes[0]);
-	g_ctx->input_dev->keycodemax = ARRAY_SIZE(keycodes);
+	poll_wait(file, &raw->wait, wait);
 
-	// Set input device keycode bits
-	for (i = 0; i < NUM_KEYCODES; i++) {
-		__set_bit(keycodes[i], g_ctx->input_dev->keybit);
+	if (READ_ONCE(raw->dead)) {
+		return EPOLLHUP;
 	}
-	__clear_bit(KEY_RESERVED, g_ctx->input_dev->keybit);
-	__set_bit(EV_REP, g_ctx->input_dev->evbit);
-	__set_bit(EV_KEY, g_ctx->input_dev->evbit);
+	head = smp_load_acquire(&raw->ring->head);
+	spin_lock(&raw->lock);
+	seen = rf->seen;
+	spin_unlock(&raw->lock);
 
-	// Set input device capabilities
-	input_set_capability(g_ctx->input_dev, EV_MSC, MSC_SCAN);
-	input_set_capability(g_ctx->input_dev, EV_REL, REL_X);
-	input_set_capability(g_ctx->input_dev, EV_REL, REL_Y);
-/*
-	input_set_capability(g_ctx->input_dev, EV_ABS, ABS_X);
-	input_set_capability(g_ctx->input_dev, EV_ABS, ABS_Y);
-        input_set_abs_params(g_ctx->input_dev, ABS_X, 0, 320, 4, 8);
-        input_set_abs_params(g_ctx->input_dev, ABS_Y, 0, 320, 4, 8);
-*/
-	input_set_capability(g_ctx->input_dev, EV_KEY, BTN_LEFT);
-	input_set_capability(g_ctx->input_dev, EV_KEY, BTN_RIGHT);
+	return (head != seen) ? (EPOLLIN | EPOLLRDNORM) : 0;
+}
 
-	// Request IRQ handler for I2C client and initialize workqueue
-    /*
-	if ((rc = devm_request_threaded_irq(&i2c_client->dev,
-		i2c_client->irq, NULL, input_irq_handler, IRQF_SHARED | IRQF_ONESHOT,
-		i2c_client->name, g_ctx))) {
+// Reader publishes how far it got, later poll()s wait for newer events
+static int kbd_raw_consumed(struct kbd_raw_file *rf, unsigned long arg)
+{
+	struct kbd_raw_ring *raw = rf->raw;
+	uint64_t tail, head;
 
-		dev_err(&i2c_client->dev,
-			"Could not claim IRQ %d; error %d\n", i2c_client->irq, rc);
-		return rc;
+	if (copy_from_user(&tail, (void __user *)arg, sizeof(tail))) {
+		return -EFAULT;
 	}
-    */
-        g_ctx->mouse_mode = FALSE;
-        g_ctx->mouse_move_dir = 0;
-	INIT_WORK(&g_ctx->work_struct, input_workqueue_handler);
-    g_kbd_timer.expires = jiffies + HZ / 128;
-    add_timer(&g_kbd_timer);
-
-	// Register input device with input subsystem
-	dev_info(&i2c_client->dev,
-		"%s registering input device", __func__);
-	if ((rc = input_register_device(g_ctx->input_dev))) {
-		dev_err(&i2c_client->dev,
-			"Failed to register input device, error: %d\n", rc);
-		return rc;
+	head = smp_load_acquire(&raw->ring->head);
+	if (tail > head) {
+		return -EINVAL;
 	}
 
+	spin_lock(&raw->lock);
+	rf->seen = tail;
+	spin_unlock(&raw->lock);
 	return 0;
 }
 
-void input_shutdown(struct i2c_client* i2c_client)
+static long kbd_raw_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
-	// Run subsystem shutdowns
-    /*
-	input_meta_shutdown(i2c_client, g_ctx);
-	input_touch_shutdown(i2c_client, g_ctx);
-	input_modifiers_shutdown(i2c_client, g_ctx);
-	input_display_shutdown(i2c_client, g_ctx);
-	input_rtc_shutdown(i2c_client, g_ctx);
-	input_fw_shutdown(i2c_client, g_ctx);
-    */
+	struct kbd_raw_file *rf = file->private_data;
+	struct kbd_raw_ring *raw = rf->raw;
+	struct eventfd_ctx *eventfd = NULL, *old;
+	int fd;
 
-	// Remove context from global state
-	// (It is freed by the device-specific memory mananger)
-    del_timer(&g_kbd_timer);
-	g_ctx = NULL;
-}
+	if ((cmd != PICOCALC_RING_IOC_EVENTFD) && (cmd != PICOCALC_RING_IOC_CONSUMED)) {
+		return -ENOTTY;
+	}
+	if (READ_ONCE(raw->dead)) {
+		return -ENODEV;
+	}
+	if (cmd == PICOCALC_RING_IOC_CONSUMED) {
+		return kbd_raw_consumed(rf, arg);
+	}
+	if (get_user(fd, (int __user *)arg)) {
+		return -EFAULT;
+	}
 
-uint32_t params_get_sysfs_gid(void)
-{
-	return sysfs_gid_setting;
+	if (fd >= 0) {
+		eventfd = eventfd_ctx_fdget(fd);
+		if (IS_ERR(eventfd)) {
+			return PTR_ERR(eventfd);
+		}
+	}
+
+	spin_lock(&raw->lock);
+	old = rf->eventfd;
+	rf->eventfd = eventfd;
+	spin_unlock(&raw->lock);
+
+	if (old) {
+		eventfd_ctx_put(old);
+	}
+	return 0;
 }
 
-// Read battery percent over I2C
-static int read_battery_percent(void)
+static struct file_operations const kbd_raw_fops = {
+	.owner = THIS_MODULE,
+	.open = kbd_raw_open,
+	.release = kbd_raw_release,
+	.mmap = kbd_raw_mmap,
+	.poll = kbd_raw_poll,
+	.unlocked_ioctl = kbd_raw_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+};
+
+// Ring device is optional, failures are not fatal
+void raw_probe(struct i2c_client* i2c_client)
 {
+	struct kbd_ctx *ctx = i2c_get_clientdata(i2c_client);
+	struct kbd_raw_ring *raw;
+	struct picocalc_ring_header *ring;
+	unsigned int entries;
+	size_t data_offset;
 	int rc;
-	uint8_t percent[2];
 
-	// Make sure I2C client was initialized
-	if ((g_ctx == NULL) || (g_ctx->i2c_client == NULL)) {
-		return -EINVAL;
+	if (!raw_ring_entries) {
+		return;
 	}
 
-	// Read battery level
-	if ((rc = kbd_read_i2c_2u8(g_ctx->i2c_client, REG_ID_BAT, percent)) < 0) {
-		return rc;
+	raw = kzalloc(sizeof(*raw), GFP_KERNEL);
+	if (!raw) {
+		dev_warn(&i2c_client->dev,
+			"%s Could not allocate raw event ring\n", __func__);
+		return;
 	}
+	kref_init(&raw->ref);
+	raw->dev = get_device(&i2c_client->dev);
+	init_waitqueue_head(&raw->wait);
+	spin_lock_init(&raw->lock);
+	INIT_LIST_HEAD(&raw->files);
 
-	// Calculate raw battery level
-	return percent[1];
+	entries = roundup_pow_of_two(clamp_t(unsigned int, raw_ring_entries,
+		RAW_RING_MIN_ENTRIES, RAW_RING_MAX_ENTRIES));
+	data_offset = ALIGN(sizeof(*ring), SMP_CACHE_BYTES);
+	raw->size = PAGE_ALIGN(data_offset
+		+ entries * sizeof(struct picocalc_ring_event));
+
+	ring = vmalloc_user(raw->size);
+	if (!ring) {
+		dev_warn(&i2c_client->dev,
+			"%s Could not allocate raw event ring\n", __func__);
+		kref_put(&raw->ref, kbd_raw_ring_release);
+		return;
+	}
+	ring->magic = PICOCALC_RING_MAGIC;
+	ring->version = PICOCALC_RING_VERSION;
+	ring->entries = entries;
+	ring->entry_size = sizeof(struct picocalc_ring_event);
+	ring->data_offset = data_offset;
+	raw->ring = ring;
+	raw->events = (void *)ring + data_offset;
+
+	snprintf(raw->name, sizeof(raw->name), "%s_raw", ctx->name);
+	raw->misc.minor = MISC_DYNAMIC_MINOR;
+	raw->misc.name = raw->name;
+	raw->misc.fops = &kbd_raw_fops;
+	raw->misc.parent = &i2c_client->dev;
+	if ((rc = misc_register(&raw->misc))) {
+		dev_warn(&i2c_client->dev,
+			"%s Could not register %s, error: %d\n",
+			__func__, raw->name, rc);
+		kref_put(&raw->ref, kbd_raw_ring_release);
+		return;
+	}
+
+	// Published under drain_lock, the poller may be running already
+	mutex_lock(&ctx->drain_lock);
+	ctx->raw = raw;
+	mutex_unlock(&ctx->drain_lock);
+
+	dev_info(&i2c_client->dev, "%s Raw event ring /dev/%s, %u entries\n",
+		__func__, raw->name, entries);
 }
 
-static int parse_and_write_i2c_u8(char const* buf, size_t count, uint8_t reg)
+// No new opens after the misc device is gone. Files still open see the
+// ring dead and keep it allocated until they are closed
+void raw_shutdown(struct i2c_client* i2c_client)
 {
-	int parsed;
+	struct kbd_ctx *ctx = i2c_get_clientdata(i2c_client);
+	struct kbd_raw_ring *raw = ctx->raw;
+	struct kbd_raw_file *rf;
+	unsigned int open_files = 0;
 
-	// Parse string entry
-	if ((parsed = parse_u8(buf)) < 0) {
-		return -EINVAL;
+	if (!raw) {
+		return;
 	}
+	misc_deregister(&raw->misc);
+
+	mutex_lock(&ctx->drain_lock);
+	ctx->raw = NULL;
+	mutex_unlock(&ctx->drain_lock);
 
-	// Write value to LED register if available
-	if (g_ctx && g_ctx->i2c_client) {
-		kbd_write_i2c_u8(g_ctx->i2c_client, reg, (uint8_t)parsed);
+	spin_lock(&raw->lock);
+	WRITE_ONCE(raw->dead, true);
+	list_for_each_entry(rf, &raw->files, node) {
+		open_files++;
 	}
+	spin_unlock(&raw->lock);
 
-	return count;
+	// Readers are not coming back for the device
+	while (open_files--) {
+		pm_runtime_put_noidle(raw->dev);
+	}
+	wake_up_interruptible_poll(&raw->wait, EPOLLHUP);
+
+	kref_put(&raw->ref, kbd_raw_ring_release);
 }
 
-// Sysfs entries
+// Power management
 
-// Battery percent approximate
-static ssize_t battery_percent_show(struct kobject *kobj, struct kobj_attribute *attr,
-	char *buf)
+// Stop polling and the pointer, then send anything still queued
+static void kbd_pm_quiesce(struct kbd_ctx* ctx)
 {
-	int percent;
+	kbd_poll_stop(ctx);
+	hrtimer_cancel(&ctx->mouse_timer);
 
-	if ((percent = read_battery_percent()) < 0) {
-		return percent;
+	if (!READ_ONCE(ctx->suspended)) {
+		mutex_lock(&ctx->drain_lock);
+		kbd_xfer_flush(ctx);
+		mutex_unlock(&ctx->drain_lock);
 	}
-
-	// Format into buffer
-	return sprintf(buf, "%d\n", percent);
 }
-struct kobj_attribute battery_percent_attr
-	= __ATTR(battery_percent, 0444, battery_percent_show, NULL);
 
-// Keyboard backlight value
-static ssize_t __used keyboard_backlight_store(struct kobject *kobj,
-	struct kobj_attribute *attr, char const *buf, size_t count)
+static int picocalc_kbd_runtime_suspend(struct device *dev)
 {
-	return parse_and_write_i2c_u8(buf, count, REG_ID_BK2);
+	struct kbd_ctx *ctx = dev_get_drvdata(dev);
+
+	kbd_irq_enable(ctx, false);
+	kbd_pm_quiesce(ctx);
+
+	return 0;
 }
-struct kobj_attribute keyboard_backlight_attr
-	= __ATTR(keyboard_backlight, 0220, NULL, keyboard_backlight_store);
 
-// screen backlight value
-static ssize_t __used screen_backlight_store(struct kobject *kobj,
-	struct kobj_attribute *attr, char const *buf, size_t count)
+static int picocalc_kbd_runtime_resume(struct device *dev)
 {
-	return parse_and_write_i2c_u8(buf, count, REG_ID_BKL);
+	struct kbd_ctx *ctx = dev_get_drvdata(dev);
+
+	if (READ_ONCE(ctx->suspended)) {
+		return 0;
+	}
+
+	// Restart from the fast tier, a key may be waiting
+	mutex_lock(&ctx->drain_lock);
+	WRITE_ONCE(ctx->polling, true);
+	kbd_poll_rearm(ctx, true);
+	mutex_unlock(&ctx->drain_lock);
+	kbd_irq_enable(ctx, true);
+
+	return 0;
 }
-struct kobj_attribute screen_backlight_attr
-	= __ATTR(screen_backlight, 0220, NULL, screen_backlight_store);
 
-// Time since last keypress in milliseconds
-static ssize_t last_keypress_show(struct kobject *kobj, struct kobj_attribute *attr,
-	char *buf)
+// Light levels again, the keyboard may have lost them while asleep
+static void lights_restore(struct kbd_ctx* ctx)
 {
-	uint64_t last_keypress_ms;
+	int i;
 
-	if (g_ctx) {
+	mutex_lock(&ctx->light_lock);
+	for (i = 0; i < KBD_LIGHTS; i++) {
+		ctx->lights[i].level = ctx->lights[i].target;
+		ctx->lights[i].start = ctx->lights[i].target;
+		ctx->lights[i].fade_ms = 0;
+		kbd_xfer_write(ctx, ctx->lights[i].reg, ctx->lights[i].target);
+	}
+	mutex_unlock(&ctx->light_lock);
+}
 
-		// Get time in ns
-		last_keypress_ms = ktime_get_boottime_ns();
-		if (g_ctx->last_keypress_at < last_keypress_ms) {
-			last_keypress_ms -= g_ctx->last_keypress_at;
+static int picocalc_kbd_suspend(struct device *dev)
+{
+	struct kbd_ctx *ctx = dev_get_drvdata(dev);
+	int rc;
 
-			// Calculate time in milliseconds
-			last_keypress_ms = div_u64(last_keypress_ms, 1000000);
+	cancel_delayed_work_sync(&ctx->battery_work);
+	cancel_delayed_work_sync(&ctx->light_fade_work);
 
-			// Format into buffer
-			return sprintf(buf, "%lld\n", last_keypress_ms);
-		}
+	if ((rc = pm_runtime_force_suspend(dev))) {
+		return rc;
 	}
 
-	return sprintf(buf, "-1\n");
-}
-struct kobj_attribute last_keypress_attr
-	= __ATTR(last_keypress, 0444, last_keypress_show, NULL);
+	// Work queued while runtime suspended must not run during sleep
+	WRITE_ONCE(ctx->suspended, true);
+	kthread_cancel_work_sync(&ctx->work_struct);
 
-// Sysfs attributes (entries)
-struct kobject *picocalc_kobj = NULL;
-static struct attribute *picocalc_attrs[] = {
-	&battery_percent_attr.attr,
-	&screen_backlight_attr.attr,
-	&last_keypress_attr.attr,
-	&keyboard_backlight_attr.attr,
-	NULL,
-};
-static struct attribute_group picocalc_attr_group = {
-	.attrs = picocalc_attrs
-};
+	// The keyboard may lose power, write the cached registers back on resume
+	regcache_cache_only(ctx->regmap, true);
+	regcache_mark_dirty(ctx->regmap);
 
-static void picocalc_get_ownership
-#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 6, 0)
-(struct kobject *kobj, kuid_t *uid, kgid_t *gid)
-#else
-(struct kobject const *kobj, kuid_t *uid, kgid_t *gid)
-#endif
-{
-	if (gid != NULL) {
-		gid->val = params_get_sysfs_gid();
+	// Keep the key IRQ live so a key press resumes the system
+	if (ctx->irq_mode && device_may_wakeup(dev)) {
+		kbd_irq_enable(ctx, true);
+		if (!enable_irq_wake(ctx->irq)) {
+			ctx->wake_armed = true;
+		}
 	}
-}
 
-static struct kobj_type picocalc_ktype = {
-	.get_ownership = picocalc_get_ownership,
-	.sysfs_ops = &kobj_sysfs_ops
-};
+	return 0;
+}
 
-int sysfs_probe(struct i2c_client* i2c_client)
+static int picocalc_kbd_resume(struct device *dev)
 {
+	struct kbd_ctx *ctx = dev_get_drvdata(dev);
 	int rc;
 
-	// Allocate custom sysfs type
-	if ((picocalc_kobj = devm_kzalloc(&i2c_client->dev, sizeof(*picocalc_kobj), GFP_KERNEL)) == NULL) {
-		return -ENOMEM;
+	if (ctx->wake_armed) {
+		disable_irq_wake(ctx->irq);
+		ctx->wake_armed = false;
 	}
+	kbd_irq_enable(ctx, false);
 
-	// Create sysfs entries for picocalc with custom type
-	rc = kobject_init_and_add(picocalc_kobj, &picocalc_ktype, firmware_kobj, "picocalc");
-	if (rc < 0) {
-		kobject_put(picocalc_kobj);
-		return rc;
+	// Disabling waited for the handler, undo its mask on top of ours
+	if (ctx->irq_wake_masked) {
+		enable_irq(ctx->irq);
+		ctx->irq_wake_masked = false;
 	}
 
-	// Create sysfs attributes
-	if (sysfs_create_group(picocalc_kobj, &picocalc_attr_group)) {
-		kobject_put(picocalc_kobj);
-		return -ENOMEM;
+	// Config first, then the lights compare against the restored cache
+	regcache_cache_only(ctx->regmap, false);
+	if ((rc = regcache_sync(ctx->regmap))) {
+		dev_warn(dev, "%s Could not restore registers, error: %d\n", __func__, rc);
 	}
 
-	return 0;
-}
+	WRITE_ONCE(ctx->suspended, false);
+	lights_restore(ctx);
 
-void sysfs_shutdown(struct i2c_client* i2c_client)
-{
-	// Remove sysfs entry
-	if (picocalc_kobj) {
-		kobject_put(picocalc_kobj);
-		picocalc_kobj = NULL;
+	// Release the INT line, the wakeup handler left the flag set
+	if (ctx->irq_mode) {
+		kbd_xfer_write(ctx, REG_ID_INT, 0);
 	}
+
+	// Refresh the battery right away, it drained while asleep
+	queue_delayed_work(system_power_efficient_wq, &ctx->battery_work, 0);
+
+	return pm_runtime_force_resume(dev);
 }
 
+static struct dev_pm_ops const picocalc_kbd_pm_ops = {
+	SYSTEM_SLEEP_PM_OPS(picocalc_kbd_suspend, picocalc_kbd_resume)
+	RUNTIME_PM_OPS(picocalc_kbd_runtime_suspend, picocalc_kbd_runtime_resume, NULL)
+};
+
 static int picocalc_kbd_probe
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 6, 0)
 (struct i2c_client* i2c_client, struct i2c_device_id const* i2c_id)
@@ -781,17 +4013,45 @@ static int picocalc_kbd_probe
 	}
     */
 
+	// Initialize battery power supply
+	if ((rc = battery_probe(i2c_client))) {
+		goto err_input;
+	}
+
+	// Initialize backlight and keyboard LED
+	if ((rc = lights_probe(i2c_client))) {
+		goto err_battery;
+	}
+
 	// Initialize sysfs interface
 	if ((rc = sysfs_probe(i2c_client))) {
-		return rc;
+		goto err_lights;
 	}
 
+	// Initialize debugfs statistics
+	debugfs_probe(i2c_client);
+
+	// Initialize optional raw event ring device
+	raw_probe(i2c_client);
+
 	return 0;
+
+err_lights:
+	lights_shutdown(i2c_client);
+err_battery:
+	battery_shutdown(i2c_client);
+err_input:
+	input_shutdown(i2c_client);
+	return rc;
 }
 
 static void picocalc_kbd_shutdown(struct i2c_client* i2c_client)
 {
+	raw_shutdown(i2c_client);
+	debugfs_shutdown(i2c_client);
 	sysfs_shutdown(i2c_client);
+	lights_shutdown(i2c_client);
+	battery_shutdown(i2c_client);
 //	params_shutdown();
 	input_shutdown(i2c_client);
 }
@@ -823,6 +4083,7 @@ static struct i2c_driver picocalc_kbd_driver = {
 	.driver = {
 		.name = "picocalc_kbd",
 		.of_match_table = picocalc_kbd_of_device_id,
+		.pm = pm_ptr(&picocalc_kbd_pm_ops),
 	},
 	.probe    = picocalc_kbd_probe,
 	.shutdown = picocalc_kbd_shutdown,
@@ -859,3 +4120,12 @@ MODULE_LICENSE("GPL");
 MODULE_AUTHOR("hiro <hiro@hiro.com>");
 MODULE_DESCRIPTION("keyboard driver for picocalc");
 MODULE_VERSION("0.01");
+
+// Unit tests need static functions, build with "make KUNIT=1"
+#if defined(PICOCALC_KBD_KUNIT_TEST) && IS_ENABLED(CONFIG_KUNIT)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+#include "picocalc_kbd_test.c"
+#else
+#warning "picocalc_kbd KUnit tests need a 6.0 or later kernel"
+#endif
+#endif
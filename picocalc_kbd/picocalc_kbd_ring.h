@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: GPL-2.0-only WITH Linux-syscall-note */
+/*
+ * Keyboard Driver for picocalc
+ * picocalc_kbd_ring.h: Raw key event ring shared with user space.
+ *
+ * Loading the driver with raw_ring_entries=<n> adds /dev/picocalc_raw (or
+ * /dev/picocalcN_raw), a read-only mapping of every FIFO item as read from
+ * firmware, next to the normal input device. The mapping starts with
+ * struct picocalc_ring_header, followed by a power-of-two array of
+ * struct picocalc_ring_event at data_offset.
+ *
+ * There is one producer and no feedback from readers, so any number of
+ * readers can follow the ring, each keeping its own tail:
+ *
+ *   head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+ *   if (head - tail > hdr->entries)
+ *           tail = head - hdr->entries;          // overrun, events lost
+ *   for (; tail != head; tail++)
+ *           handle(&ev[tail & (hdr->entries - 1)]);
+ *   __atomic_thread_fence(__ATOMIC_ACQUIRE);
+ *   // events older than hdr->head - hdr->entries may have been overwritten
+ *   // while they were handled
+ *   ioctl(fd, PICOCALC_RING_IOC_CONSUMED, &tail);
+ *
+ * poll() reports the device readable while head is past the tail last
+ * published with PICOCALC_RING_IOC_CONSUMED, or past head at open() if none
+ * was. Readers that spin on head need not publish their tail.
+ * PICOCALC_RING_IOC_EVENTFD attaches an eventfd that is signalled on every
+ * batch instead.
+ *
+ * If the keyboard goes away while the device is open, poll() reports
+ * EPOLLHUP and mmap() and ioctl() fail with ENODEV. Existing mappings stay
+ * readable until they are unmapped.
+ */
+
+#ifndef PICOCALC_KBD_RING_H_
+#define PICOCALC_KBD_RING_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define PICOCALC_RING_MAGIC		0x50435242	/* "PCRB" */
+#define PICOCALC_RING_VERSION	1
+
+struct picocalc_ring_header
+{
+	__u32 magic;
+	__u32 version;
+	__u32 entries;			/* power of two */
+	__u32 entry_size;		/* sizeof(struct picocalc_ring_event) */
+	__u32 data_offset;		/* bytes from the start of the mapping to the events */
+	__u32 reserved;
+	__u64 head;				/* events written so far, updated with release order */
+};
+
+struct picocalc_ring_event
+{
+	__u64 timestamp_ns;		/* CLOCK_MONOTONIC when the FIFO read completed */
+	__u8 state;				/* 1 pressed, 2 hold, 3 released, 4 long hold */
+	__u8 scancode;
+	__u8 reserved[6];
+};
+
+/* Attach an eventfd signalled on every batch, a negative fd detaches it */
+#define PICOCALC_RING_IOC_EVENTFD	_IOW('P', 0x01, __s32)
+
+/* Publish the reader's tail, poll() is readable while head is past it */
+#define PICOCALC_RING_IOC_CONSUMED	_IOW('P', 0x02, __u64)
+
+#endif
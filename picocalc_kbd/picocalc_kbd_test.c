@@ -0,0 +1,1223 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Keyboard Driver for picocalc
+ * picocalc_kbd_test.c: KUnit tests, built into the driver with KUNIT=1 or
+ * CONFIG_PICOCALC_KBD_KUNIT_TEST.
+ *
+ * Each test gets a fake keyboard firmware on its own I2C adapter, the same
+ * register map the driver uses on top of it, and a private input device. An
+ * input handler bound only to that device records what the driver reports,
+ * so the FIFO readers, frame splitting, overflow recovery, the dual-role,
+ * sticky and mouse-mode keys, the pointer acceleration curve and the drain
+ * budget are checked without a keyboard.
+ */
+
+#include <kunit/test.h>
+
+#define KBD_TEST_NAME			"picocalc_kbd_kunit"
+#define KBD_TEST_ADDR			0x1f
+#define KBD_TEST_LOG			64
+
+// Full bursts timed against the drain budget, the fastest one counts
+#define KBD_TEST_BUDGET_ROUNDS	8
+
+struct kbd_test_event
+{
+	uint16_t type;
+	uint16_t code;
+	int32_t value;
+};
+
+// Events seen by the recording handler, tests run one at a time
+static struct kbd_test_event kbd_test_log[KBD_TEST_LOG];
+static unsigned int kbd_test_count;
+static bool kbd_test_in_frame;
+
+struct kbd_test_priv
+{
+	struct kbd_ctx ctx;
+	struct i2c_adapter adapter;
+	struct i2c_client *client;
+
+	// Fake firmware, as in picocalc_kbd_sim: register file, selected
+	// register and key FIFO of state/scancode pairs
+	uint8_t regs[KBD_NUM_REGS];
+	uint8_t reg_ptr;
+	uint8_t fifo[KBD_FIFO_SIZE][2];
+	unsigned int fifo_head;
+	unsigned int fifo_count;
+
+	// Bus traffic, and an error to fail every transfer with
+	unsigned int xfers;
+	unsigned int fifo_reads;
+	unsigned int writes[KBD_NUM_REGS];
+	int xfer_error;
+};
+
+#define KBD_TEST_KEY(_code, _value)	{ EV_KEY, (_code), (_value) }
+#define KBD_TEST_SYN				{ EV_SYN, SYN_REPORT, 0 }
+
+#define KBD_TEST_PRESS(_sc)			{ .state = KEY_STATE_PRESSED, .scancode = (_sc) }
+#define KBD_TEST_HOLD(_sc)			{ .state = KEY_STATE_HOLD, .scancode = (_sc) }
+#define KBD_TEST_RELEASE(_sc)		{ .state = KEY_STATE_RELEASED, .scancode = (_sc) }
+
+// Scancodes from picocalc_kbd_code.h
+#define KBD_TEST_SC_ESC				0xB1
+#define KBD_TEST_SC_LEFTALT			0xA1
+#define KBD_TEST_SC_LEFTSHIFT		0xA2
+#define KBD_TEST_SC_RIGHTSHIFT		0xA3
+#define KBD_TEST_SC_LEFTCTRL		0xA5
+
+static void kbd_test_record(struct input_handle *handle, unsigned int type,
+	unsigned int code, int value)
+{
+	// Scan codes go with every key, tests look at keys and frames only.
+	// A frame that only carried scan codes is left out
+	if ((type == EV_MSC) || (kbd_test_count >= KBD_TEST_LOG)) {
+		return;
+	}
+	if (type == EV_SYN) {
+		if (!kbd_test_in_frame) {
+			return;
+		}
+		kbd_test_in_frame = false;
+	} else {
+		kbd_test_in_frame = true;
+	}
+	kbd_test_log[kbd_test_count++] = (struct kbd_test_event){
+		.type = type,
+		.code = code,
+		.value = value,
+	};
+}
+
+static bool kbd_test_match(struct input_handler *handler, struct input_dev *dev)
+{
+	return dev->name && !strcmp(dev->name, KBD_TEST_NAME);
+}
+
+static int kbd_test_connect(struct input_handler *handler, struct input_dev *dev,
+	const struct input_device_id *id)
+{
+	struct input_handle *handle;
+	int rc;
+
+	handle = kzalloc(sizeof(*handle), GFP_KERNEL);
+	if (!handle) {
+		return -ENOMEM;
+	}
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = KBD_TEST_NAME;
+
+	if ((rc = input_register_handle(handle))) {
+		kfree(handle);
+		return rc;
+	}
+	if ((rc = input_open_device(handle))) {
+		input_unregister_handle(handle);
+		kfree(handle);
+		return rc;
+	}
+
+	return 0;
+}
+
+static void kbd_test_disconnect(struct input_handle *handle)
+{
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(handle);
+}
+
+static struct input_device_id const kbd_test_ids[] = {
+	{ .driver_info = 1 },
+	{ },
+};
+
+static struct input_handler kbd_test_handler = {
+	.event = kbd_test_record,
+	.match = kbd_test_match,
+	.connect = kbd_test_connect,
+	.disconnect = kbd_test_disconnect,
+	.name = KBD_TEST_NAME,
+	.id_table = kbd_test_ids,
+};
+
+// Queue an event in the firmware FIFO, dropped once it is full
+static void kbd_test_fw_push(struct kbd_test_priv *priv, uint8_t state,
+	uint8_t scancode)
+{
+	unsigned int tail;
+
+	if (priv->fifo_count >= KBD_FIFO_SIZE) {
+		return;
+	}
+	tail = (priv->fifo_head + priv->fifo_count) % KBD_FIFO_SIZE;
+	priv->fifo[tail][0] = state;
+	priv->fifo[tail][1] = scancode;
+	priv->fifo_count++;
+}
+
+// Fill the FIFO with a hold of 'a' and taps of the next keys, KBD_FIFO_SIZE
+// items that leave every key up again
+static void kbd_test_fw_burst(struct kbd_test_priv *priv)
+{
+	unsigned int i;
+
+	kbd_test_fw_push(priv, KEY_STATE_PRESSED, 'a');
+	kbd_test_fw_push(priv, KEY_STATE_HOLD, 'a');
+	kbd_test_fw_push(priv, KEY_STATE_RELEASED, 'a');
+	for (i = 1; i < KBD_FIFO_TAPS; i++) {
+		kbd_test_fw_push(priv, KEY_STATE_PRESSED, 'a' + i);
+		kbd_test_fw_push(priv, KEY_STATE_RELEASED, 'a' + i);
+	}
+}
+
+// Read from the selected register. The FIFO pops one item per two bytes and
+// reads as zeroes once empty, others reply with the register ID then value
+static void kbd_test_fw_read(struct kbd_test_priv *priv, uint8_t *buf, uint16_t len)
+{
+	uint16_t i;
+
+	if (priv->reg_ptr == REG_ID_FIF) {
+		memset(buf, 0, len);
+		for (i = 0; (i + 1 < len) && priv->fifo_count; i += 2) {
+			buf[i] = priv->fifo[priv->fifo_head][0];
+			buf[i + 1] = priv->fifo[priv->fifo_head][1];
+			priv->fifo_head = (priv->fifo_head + 1) % KBD_FIFO_SIZE;
+			priv->fifo_count--;
+		}
+		priv->fifo_reads++;
+		return;
+	}
+
+	if (priv->reg_ptr == REG_ID_KEY) {
+		priv->regs[REG_ID_KEY] = priv->fifo_count & KEY_COUNT_MASK;
+	}
+
+	memset(buf, 0, len);
+	buf[0] = priv->reg_ptr;
+	if ((len > 1) && (priv->reg_ptr < KBD_NUM_REGS)) {
+		buf[1] = priv->regs[priv->reg_ptr];
+	}
+}
+
+// A write selects the register, with the write bit it also sets it
+static void kbd_test_fw_write(struct kbd_test_priv *priv, uint8_t const *buf,
+	uint16_t len)
+{
+	uint8_t reg = buf[0] & ~PICOCALC_WRITE_MASK;
+
+	priv->reg_ptr = reg;
+	if (!(buf[0] & PICOCALC_WRITE_MASK) || (len < 2) || (reg >= KBD_NUM_REGS)) {
+		return;
+	}
+	priv->regs[reg] = buf[1];
+	priv->writes[reg]++;
+}
+
+// Transfers are serialised by the adapter lock
+static int kbd_test_xfer(struct i2c_adapter *adapter, struct i2c_msg *msgs, int num)
+{
+	struct kbd_test_priv *priv = i2c_get_adapdata(adapter);
+	int i;
+
+	priv->xfers++;
+	if (priv->xfer_error) {
+		return priv->xfer_error;
+	}
+
+	for (i = 0; i < num; i++) {
+		if (msgs[i].addr != KBD_TEST_ADDR) {
+			return -ENXIO;
+		}
+		if (msgs[i].len == 0) {
+			continue;
+		}
+		if (msgs[i].flags & I2C_M_RD) {
+			kbd_test_fw_read(priv, msgs[i].buf, msgs[i].len);
+		} else {
+			kbd_test_fw_write(priv, msgs[i].buf, msgs[i].len);
+		}
+	}
+
+	return num;
+}
+
+static u32 kbd_test_functionality(struct i2c_adapter *adapter)
+{
+	return I2C_FUNC_I2C | I2C_FUNC_SMBUS_EMUL;
+}
+
+static struct i2c_algorithm const kbd_test_algo = {
+	.master_xfer = kbd_test_xfer,
+	.functionality = kbd_test_functionality,
+};
+
+static int kbd_test_init(struct kunit *test)
+{
+	struct kbd_test_priv *priv;
+	struct kbd_ctx *ctx;
+	struct i2c_board_info info = {
+		I2C_BOARD_INFO(KBD_TEST_NAME, KBD_TEST_ADDR),
+	};
+	int rc;
+
+	priv = kunit_kzalloc(test, sizeof(*priv), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, priv);
+	test->priv = priv;
+	ctx = &priv->ctx;
+
+	// Set up first, exit cancels it whatever else failed
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
+	hrtimer_init(&ctx->mouse_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+	ctx->mouse_timer.function = mouse_timer_function;
+#else
+	hrtimer_setup(&ctx->mouse_timer, mouse_timer_function, CLOCK_MONOTONIC,
+		HRTIMER_MODE_REL_SOFT);
+#endif
+
+	// Firmware on its own bus. No driver matches the client name, so the
+	// test is the only one talking to it
+	priv->regs[REG_ID_VER] = KBD_FW_VERSION_FAST_I2C;
+	priv->adapter.owner = THIS_MODULE;
+	priv->adapter.algo = &kbd_test_algo;
+	strscpy(priv->adapter.name, KBD_TEST_NAME, sizeof(priv->adapter.name));
+	i2c_set_adapdata(&priv->adapter, priv);
+	KUNIT_ASSERT_EQ(test, i2c_add_adapter(&priv->adapter), 0);
+
+	priv->client = i2c_new_client_device(&priv->adapter, &info);
+	KUNIT_ASSERT_FALSE(test, IS_ERR(priv->client));
+	i2c_set_clientdata(priv->client, ctx);
+	ctx->i2c_client = priv->client;
+	strscpy(ctx->name, KBD_TEST_NAME, sizeof(ctx->name));
+
+	ctx->stats = alloc_percpu(struct kbd_stats);
+	KUNIT_ASSERT_NOT_NULL(test, ctx->stats);
+
+	ctx->keycode_map = kunit_kmalloc(test, sizeof(keycodes), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ctx->keycode_map);
+	memcpy(ctx->keycode_map, keycodes, sizeof(keycodes));
+
+	// Same map as the driver, on the fake firmware
+	ctx->regmap = regmap_init(&priv->client->dev, NULL, priv->client,
+		&kbd_regmap_config);
+	KUNIT_ASSERT_FALSE(test, IS_ERR(ctx->regmap));
+
+	// No autorepeat, its timer would add events to the log
+	ctx->input_dev = input_allocate_device();
+	KUNIT_ASSERT_NOT_NULL(test, ctx->input_dev);
+	ctx->input_dev->name = KBD_TEST_NAME;
+	input_set_key_capabilities(ctx);
+	if ((rc = input_register_device(ctx->input_dev))) {
+		input_free_device(ctx->input_dev);
+		ctx->input_dev = NULL;
+		KUNIT_ASSERT_EQ(test, rc, 0);
+	}
+
+	spin_lock_init(&ctx->report_lock);
+	spin_lock_init(&ctx->xfer_lock);
+	mutex_init(&ctx->drain_lock);
+	mutex_init(&ctx->battery_lock);
+	ctx->dual_role_pending = -1;
+	ctx->tap_hold_ms = KBD_TAP_HOLD_MS;
+	ctx->drain_budget_us = KBD_DRAIN_BUDGET_US;
+	ctx->bus_hz = KBD_I2C_STANDARD_HZ;
+	ctx->mouse_rate_hz = MOUSE_RATE_HZ;
+	ctx->mouse_speed_min = MOUSE_SPEED_MIN;
+	ctx->mouse_speed_max = MOUSE_SPEED_MAX;
+	ctx->mouse_accel = MOUSE_ACCEL;
+	ctx->mouse_precision_pct = MOUSE_PRECISION_PCT;
+	ctx->scroll_speed_min = SCROLL_SPEED_MIN;
+	ctx->scroll_speed_max = SCROLL_SPEED_MAX;
+	ctx->scroll_accel = SCROLL_ACCEL;
+
+	// There is no poller, queued transactions are flushed by the tests
+	ctx->suspended = true;
+
+	kbd_test_count = 0;
+	kbd_test_in_frame = false;
+	return 0;
+}
+
+static void kbd_test_exit(struct kunit *test)
+{
+	struct kbd_test_priv *priv = test->priv;
+
+	if (!priv) {
+		return;
+	}
+	hrtimer_cancel(&priv->ctx.mouse_timer);
+	if (priv->ctx.stats_enabled) {
+		stats_enable_set(&priv->ctx, 0);
+	}
+	if (priv->ctx.input_dev) {
+		input_unregister_device(priv->ctx.input_dev);
+	}
+	if (!IS_ERR_OR_NULL(priv->ctx.regmap)) {
+		regmap_exit(priv->ctx.regmap);
+	}
+	free_percpu(priv->ctx.stats);
+	if (!IS_ERR_OR_NULL(priv->client)) {
+		i2c_unregister_device(priv->client);
+	}
+	if (device_is_registered(&priv->adapter.dev)) {
+		i2c_del_adapter(&priv->adapter);
+	}
+}
+
+static int kbd_test_suite_init(struct kunit_suite *suite)
+{
+	return input_register_handler(&kbd_test_handler);
+}
+
+static void kbd_test_suite_exit(struct kunit_suite *suite)
+{
+	input_unregister_handler(&kbd_test_handler);
+}
+
+// Compare the recorded events with the expected ones and clear the log
+static void kbd_test_expect(struct kunit *test, struct kbd_test_event const* expect,
+	unsigned int count)
+{
+	unsigned int i;
+
+	KUNIT_EXPECT_EQ(test, kbd_test_count, count);
+	for (i = 0; i < min(kbd_test_count, count); i++) {
+		KUNIT_EXPECT_EQ_MSG(test, kbd_test_log[i].type, expect[i].type,
+			"event %u", i);
+		KUNIT_EXPECT_EQ_MSG(test, kbd_test_log[i].code, expect[i].code,
+			"event %u", i);
+		KUNIT_EXPECT_EQ_MSG(test, kbd_test_log[i].value, expect[i].value,
+			"event %u", i);
+	}
+	kbd_test_count = 0;
+}
+
+#define KBD_TEST_EXPECT(_test, ...) do {							\
+	static struct kbd_test_event const _expect[] = { __VA_ARGS__ };	\
+	kbd_test_expect(_test, _expect, ARRAY_SIZE(_expect));			\
+} while (0)
+
+#define KBD_TEST_EXPECT_NONE(_test)	KUNIT_EXPECT_EQ(_test, kbd_test_count, 0U)
+
+// Report items as if one FIFO read returned them
+static bool kbd_test_drain(struct kbd_ctx* ctx, struct key_fifo_item const* items,
+	unsigned int count)
+{
+	bool inconsistent = false;
+
+	memcpy(ctx->key_fifo_data, items, count * sizeof(*items));
+	ctx->key_fifo_count = count;
+	input_report_fifo(ctx, &inconsistent);
+	ctx->key_fifo_count = 0;
+
+	return inconsistent;
+}
+
+#define KBD_TEST_DRAIN(_ctx, ...) ({								\
+	static struct key_fifo_item const _items[] = { __VA_ARGS__ };	\
+	kbd_test_drain(_ctx, _items, ARRAY_SIZE(_items));				\
+})
+
+static void kbd_test_fifo_decode(struct kunit *test)
+{
+	struct kbd_ctx *ctx = &((struct kbd_test_priv*)test->priv)->ctx;
+	uint8_t const data[] = {
+		KEY_STATE_PRESSED, 'a',
+		KEY_STATE_RELEASED, 'a',
+		KEY_STATE_HOLD, 'b',
+	};
+
+	input_fw_decode_fifo(ctx, data, 3);
+	KUNIT_ASSERT_EQ(test, ctx->key_fifo_count, 3);
+	KUNIT_EXPECT_EQ(test, (int)ctx->key_fifo_data[0].state, KEY_STATE_PRESSED);
+	KUNIT_EXPECT_EQ(test, ctx->key_fifo_data[0].scancode, 'a');
+	KUNIT_EXPECT_EQ(test, (int)ctx->key_fifo_data[1].state, KEY_STATE_RELEASED);
+	KUNIT_EXPECT_EQ(test, ctx->key_fifo_data[1].scancode, 'a');
+	KUNIT_EXPECT_EQ(test, (int)ctx->key_fifo_data[2].state, KEY_STATE_HOLD);
+	KUNIT_EXPECT_EQ(test, ctx->key_fifo_data[2].scancode, 'b');
+}
+
+static void kbd_test_fifo_decode_padding(struct kunit *test)
+{
+	struct kbd_ctx *ctx = &((struct kbd_test_priv*)test->priv)->ctx;
+	uint8_t const data[] = {
+		KEY_STATE_PRESSED, 'a',
+		KEY_STATE_IDLE, 0,
+		KEY_STATE_RELEASED, 'a',
+	};
+
+	// Entries after the first empty one are not FIFO items
+	input_fw_decode_fifo(ctx, data, 3);
+	KUNIT_EXPECT_EQ(test, ctx->key_fifo_count, 1);
+
+	input_fw_decode_fifo(ctx, data, 0);
+	KUNIT_EXPECT_EQ(test, ctx->key_fifo_count, 0);
+}
+
+static void kbd_test_fifo_decode_clamp(struct kunit *test)
+{
+	struct kbd_ctx *ctx = &((struct kbd_test_priv*)test->priv)->ctx;
+	uint8_t data[(KBD_FIFO_SIZE + 1) * 2];
+	unsigned int i;
+
+	for (i = 0; i < KBD_FIFO_SIZE + 1; i++) {
+		data[i * 2] = KEY_STATE_PRESSED;
+		data[i * 2 + 1] = 'a' + (i % 26);
+	}
+
+	input_fw_decode_fifo(ctx, data, KBD_FIFO_SIZE + 1);
+	KUNIT_EXPECT_EQ(test, ctx->key_fifo_count, KBD_FIFO_SIZE);
+}
+
+static void kbd_test_frame_merge(struct kunit *test)
+{
+	struct kbd_ctx *ctx = &((struct kbd_test_priv*)test->priv)->ctx;
+	bool inconsistent;
+
+	// Different keys share a frame
+	inconsistent = KBD_TEST_DRAIN(ctx, KBD_TEST_PRESS('a'), KBD_TEST_PRESS('b'));
+	KUNIT_EXPECT_FALSE(test, inconsistent);
+	KBD_TEST_EXPECT(test,
+		KBD_TEST_KEY(KEY_A, 1), KBD_TEST_KEY(KEY_B, 1), KBD_TEST_SYN);
+	KUNIT_EXPECT_EQ(test, ctx->frames_split, 0);
+}
+
+static void kbd_test_frame_split(struct kunit *test)
+{
+	struct kbd_ctx *ctx = &((struct kbd_test_priv*)test->priv)->ctx;
+	bool inconsistent;
+
+	// Two taps of one key in a drain, each change in its own frame
+	inconsistent = KBD_TEST_DRAIN(ctx,
+		KBD_TEST_PRESS('a'), KBD_TEST_RELEASE('a'),
+		KBD_TEST_PRESS('a'), KBD_TEST_RELEASE('a'));
+	KUNIT_EXPECT_FALSE(test, inconsistent);
+	KBD_TEST_EXPECT(test,
+		KBD_TEST_KEY(KEY_A, 1), KBD_TEST_SYN,
+		KBD_TEST_KEY(KEY_A, 0), KBD_TEST_SYN,
+		KBD_TEST_KEY(KEY_A, 1), KBD_TEST_SYN,
+		KBD_TEST_KEY(KEY_A, 0), KBD_TEST_SYN);
+	KUNIT_EXPECT_EQ(test, ctx->frames_split, 3);
+}
+
+static void kbd_test_lost_release(struct kunit *test)
+{
+	struct kbd_ctx *ctx = &((struct kbd_test_priv*)test->priv)->ctx;
+	bool inconsistent;
+
+	// A second press without a release reports the missing release first
+	inconsistent = KBD_TEST_DRAIN(ctx, KBD_TEST_PRESS('a'));
+	KUNIT_EXPECT_FALSE(test, inconsistent);
+	inconsistent = KBD_TEST_DRAIN(ctx, KBD_TEST_PRESS('a'));
+	KUNIT_EXPECT_TRUE(test, inconsistent);
+	KBD_TEST_EXPECT(test,
+		KBD_TEST_KEY(KEY_A, 1), KBD_TEST_SYN,
+		KBD_TEST_KEY(KEY_A, 0), KBD_TEST_SYN,
+		KBD_TEST_KEY(KEY_A, 1), KBD_TEST_SYN);
+	KUNIT_EXPECT_EQ(test, ctx->overflow_released, 1);
+
+	// A release of a key firmware never reported down is inconsistent too
+	inconsistent = KBD_TEST_DRAIN(ctx, KBD_TEST_RELEASE('b'));
+	KUNIT_EXPECT_TRUE(test, inconsistent);
+}
+
+static void kbd_test_overflow_recover(struct kunit *test)
+{
+	struct kbd_ctx *ctx = &((struct kbd_test_priv*)test->priv)->ctx;
+
+	KBD_TEST_DRAIN(ctx, KBD_TEST_PRESS('a'), KBD_TEST_PRESS('b'));
+	KBD_TEST_EXPECT(test,
+		KBD_TEST_KEY(KEY_A, 1), KBD_TEST_KEY(KEY_B, 1), KBD_TEST_SYN);
+
+	// Full FIFO not yet caught up with, keys stay down
+	input_overflow_recover(ctx, true, false, false, false);
+	KBD_TEST_EXPECT_NONE(test);
+	KUNIT_EXPECT_TRUE(test, ctx->overflow_pending);
+
+	// Still the same episode once caught up, then every key is released
+	input_overflow_recover(ctx, true, true, true, false);
+	KBD_TEST_EXPECT(test,
+		KBD_TEST_KEY(KEY_A, 0), KBD_TEST_KEY(KEY_B, 0), KBD_TEST_SYN);
+	KUNIT_EXPECT_FALSE(test, ctx->overflow_pending);
+	KUNIT_EXPECT_EQ(test, ctx->overflows, 1);
+	KUNIT_EXPECT_EQ(test, ctx->overflow_full, 1);
+	KUNIT_EXPECT_EQ(test, ctx->overflow_flagged, 1);
+	KUNIT_EXPECT_EQ(test, ctx->overflow_recovered, 1);
+	KUNIT_EXPECT_EQ(test, ctx->overflow_released, 2);
+	KUNIT_EXPECT_TRUE(test, bitmap_empty(ctx->keys_down, NUM_KEYCODES));
+}
+
+// Esc sends Esc when tapped and left ctrl when held
+static void kbd_test_dual_role_setup(struct kbd_ctx* ctx)
+{
+	ctx->dual_roles[0] = (struct kbd_dual_role){
+		.scancode = KBD_TEST_SC_ESC,
+		.tap = KEY_ESC,
+		.hold = KEY_LEFTCTRL,
+		.tap_ms = KBD_TAP_HOLD_MS,
+	};
+	ctx->dual_role_count = 1;
+	dual_role_reindex(ctx);
+}
+
+static void kbd_test_dual_role_tap(struct kunit *test)
+{
+	struct kbd_ctx *ctx = &((struct kbd_test_priv*)test->priv)->ctx;
+
+	kbd_test_dual_role_setup(ctx);
+
+	KBD_TEST_DRAIN(ctx, KBD_TEST_PRESS(KBD_TEST_SC_ESC));
+	KBD_TEST_EXPECT_NONE(test);
+
+	KBD_TEST_DRAIN(ctx, KBD_TEST_RELEASE(KBD_TEST_SC_ESC));
+	KBD_TEST_EXPECT(test,
+		KBD_TEST_KEY(KEY_ESC, 1), KBD_TEST_SYN,
+		KBD_TEST_KEY(KEY_ESC, 0), KBD_TEST_SYN);
+	KUNIT_EXPECT_EQ(test, ctx->dual_role_pending, -1);
+}
+
+static void kbd_test_dual_role_hold(struct kunit *test)
+{
+	struct kbd_ctx *ctx = &((struct kbd_test_priv*)test->priv)->ctx;
+
+	kbd_test_dual_role_setup(ctx);
+
+	// Firmware hold commits to the hold keycode
+	KBD_TEST_DRAIN(ctx, KBD_TEST_PRESS(KBD_TEST_SC_ESC),
+		KBD_TEST_HOLD(KBD_TEST_SC_ESC));
+	KBD_TEST_EXPECT(test, KBD_TEST_KEY(KEY_LEFTCTRL, 1), KBD_TEST_SYN);
+
+	KBD_TEST_DRAIN(ctx, KBD_TEST_RELEASE(KBD_TEST_SC_ESC));
+	KBD_TEST_EXPECT(test, KBD_TEST_KEY(KEY_LEFTCTRL, 0), KBD_TEST_SYN);
+}
+
+static void kbd_test_dual_role_chord(struct kunit *test)
+{
+	struct kbd_ctx *ctx = &((struct kbd_test_priv*)test->priv)->ctx;
+
+	kbd_test_dual_role_setup(ctx);
+
+	// Another key pressed first makes it a hold, ahead of that key
+	KBD_TEST_DRAIN(ctx, KBD_TEST_PRESS(KBD_TEST_SC_ESC), KBD_TEST_PRESS('a'));
+	KBD_TEST_EXPECT(test,
+		KBD_TEST_KEY(KEY_LEFTCTRL, 1), KBD_TEST_KEY(KEY_A, 1), KBD_TEST_SYN);
+
+	KBD_TEST_DRAIN(ctx, KBD_TEST_RELEASE('a'), KBD_TEST_RELEASE(KBD_TEST_SC_ESC));
+	KBD_TEST_EXPECT(test,
+		KBD_TEST_KEY(KEY_A, 0), KBD_TEST_KEY(KEY_LEFTCTRL, 0), KBD_TEST_SYN);
+}
+
+static void kbd_test_dual_role_late_release(struct kunit *test)
+{
+	struct kbd_ctx *ctx = &((struct kbd_test_priv*)test->priv)->ctx;
+
+	kbd_test_dual_role_setup(ctx);
+
+	KBD_TEST_DRAIN(ctx, KBD_TEST_PRESS(KBD_TEST_SC_ESC));
+	KBD_TEST_EXPECT_NONE(test);
+
+	// Released past the window with no firmware hold, the hold key is tapped
+	ctx->dual_roles[0].pressed_at -= NSEC_PER_SEC;
+	KBD_TEST_DRAIN(ctx, KBD_TEST_RELEASE(KBD_TEST_SC_ESC));
+	KBD_TEST_EXPECT(test,
+		KBD_TEST_KEY(KEY_LEFTCTRL, 1), KBD_TEST_SYN,
+		KBD_TEST_KEY(KEY_LEFTCTRL, 0), KBD_TEST_SYN);
+
+	// Without a hold key it falls back to the tap
+	ctx->dual_roles[0].hold = 0;
+	KBD_TEST_DRAIN(ctx, KBD_TEST_PRESS(KBD_TEST_SC_ESC));
+	ctx->dual_roles[0].pressed_at -= NSEC_PER_SEC;
+	KBD_TEST_DRAIN(ctx, KBD_TEST_RELEASE(KBD_TEST_SC_ESC));
+	KBD_TEST_EXPECT(test,
+		KBD_TEST_KEY(KEY_ESC, 1), KBD_TEST_SYN,
+		KBD_TEST_KEY(KEY_ESC, 0), KBD_TEST_SYN);
+}
+
+static void kbd_test_sticky_latch(struct kunit *test)
+{
+	struct kbd_ctx *ctx = &((struct kbd_test_priv*)test->priv)->ctx;
+
+	ctx->sticky_modifiers = 1;
+
+	// A lone shift tap is reported and latched
+	KBD_TEST_DRAIN(ctx, KBD_TEST_PRESS(KBD_TEST_SC_LEFTSHIFT),
+		KBD_TEST_RELEASE(KBD_TEST_SC_LEFTSHIFT));
+	KBD_TEST_EXPECT(test,
+		KBD_TEST_KEY(KEY_LEFTSHIFT, 1), KBD_TEST_SYN,
+		KBD_TEST_KEY(KEY_LEFTSHIFT, 0), KBD_TEST_SYN);
+	KUNIT_EXPECT_NE(test, ctx->sticky_pending, 0);
+
+	// The next key gets shift in its frame, released in the frame after
+	KBD_TEST_DRAIN(ctx, KBD_TEST_PRESS('a'), KBD_TEST_RELEASE('a'));
+	KBD_TEST_EXPECT(test,
+		KBD_TEST_KEY(KEY_LEFTSHIFT, 1), KBD_TEST_KEY(KEY_A, 1), KBD_TEST_SYN,
+		KBD_TEST_KEY(KEY_LEFTSHIFT, 0), KBD_TEST_SYN,
+		KBD_TEST_KEY(KEY_A, 0), KBD_TEST_SYN);
+	KUNIT_EXPECT_EQ(test, ctx->sticky_pending, 0);
+
+	// Only once
+	KBD_TEST_DRAIN(ctx, KBD_TEST_PRESS('a'));
+	KBD_TEST_EXPECT(test, KBD_TEST_KEY(KEY_A, 1), KBD_TEST_SYN);
+}
+
+static void kbd_test_sticky_unlatch(struct kunit *test)
+{
+	struct kbd_ctx *ctx = &((struct kbd_test_priv*)test->priv)->ctx;
+
+	ctx->sticky_modifiers = 1;
+
+	// Tapping a latched modifier again unlatches it
+	KBD_TEST_DRAIN(ctx, KBD_TEST_PRESS(KBD_TEST_SC_LEFTSHIFT),
+		KBD_TEST_RELEASE(KBD_TEST_SC_LEFTSHIFT));
+	KBD_TEST_DRAIN(ctx, KBD_TEST_PRESS(KBD_TEST_SC_LEFTSHIFT),
+		KBD_TEST_RELEASE(KBD_TEST_SC_LEFTSHIFT));
+	KUNIT_EXPECT_EQ(test, ctx->sticky_pending, 0);
+
+	// Shift used as a chord does not latch
+	KBD_TEST_DRAIN(ctx, KBD_TEST_PRESS(KBD_TEST_SC_LEFTSHIFT), KBD_TEST_PRESS('a'),
+		KBD_TEST_RELEASE('a'), KBD_TEST_RELEASE(KBD_TEST_SC_LEFTSHIFT));
+	KUNIT_EXPECT_EQ(test, ctx->sticky_pending, 0);
+}
+
+static void kbd_test_xfer_cached(struct kunit *test)
+{
+	struct kbd_test_priv *priv = test->priv;
+	struct kbd_ctx *ctx = &priv->ctx;
+	unsigned int value;
+
+	priv->regs[REG_ID_BKL] = 0x40;
+	priv->regs[REG_ID_BAT] = 0x80 | 55;
+	KUNIT_ASSERT_EQ(test, regmap_read(ctx->regmap, REG_ID_BKL, &value), 0);
+
+	// A write of the cached value stays off the bus, the last queued wins
+	kbd_xfer_write(ctx, REG_ID_BKL, 0x10);
+	kbd_xfer_write(ctx, REG_ID_BKL, 0x40);
+	kbd_xfer_flush(ctx);
+	KUNIT_EXPECT_EQ(test, priv->writes[REG_ID_BKL], 0);
+	KUNIT_EXPECT_EQ(test, ctx->xfer_coalesced, 1);
+	KUNIT_EXPECT_EQ(test, ctx->xfer_cached, 1);
+
+	kbd_xfer_write(ctx, REG_ID_BKL, 0x50);
+	kbd_xfer_flush(ctx);
+	KUNIT_EXPECT_EQ(test, priv->writes[REG_ID_BKL], 1);
+	KUNIT_EXPECT_EQ(test, priv->regs[REG_ID_BKL], 0x50);
+	KUNIT_EXPECT_EQ(test, ctx->xfer_issued, 1);
+
+	// Volatile registers are always written
+	kbd_xfer_write(ctx, REG_ID_INT, 0);
+	kbd_xfer_write(ctx, REG_ID_INT, 0);
+	kbd_xfer_flush(ctx);
+	kbd_xfer_write(ctx, REG_ID_INT, 0);
+	kbd_xfer_flush(ctx);
+	KUNIT_EXPECT_EQ(test, priv->writes[REG_ID_INT], 2);
+
+	// Queued reads complete into the battery cache
+	kbd_xfer_read(ctx, REG_ID_BAT);
+	kbd_xfer_flush(ctx);
+	KUNIT_EXPECT_EQ(test, ctx->xfer_reads, 1);
+	KUNIT_EXPECT_TRUE(test, ctx->battery_charging);
+	KUNIT_EXPECT_EQ(test, ctx->battery_capacity, 55);
+}
+
+static void kbd_test_drain_bus_time(struct kunit *test)
+{
+	struct kbd_ctx *ctx = &((struct kbd_test_priv*)test->priv)->ctx;
+
+	// 32 word reads for a full FIFO read one entry at a time, about 15 ms
+	// at 100 kHz, more than the fast poll interval
+	ctx->bus_hz = KBD_I2C_STANDARD_HZ;
+	ctx->fifo_batched = false;
+	KUNIT_EXPECT_EQ(test, kbd_drain_bus_us(ctx), 15040);
+
+	// One word read and one 62 byte block read
+	ctx->bus_hz = 400000;
+	ctx->fifo_batched = true;
+	KUNIT_EXPECT_EQ(test, kbd_drain_bus_us(ctx), 1585);
+}
+
+static void kbd_test_mouse_precision(struct kunit *test)
+{
+	struct kbd_ctx *ctx = &((struct kbd_test_priv*)test->priv)->ctx;
+	bool inconsistent;
+
+	ctx->mouse_mode = 1;
+
+	// Left alt still reaches applications in mouse mode, for alt-drag
+	inconsistent = KBD_TEST_DRAIN(ctx, KBD_TEST_PRESS(KBD_TEST_SC_LEFTALT));
+	KUNIT_EXPECT_FALSE(test, inconsistent);
+	KBD_TEST_EXPECT(test, KBD_TEST_KEY(KEY_LEFTALT, 1), KBD_TEST_SYN);
+	KUNIT_EXPECT_FALSE(test, ctx->mouse_precision);
+
+	// Precision is held on its own key, which is not reported
+	inconsistent = KBD_TEST_DRAIN(ctx, KBD_TEST_PRESS(';'));
+	KUNIT_EXPECT_FALSE(test, inconsistent);
+	KBD_TEST_EXPECT_NONE(test);
+	KUNIT_EXPECT_TRUE(test, ctx->mouse_precision);
+
+	inconsistent = KBD_TEST_DRAIN(ctx,
+		KBD_TEST_RELEASE(';'), KBD_TEST_RELEASE(KBD_TEST_SC_LEFTALT));
+	KUNIT_EXPECT_FALSE(test, inconsistent);
+	KBD_TEST_EXPECT(test, KBD_TEST_KEY(KEY_LEFTALT, 0), KBD_TEST_SYN);
+	KUNIT_EXPECT_FALSE(test, ctx->mouse_precision);
+}
+
+static void kbd_test_mouse_scroll_mod(struct kunit *test)
+{
+	struct kbd_ctx *ctx = &((struct kbd_test_priv*)test->priv)->ctx;
+	bool inconsistent;
+
+	ctx->mouse_mode = 1;
+
+	// Left ctrl still reaches applications in mouse mode, for ctrl-click
+	inconsistent = KBD_TEST_DRAIN(ctx, KBD_TEST_PRESS(KBD_TEST_SC_LEFTCTRL));
+	KUNIT_EXPECT_FALSE(test, inconsistent);
+	KBD_TEST_EXPECT(test, KBD_TEST_KEY(KEY_LEFTCTRL, 1), KBD_TEST_SYN);
+	KUNIT_EXPECT_FALSE(test, ctx->mouse_scroll_mod);
+
+	inconsistent = KBD_TEST_DRAIN(ctx, KBD_TEST_PRESS(']'));
+	KUNIT_EXPECT_FALSE(test, inconsistent);
+	KBD_TEST_EXPECT(test, KBD_TEST_KEY(BTN_LEFT, 1), KBD_TEST_SYN);
+
+	inconsistent = KBD_TEST_DRAIN(ctx,
+		KBD_TEST_RELEASE(']'), KBD_TEST_RELEASE(KBD_TEST_SC_LEFTCTRL));
+	KUNIT_EXPECT_FALSE(test, inconsistent);
+	KBD_TEST_EXPECT(test,
+		KBD_TEST_KEY(BTN_LEFT, 0), KBD_TEST_KEY(KEY_LEFTCTRL, 0), KBD_TEST_SYN);
+
+	// Scrolling is held on its own key, which is not reported
+	inconsistent = KBD_TEST_DRAIN(ctx, KBD_TEST_PRESS('\''));
+	KUNIT_EXPECT_FALSE(test, inconsistent);
+	KBD_TEST_EXPECT_NONE(test);
+	KUNIT_EXPECT_TRUE(test, ctx->mouse_scroll_mod);
+
+	inconsistent = KBD_TEST_DRAIN(ctx, KBD_TEST_RELEASE('\''));
+	KUNIT_EXPECT_FALSE(test, inconsistent);
+	KUNIT_EXPECT_FALSE(test, ctx->mouse_scroll_mod);
+}
+
+static void kbd_test_fw_probe(struct kunit *test)
+{
+	struct kbd_test_priv *priv = test->priv;
+	struct kbd_ctx *ctx = &priv->ctx;
+	int fifo_mode_saved = fifo_mode;
+	bool overflow_int_saved = overflow_int;
+
+	priv->regs[REG_ID_VER] = 0x10;
+	priv->regs[REG_ID_CFG] = CFG_OVERFLOW_ON | CFG_KEY_INT;
+
+	// Without the batched-fifo property reads are legacy, CFG is only read
+	fifo_mode = KBD_FIFO_MODE_AUTO;
+	overflow_int = false;
+	input_fw_probe(priv->client, ctx);
+	KUNIT_EXPECT_EQ(test, ctx->version_number, 0x10);
+	KUNIT_EXPECT_FALSE(test, ctx->fifo_batched);
+	KUNIT_EXPECT_EQ(test, ctx->bus_hz, KBD_I2C_STANDARD_HZ);
+	KUNIT_EXPECT_TRUE(test, ctx->cfg_valid);
+	KUNIT_EXPECT_EQ(test, ctx->cfg_saved, CFG_OVERFLOW_ON | CFG_KEY_INT);
+	KUNIT_EXPECT_FALSE(test, ctx->overflow_int);
+	KUNIT_EXPECT_EQ(test, priv->writes[REG_ID_CFG], 0);
+
+	// Opting in adds the overflow interrupt to what firmware had
+	fifo_mode = KBD_FIFO_MODE_BATCHED;
+	overflow_int = true;
+	input_fw_probe(priv->client, ctx);
+	KUNIT_EXPECT_TRUE(test, ctx->fifo_batched);
+	KUNIT_EXPECT_TRUE(test, ctx->overflow_int);
+	KUNIT_EXPECT_EQ(test, priv->writes[REG_ID_CFG], 1);
+	KUNIT_EXPECT_EQ(test, priv->regs[REG_ID_CFG],
+		CFG_OVERFLOW_ON | CFG_OVERFLOW_INT | CFG_KEY_INT);
+
+	fifo_mode = fifo_mode_saved;
+	overflow_int = overflow_int_saved;
+}
+
+static void kbd_test_fifo_legacy(struct kunit *test)
+{
+	struct kbd_test_priv *priv = test->priv;
+	struct kbd_ctx *ctx = &priv->ctx;
+
+	// One word read per item, up to the first empty one
+	ctx->fifo_batched = false;
+	kbd_test_fw_push(priv, KEY_STATE_PRESSED, 'a');
+	kbd_test_fw_push(priv, KEY_STATE_RELEASED, 'a');
+	kbd_test_fw_push(priv, KEY_STATE_HOLD, 'b');
+	input_fw_read_fifo(ctx);
+	KUNIT_ASSERT_EQ(test, ctx->key_fifo_count, 3);
+	KUNIT_EXPECT_EQ(test, (int)ctx->key_fifo_data[0].state, KEY_STATE_PRESSED);
+	KUNIT_EXPECT_EQ(test, ctx->key_fifo_data[0].scancode, 'a');
+	KUNIT_EXPECT_EQ(test, (int)ctx->key_fifo_data[1].state, KEY_STATE_RELEASED);
+	KUNIT_EXPECT_EQ(test, ctx->key_fifo_data[1].scancode, 'a');
+	KUNIT_EXPECT_EQ(test, (int)ctx->key_fifo_data[2].state, KEY_STATE_HOLD);
+	KUNIT_EXPECT_EQ(test, ctx->key_fifo_data[2].scancode, 'b');
+	KUNIT_EXPECT_EQ(test, priv->fifo_reads, 4U);
+	KUNIT_EXPECT_EQ(test, priv->xfers, 4U);
+
+	// A full FIFO is read to the end without the empty read
+	priv->xfers = 0;
+	kbd_test_fw_burst(priv);
+	input_fw_read_fifo(ctx);
+	KUNIT_EXPECT_EQ(test, ctx->key_fifo_count, KBD_FIFO_SIZE);
+	KUNIT_EXPECT_EQ(test, priv->fifo_count, 0U);
+	KUNIT_EXPECT_EQ(test, priv->xfers, KBD_FIFO_SIZE);
+}
+
+static void kbd_test_fifo_batched(struct kunit *test)
+{
+	struct kbd_test_priv *priv = test->priv;
+	struct kbd_ctx *ctx = &priv->ctx;
+
+	// The pending count, then all items in one block read
+	ctx->fifo_batched = true;
+	kbd_test_fw_push(priv, KEY_STATE_PRESSED, 'a');
+	kbd_test_fw_push(priv, KEY_STATE_RELEASED, 'a');
+	kbd_test_fw_push(priv, KEY_STATE_PRESSED, 'b');
+	input_fw_read_fifo(ctx);
+	KUNIT_ASSERT_EQ(test, ctx->key_fifo_count, 3);
+	KUNIT_EXPECT_EQ(test, (int)ctx->key_fifo_data[2].state, KEY_STATE_PRESSED);
+	KUNIT_EXPECT_EQ(test, ctx->key_fifo_data[2].scancode, 'b');
+	KUNIT_EXPECT_EQ(test, priv->fifo_reads, 1U);
+	KUNIT_EXPECT_EQ(test, priv->xfers, 2U);
+
+	// An empty FIFO costs the count read only
+	priv->xfers = 0;
+	input_fw_read_fifo(ctx);
+	KUNIT_EXPECT_EQ(test, ctx->key_fifo_count, 0);
+	KUNIT_EXPECT_EQ(test, priv->xfers, 1U);
+
+	// Without a count nothing is popped
+	priv->xfer_error = -EIO;
+	kbd_test_fw_push(priv, KEY_STATE_PRESSED, 'c');
+	input_fw_read_fifo(ctx);
+	KUNIT_EXPECT_EQ(test, ctx->key_fifo_count, 0);
+	KUNIT_EXPECT_EQ(test, priv->fifo_count, 1U);
+}
+
+static void kbd_test_fifo_burst(struct kunit *test)
+{
+	struct kbd_test_priv *priv = test->priv;
+	struct kbd_ctx *ctx = &priv->ctx;
+	struct kbd_test_event expect[KBD_TEST_LOG];
+	unsigned short keycode;
+	unsigned int i, n = 0;
+	bool inconsistent = false;
+
+	// A full FIFO in one drain pass
+	ctx->fifo_batched = true;
+	kbd_test_fw_burst(priv);
+	KUNIT_EXPECT_EQ(test, input_drain_pass(ctx, &inconsistent), KBD_FIFO_SIZE);
+	KUNIT_EXPECT_FALSE(test, inconsistent);
+	KUNIT_EXPECT_EQ(test, priv->fifo_count, 0U);
+	KUNIT_EXPECT_EQ(test, priv->xfers, 2U);
+
+	// Each release repeats its key and starts a frame, which the next
+	// press shares. The hold is not reported
+	for (i = 0; i < KBD_FIFO_TAPS; i++) {
+		keycode = ctx->keycode_map['a' + i];
+		expect[n++] = (struct kbd_test_event)KBD_TEST_KEY(keycode, 1);
+		expect[n++] = (struct kbd_test_event)KBD_TEST_SYN;
+		expect[n++] = (struct kbd_test_event)KBD_TEST_KEY(keycode, 0);
+	}
+	expect[n++] = (struct kbd_test_event)KBD_TEST_SYN;
+	kbd_test_expect(test, expect, n);
+	KUNIT_EXPECT_EQ(test, ctx->frames_split, KBD_FIFO_TAPS);
+	KUNIT_EXPECT_TRUE(test, bitmap_empty(ctx->keys_down, NUM_KEYCODES));
+}
+
+static void kbd_test_drain_budget(struct kunit *test)
+{
+	struct kbd_test_priv *priv = test->priv;
+	struct kbd_ctx *ctx = &priv->ctx;
+	bool inconsistent = false;
+
+	// Not checked without statistics, however small the budget
+	ctx->fifo_batched = true;
+	ctx->drain_budget_us = 0;
+	kbd_test_fw_burst(priv);
+	input_drain_pass(ctx, &inconsistent);
+	KUNIT_EXPECT_EQ(test, ctx->drain_over_budget, 0);
+
+	// With them a drain that reported anything is over, an empty one is
+	// not checked
+	stats_enable_set(ctx, 1);
+	kbd_test_fw_burst(priv);
+	input_drain_pass(ctx, &inconsistent);
+	input_drain_pass(ctx, &inconsistent);
+	stats_enable_set(ctx, 0);
+	KUNIT_EXPECT_EQ(test, ctx->drain_over_budget, 1);
+	KUNIT_EXPECT_FALSE(test, inconsistent);
+}
+
+static void kbd_test_drain_budget_time(struct kunit *test)
+{
+	struct kbd_test_priv *priv = test->priv;
+	struct kbd_ctx *ctx = &priv->ctx;
+	uint64_t budget_ns = (uint64_t)KBD_DRAIN_BUDGET_US * NSEC_PER_USEC;
+	uint64_t start, elapsed_ns, best_ns = U64_MAX;
+	unsigned int round;
+	bool inconsistent = false;
+
+	// Reporting a full FIFO fits the default budget. The fastest round
+	// counts, so the test thread being preempted does not
+	ctx->fifo_batched = true;
+	for (round = 0; round < KBD_TEST_BUDGET_ROUNDS; round++) {
+		kbd_test_fw_burst(priv);
+		input_fw_read_fifo(ctx);
+		KUNIT_ASSERT_EQ(test, ctx->key_fifo_count, KBD_FIFO_SIZE);
+
+		start = ktime_get_ns();
+		input_report_fifo(ctx, &inconsistent);
+		elapsed_ns = ktime_get_ns() - start;
+		best_ns = min(best_ns, elapsed_ns);
+
+		ctx->key_fifo_count = 0;
+		kbd_test_count = 0;
+	}
+	KUNIT_EXPECT_FALSE(test, inconsistent);
+	KUNIT_EXPECT_LE(test, best_ns, budget_ns);
+	kunit_info(test, "reporting %u events took %llu ns, budget %llu ns\n",
+		KBD_FIFO_SIZE, best_ns, budget_ns);
+
+	// The driver's own check passes the same drains
+	stats_enable_set(ctx, 1);
+	for (round = 0; round < KBD_TEST_BUDGET_ROUNDS; round++) {
+		kbd_test_fw_burst(priv);
+		input_drain_pass(ctx, &inconsistent);
+		kbd_test_count = 0;
+	}
+	stats_enable_set(ctx, 0);
+	KUNIT_EXPECT_LT(test, ctx->drain_over_budget, (uint64_t)KBD_TEST_BUDGET_ROUNDS);
+}
+
+static void kbd_test_battery_read(struct kunit *test)
+{
+	struct kbd_test_priv *priv = test->priv;
+	struct kbd_ctx *ctx = &priv->ctx;
+	int raw;
+
+	// BAT is volatile, every read goes to firmware
+	priv->regs[REG_ID_BAT] = BATTERY_CHARGING | 55;
+	raw = read_battery_percent(ctx);
+	KUNIT_EXPECT_EQ(test, raw, BATTERY_CHARGING | 55);
+	KUNIT_EXPECT_EQ(test, priv->xfers, 1U);
+	KUNIT_EXPECT_TRUE(test, battery_update(ctx, raw));
+	KUNIT_EXPECT_EQ(test, ctx->battery_capacity, 55);
+	KUNIT_EXPECT_TRUE(test, ctx->battery_charging);
+
+	// Unplugging restarts the filter at the new reading
+	priv->regs[REG_ID_BAT] = 60;
+	raw = read_battery_percent(ctx);
+	KUNIT_EXPECT_EQ(test, raw, 60);
+	KUNIT_EXPECT_EQ(test, priv->xfers, 2U);
+	KUNIT_EXPECT_TRUE(test, battery_update(ctx, raw));
+	KUNIT_EXPECT_EQ(test, ctx->battery_capacity, 60);
+	KUNIT_EXPECT_FALSE(test, ctx->battery_charging);
+
+	// Then moves a quarter of the way to each reading
+	priv->regs[REG_ID_BAT] = 80;
+	KUNIT_EXPECT_TRUE(test, battery_update(ctx, read_battery_percent(ctx)));
+	KUNIT_EXPECT_EQ(test, ctx->battery_capacity, 65);
+
+	// Bus errors are passed on
+	priv->xfer_error = -EIO;
+	KUNIT_EXPECT_EQ(test, read_battery_percent(ctx), -EIO);
+	KUNIT_EXPECT_EQ(test, ctx->battery_capacity, 65);
+}
+
+static void kbd_test_mouse_toggle(struct kunit *test)
+{
+	struct kbd_test_priv *priv = test->priv;
+	struct kbd_ctx *ctx = &priv->ctx;
+	bool inconsistent = false;
+
+	// Right shift switches mouse mode on and is not reported itself
+	kbd_test_fw_push(priv, KEY_STATE_PRESSED, KBD_TEST_SC_RIGHTSHIFT);
+	kbd_test_fw_push(priv, KEY_STATE_HOLD, KBD_TEST_SC_RIGHTSHIFT);
+	kbd_test_fw_push(priv, KEY_STATE_RELEASED, KBD_TEST_SC_RIGHTSHIFT);
+	KUNIT_EXPECT_EQ(test, input_drain_pass(ctx, &inconsistent), 3);
+	KBD_TEST_EXPECT_NONE(test);
+	KUNIT_EXPECT_EQ(test, ctx->mouse_mode, 1);
+
+	// The brackets are buttons now, ';' holds precision
+	kbd_test_fw_push(priv, KEY_STATE_PRESSED, ']');
+	kbd_test_fw_push(priv, KEY_STATE_PRESSED, ';');
+	input_drain_pass(ctx, &inconsistent);
+	KBD_TEST_EXPECT(test, KBD_TEST_KEY(BTN_LEFT, 1), KBD_TEST_SYN);
+	KUNIT_EXPECT_TRUE(test, ctx->mouse_precision);
+
+	// Switching off drops the pointer state, with ';' still down
+	kbd_test_fw_push(priv, KEY_STATE_RELEASED, ']');
+	kbd_test_fw_push(priv, KEY_STATE_PRESSED, KBD_TEST_SC_RIGHTSHIFT);
+	kbd_test_fw_push(priv, KEY_STATE_RELEASED, KBD_TEST_SC_RIGHTSHIFT);
+	input_drain_pass(ctx, &inconsistent);
+	KBD_TEST_EXPECT(test, KBD_TEST_KEY(BTN_LEFT, 0), KBD_TEST_SYN);
+	KUNIT_EXPECT_EQ(test, ctx->mouse_mode, 0);
+	KUNIT_EXPECT_FALSE(test, ctx->mouse_precision);
+
+	// Keys again. The ';' release was never pressed as a key, so the
+	// input core drops it
+	kbd_test_fw_push(priv, KEY_STATE_RELEASED, ';');
+	kbd_test_fw_push(priv, KEY_STATE_PRESSED, ']');
+	input_drain_pass(ctx, &inconsistent);
+	KBD_TEST_EXPECT(test, KBD_TEST_KEY(KEY_RIGHTBRACE, 1), KBD_TEST_SYN);
+	KUNIT_EXPECT_FALSE(test, inconsistent);
+}
+
+// Hold a direction for a number of pointer ticks at the default rate,
+// returns the last speed
+static uint32_t kbd_test_motion(struct kbd_motion* m, uint8_t dir,
+	unsigned int accel, unsigned int speed_max, unsigned int pct,
+	unsigned int ticks, int* x, int* y)
+{
+	uint32_t speed = 0;
+	int dx, dy;
+
+	*x = 0;
+	*y = 0;
+	while (ticks--) {
+		speed = mouse_motion_advance(m, dir, accel, speed_max, pct,
+			NSEC_PER_SEC / MOUSE_RATE_HZ, &dx, &dy);
+		*x += dx;
+		*y += dy;
+	}
+
+	return speed;
+}
+
+static void kbd_test_mouse_accel(struct kunit *test)
+{
+	struct kbd_motion m = { .velocity = MOUSE_SPEED_MIN << MOUSE_FRAC_BITS };
+	uint32_t speed, last = MOUSE_SPEED_MIN;
+	unsigned int tick, top = 0;
+	int dx, dy, x = 0, y = 0;
+
+	// Speed climbs from the minimum by MOUSE_ACCEL per second and stays
+	// at the maximum once there
+	for (tick = 0; tick < MOUSE_RATE_HZ; tick++) {
+		speed = mouse_motion_advance(&m, MOUSE_MOVE_RIGHT, MOUSE_ACCEL,
+			MOUSE_SPEED_MAX, 100, NSEC_PER_SEC / MOUSE_RATE_HZ, &dx, &dy);
+		x += dx;
+		y += dy;
+		if (!top) {
+			KUNIT_EXPECT_GT_MSG(test, speed, last, "tick %u", tick);
+			if (speed == MOUSE_SPEED_MAX) {
+				top = tick;
+			}
+		} else {
+			KUNIT_EXPECT_EQ_MSG(test, speed, MOUSE_SPEED_MAX, "tick %u", tick);
+		}
+		last = speed;
+	}
+	KUNIT_EXPECT_EQ(test, top, (MOUSE_SPEED_MAX - MOUSE_SPEED_MIN) * MOUSE_RATE_HZ
+		/ MOUSE_ACCEL);
+
+	// 477 pixels under the curve, a tick moves at the speed it ends with.
+	// Sub-pixel remainders carry over, less than one is left
+	KUNIT_EXPECT_EQ(test, x, 481);
+	KUNIT_EXPECT_EQ(test, y, 0);
+	KUNIT_EXPECT_LT(test, m.frac_x, 1 << MOUSE_FRAC_BITS);
+}
+
+static void kbd_test_mouse_accel_scaled(struct kunit *test)
+{
+	struct kbd_motion m = { .velocity = MOUSE_SPEED_MIN << MOUSE_FRAC_BITS };
+	uint32_t speed;
+	int x, y;
+
+	// Precision scales the speed, a quarter of the distance in a second
+	speed = kbd_test_motion(&m, MOUSE_MOVE_RIGHT, MOUSE_ACCEL, MOUSE_SPEED_MAX,
+		MOUSE_PRECISION_PCT, MOUSE_RATE_HZ, &x, &y);
+	KUNIT_EXPECT_EQ(test, speed, MOUSE_SPEED_MAX * MOUSE_PRECISION_PCT / 100);
+	KUNIT_EXPECT_EQ(test, x, 120);
+
+	// Diagonals take the full step on both axes
+	m = (struct kbd_motion){ .velocity = MOUSE_SPEED_MIN << MOUSE_FRAC_BITS };
+	kbd_test_motion(&m, MOUSE_MOVE_LEFT | MOUSE_MOVE_UP, MOUSE_ACCEL,
+		MOUSE_SPEED_MAX, 100, MOUSE_RATE_HZ, &x, &y);
+	KUNIT_EXPECT_EQ(test, x, -481);
+	KUNIT_EXPECT_EQ(test, y, -481);
+
+	// Opposite directions cancel out but still accelerate
+	m = (struct kbd_motion){ .velocity = MOUSE_SPEED_MIN << MOUSE_FRAC_BITS };
+	kbd_test_motion(&m, MOUSE_MOVE_LEFT | MOUSE_MOVE_RIGHT, MOUSE_ACCEL,
+		MOUSE_SPEED_MAX, 100, MOUSE_RATE_HZ, &x, &y);
+	KUNIT_EXPECT_EQ(test, x, 0);
+	KUNIT_EXPECT_EQ(test, m.velocity, MOUSE_SPEED_MAX << MOUSE_FRAC_BITS);
+
+	// Without acceleration the minimum speed, 1.33 pixels a tick, loses
+	// less than a pixel to rounding over a second
+	m = (struct kbd_motion){ .velocity = MOUSE_SPEED_MIN << MOUSE_FRAC_BITS };
+	kbd_test_motion(&m, MOUSE_MOVE_RIGHT, 0, MOUSE_SPEED_MAX, 100,
+		MOUSE_RATE_HZ, &x, &y);
+	KUNIT_EXPECT_GE(test, x, MOUSE_SPEED_MIN - 1);
+	KUNIT_EXPECT_LE(test, x, MOUSE_SPEED_MIN);
+}
+
+static void kbd_test_scroll_accel(struct kunit *test)
+{
+	struct kbd_motion m = { .velocity = SCROLL_SPEED_MIN << MOUSE_FRAC_BITS };
+	uint32_t speed;
+	int x, y;
+
+	// Same curve in hi-res wheel units, top speed after 0.85 seconds
+	speed = kbd_test_motion(&m, MOUSE_MOVE_DOWN, SCROLL_ACCEL, SCROLL_SPEED_MAX,
+		100, (SCROLL_SPEED_MAX - SCROLL_SPEED_MIN) * MOUSE_RATE_HZ / SCROLL_ACCEL,
+		&x, &y);
+	KUNIT_EXPECT_LT(test, speed, SCROLL_SPEED_MAX);
+	speed = kbd_test_motion(&m, MOUSE_MOVE_DOWN, SCROLL_ACCEL, SCROLL_SPEED_MAX,
+		100, 1, &x, &y);
+	KUNIT_EXPECT_EQ(test, speed, SCROLL_SPEED_MAX);
+
+	// A second held scrolls 12 detents
+	m = (struct kbd_motion){ .velocity = SCROLL_SPEED_MIN << MOUSE_FRAC_BITS };
+	kbd_test_motion(&m, MOUSE_MOVE_DOWN, SCROLL_ACCEL, SCROLL_SPEED_MAX, 100,
+		MOUSE_RATE_HZ, &x, &y);
+	KUNIT_EXPECT_EQ(test, x, 0);
+	KUNIT_EXPECT_EQ(test, y, 1549);
+	KUNIT_EXPECT_EQ(test, y / SCROLL_DETENT, 12);
+}
+
+static struct kunit_case kbd_test_cases[] = {
+	KUNIT_CASE(kbd_test_fifo_decode),
+	KUNIT_CASE(kbd_test_fifo_decode_padding),
+	KUNIT_CASE(kbd_test_fifo_decode_clamp),
+	KUNIT_CASE(kbd_test_frame_merge),
+	KUNIT_CASE(kbd_test_frame_split),
+	KUNIT_CASE(kbd_test_lost_release),
+	KUNIT_CASE(kbd_test_overflow_recover),
+	KUNIT_CASE(kbd_test_dual_role_tap),
+	KUNIT_CASE(kbd_test_dual_role_hold),
+	KUNIT_CASE(kbd_test_dual_role_chord),
+	KUNIT_CASE(kbd_test_dual_role_late_release),
+	KUNIT_CASE(kbd_test_sticky_latch),
+	KUNIT_CASE(kbd_test_sticky_unlatch),
+	KUNIT_CASE(kbd_test_xfer_cached),
+	KUNIT_CASE(kbd_test_drain_bus_time),
+	KUNIT_CASE(kbd_test_mouse_precision),
+	KUNIT_CASE(kbd_test_mouse_scroll_mod),
+	KUNIT_CASE(kbd_test_fw_probe),
+	KUNIT_CASE(kbd_test_fifo_legacy),
+	KUNIT_CASE(kbd_test_fifo_batched),
+	KUNIT_CASE(kbd_test_fifo_burst),
+	KUNIT_CASE(kbd_test_drain_budget),
+	KUNIT_CASE(kbd_test_drain_budget_time),
+	KUNIT_CASE(kbd_test_battery_read),
+	KUNIT_CASE(kbd_test_mouse_toggle),
+	KUNIT_CASE(kbd_test_mouse_accel),
+	KUNIT_CASE(kbd_test_mouse_accel_scaled),
+	KUNIT_CASE(kbd_test_scroll_accel),
+	{ },
+};
+
+static struct kunit_suite kbd_test_suite = {
+	.name = "picocalc_kbd",
+	.init = kbd_test_init,
+	.exit = kbd_test_exit,
+	.suite_init = kbd_test_suite_init,
+	.suite_exit = kbd_test_suite_exit,
+	.test_cases = kbd_test_cases,
+};
+
+kunit_test_suite(kbd_test_suite);
@@ -0,0 +1,236 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Keyboard Driver for picocalc
+ * picocalc_kbd_trace.h: Tracepoints for the FIFO drain and event report path.
+ * Use trace-cmd record -e picocalc_kbd or bpftrace -l 'tracepoint:picocalc_kbd:*'.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM picocalc_kbd
+
+#ifndef PICOCALC_KBD_TRACE_TYPES_H_
+#define PICOCALC_KBD_TRACE_TYPES_H_
+
+// What the report path did with a FIFO item
+enum kbd_key_action
+{
+	KBD_KEY_IGNORED = 0,
+	KBD_KEY_MOUSE_TOGGLE,
+	KBD_KEY_MOUSE,
+	KBD_KEY_UNMAPPED,
+	KBD_KEY_HOLD,
+	KBD_KEY_REPORTED,
+	KBD_KEY_DUAL_ROLE,
+};
+
+#endif
+
+#if !defined(PICOCALC_KBD_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define PICOCALC_KBD_TRACE_H_
+
+#include <linux/i2c.h>
+#include <linux/tracepoint.h>
+
+TRACE_DEFINE_ENUM(KBD_KEY_IGNORED);
+TRACE_DEFINE_ENUM(KBD_KEY_MOUSE_TOGGLE);
+TRACE_DEFINE_ENUM(KBD_KEY_MOUSE);
+TRACE_DEFINE_ENUM(KBD_KEY_UNMAPPED);
+TRACE_DEFINE_ENUM(KBD_KEY_HOLD);
+TRACE_DEFINE_ENUM(KBD_KEY_REPORTED);
+TRACE_DEFINE_ENUM(KBD_KEY_DUAL_ROLE);
+
+#define show_kbd_key_action(action)						\
+	__print_symbolic(action,						\
+		{ KBD_KEY_IGNORED,	"ignored" },				\
+		{ KBD_KEY_MOUSE_TOGGLE,	"mouse_toggle" },			\
+		{ KBD_KEY_MOUSE,	"mouse" },				\
+		{ KBD_KEY_UNMAPPED,	"unmapped" },				\
+		{ KBD_KEY_HOLD,		"hold" },				\
+		{ KBD_KEY_REPORTED,	"reported" },				\
+		{ KBD_KEY_DUAL_ROLE,	"dual_role" })
+
+// One FIFO drain, count of items read and time spent on the bus
+TRACE_EVENT(picocalc_fifo_read,
+
+	TP_PROTO(struct i2c_client const *client, uint8_t count, bool batched,
+		uint64_t duration_ns),
+
+	TP_ARGS(client, count, batched, duration_ns),
+
+	TP_STRUCT__entry(
+		__field(int, bus)
+		__field(u16, addr)
+		__field(u8, count)
+		__field(bool, batched)
+		__field(u64, duration_ns)
+	),
+
+	TP_fast_assign(
+		__entry->bus = client->adapter->nr;
+		__entry->addr = client->addr;
+		__entry->count = count;
+		__entry->batched = batched;
+		__entry->duration_ns = duration_ns;
+	),
+
+	TP_printk("i2c-%d-%02x count=%u mode=%s duration_ns=%llu",
+		__entry->bus, __entry->addr, __entry->count,
+		__entry->batched ? "batched" : "legacy", __entry->duration_ns)
+);
+
+// One raw FIFO item as read from firmware
+TRACE_EVENT(picocalc_fifo_item,
+
+	TP_PROTO(struct i2c_client const *client, uint8_t idx, uint8_t state,
+		uint8_t scancode),
+
+	TP_ARGS(client, idx, state, scancode),
+
+	TP_STRUCT__entry(
+		__field(int, bus)
+		__field(u16, addr)
+		__field(u8, idx)
+		__field(u8, state)
+		__field(u8, scancode)
+	),
+
+	TP_fast_assign(
+		__entry->bus = client->adapter->nr;
+		__entry->addr = client->addr;
+		__entry->idx = idx;
+		__entry->state = state;
+		__entry->scancode = scancode;
+	),
+
+	TP_printk("i2c-%d-%02x idx=%u state=%u scancode=0x%02x",
+		__entry->bus, __entry->addr, __entry->idx, __entry->state,
+		__entry->scancode)
+);
+
+// Key report decision for one FIFO item
+TRACE_EVENT(picocalc_key_report,
+
+	TP_PROTO(struct i2c_client const *client, uint8_t scancode, uint8_t state,
+		uint16_t keycode, bool mouse_mode, int action),
+
+	TP_ARGS(client, scancode, state, keycode, mouse_mode, action),
+
+	TP_STRUCT__entry(
+		__field(int, bus)
+		__field(u16, addr)
+		__field(u8, scancode)
+		__field(u8, state)
+		__field(u16, keycode)
+		__field(bool, mouse_mode)
+		__field(int, action)
+	),
+
+	TP_fast_assign(
+		__entry->bus = client->adapter->nr;
+		__entry->addr = client->addr;
+		__entry->scancode = scancode;
+		__entry->state = state;
+		__entry->keycode = keycode;
+		__entry->mouse_mode = mouse_mode;
+		__entry->action = action;
+	),
+
+	TP_printk("i2c-%d-%02x scancode=0x%02x state=%u keycode=%u mouse_mode=%d action=%s",
+		__entry->bus, __entry->addr, __entry->scancode, __entry->state,
+		__entry->keycode, __entry->mouse_mode,
+		show_kbd_key_action(__entry->action))
+);
+
+// Relative pointer movement reported in mouse mode, speed in pixels per second
+TRACE_EVENT(picocalc_mouse_move,
+
+	TP_PROTO(struct i2c_client const *client, int dx, int dy, int speed),
+
+	TP_ARGS(client, dx, dy, speed),
+
+	TP_STRUCT__entry(
+		__field(int, bus)
+		__field(u16, addr)
+		__field(int, dx)
+		__field(int, dy)
+		__field(int, speed)
+	),
+
+	TP_fast_assign(
+		__entry->bus = client->adapter->nr;
+		__entry->addr = client->addr;
+		__entry->dx = dx;
+		__entry->dy = dy;
+		__entry->speed = speed;
+	),
+
+	TP_printk("i2c-%d-%02x dx=%d dy=%d speed=%d",
+		__entry->bus, __entry->addr, __entry->dx, __entry->dy, __entry->speed)
+);
+
+// Wheel movement reported in mouse mode, hi-res units and units per second
+TRACE_EVENT(picocalc_mouse_scroll,
+
+	TP_PROTO(struct i2c_client const *client, int hwheel, int wheel, int speed),
+
+	TP_ARGS(client, hwheel, wheel, speed),
+
+	TP_STRUCT__entry(
+		__field(int, bus)
+		__field(u16, addr)
+		__field(int, hwheel)
+		__field(int, wheel)
+		__field(int, speed)
+	),
+
+	TP_fast_assign(
+		__entry->bus = client->adapter->nr;
+		__entry->addr = client->addr;
+		__entry->hwheel = hwheel;
+		__entry->wheel = wheel;
+		__entry->speed = speed;
+	),
+
+	TP_printk("i2c-%d-%02x hwheel=%d wheel=%d speed=%d",
+		__entry->bus, __entry->addr, __entry->hwheel, __entry->wheel,
+		__entry->speed)
+);
+
+// FIFO overflow or key state mismatch, and how many stuck keys were released
+TRACE_EVENT(picocalc_fifo_overflow,
+
+	TP_PROTO(struct i2c_client const *client, bool full, bool flagged,
+		bool inconsistent, unsigned int released),
+
+	TP_ARGS(client, full, flagged, inconsistent, released),
+
+	TP_STRUCT__entry(
+		__field(int, bus)
+		__field(u16, addr)
+		__field(bool, full)
+		__field(bool, flagged)
+		__field(bool, inconsistent)
+		__field(unsigned int, released)
+	),
+
+	TP_fast_assign(
+		__entry->bus = client->adapter->nr;
+		__entry->addr = client->addr;
+		__entry->full = full;
+		__entry->flagged = flagged;
+		__entry->inconsistent = inconsistent;
+		__entry->released = released;
+	),
+
+	TP_printk("i2c-%d-%02x full=%d flagged=%d inconsistent=%d released=%u",
+		__entry->bus, __entry->addr, __entry->full, __entry->flagged,
+		__entry->inconsistent, __entry->released)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE picocalc_kbd_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,607 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * PicoCalc keyboard firmware simulator
+ *
+ * Registers virtual I2C adapters, each hosting a simulated PicoCalc keyboard
+ * at 0x1f, so picocalc_kbd.ko can be developed and load-tested on any Linux box.
+ *
+ *   insmod picocalc_kbd_sim.ko instances=2 latency_us=200
+ *   insmod picocalc_kbd.ko
+ *
+ * Key scripts are fed through /sys/kernel/debug/picocalc_kbd_sim/<n>/keys,
+ * one command per line:
+ *   p <scancode>               press
+ *   r <scancode>               release
+ *   h <scancode> <state>       raw firmware state, e.g. 2 (HOLD), 4 (LONG_HOLD)
+ *   t <char>                   tap a character (press and release)
+ *   s <text>                   tap each character of the text
+ *   b <count> [char]           burst of <count> taps pushed at once
+ *   x <count> <interval_us> [char]
+ *                              stream of <count> taps, one every <interval_us>
+ * Bursts and streams cycle through a-z, or repeat <char> to check that fast
+ * repeats of one key are not merged. Scancodes are decimal or 0x-prefixed hex.
+ *
+ * Stress check: stream at the driver's max_keys_per_sec and compare the key
+ * count seen by evtest with the stream length, "dropped" in stats stays 0.
+ * stress.sh next to this file does that and fails if a key went missing.
+ *
+ * A read of the FIFO register pops one entry per two bytes and returns empty
+ * entries once the FIFO runs dry. picocalc_kbd only relies on that with
+ * fifo_mode=2 or batched-fifo, real firmware is not known to do the same.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/i2c.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/delay.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/hrtimer.h>
+#include <linux/version.h>
+
+#define SIM_ADDR		0x1f
+#define SIM_FIFO_SIZE		31
+#define SIM_MAX_INSTANCES	8
+#define SIM_LINE_MAX		256
+
+// Registers, as in the keyboard firmware
+#define REG_ID_VER (0x01)
+#define REG_ID_CFG (0x02)
+#define REG_ID_INT (0x03)
+#define REG_ID_KEY (0x04)
+#define REG_ID_BKL (0x05)
+#define REG_ID_FIF (0x09)
+#define REG_ID_BK2 (0x0A)
+#define REG_ID_BAT (0x0b)
+#define REG_ID_LAST REG_ID_BAT
+
+#define PICOCALC_WRITE_MASK (1<<7)
+
+#define CFG_OVERFLOW_ON  (1 << 0)
+#define CFG_OVERFLOW_INT (1 << 1)
+#define CFG_KEY_INT      (1 << 4)
+
+#define INT_OVERFLOW     (1 << 0)
+#define INT_KEY          (1 << 3)
+
+#define KEY_STATE_PRESSED  1
+#define KEY_STATE_RELEASED 3
+
+static unsigned int instances = 1;
+module_param(instances, uint, 0444);
+MODULE_PARM_DESC(instances, "Number of simulated keyboards, each on its own bus");
+
+static unsigned int fw_version = 0x11;
+module_param(fw_version, uint, 0444);
+MODULE_PARM_DESC(fw_version, "Firmware version reported in REG_ID_VER");
+
+static unsigned int latency_us = 0;
+module_param(latency_us, uint, 0444);
+MODULE_PARM_DESC(latency_us, "Initial added latency per I2C transfer in microseconds");
+
+static unsigned int error_every = 0;
+module_param(error_every, uint, 0444);
+MODULE_PARM_DESC(error_every, "Initial fault injection, fail every Nth transfer (0 = off)");
+
+struct sim_fifo_item
+{
+	uint8_t state;
+	uint8_t scancode;
+};
+
+struct sim_kbd
+{
+	struct i2c_adapter adap;
+	struct i2c_client *client;
+	struct dentry *dir;
+	int id;
+
+	// Register file and key FIFO, shared with the stream timer
+	spinlock_t lock;
+	uint8_t regs[REG_ID_LAST + 1];
+	uint8_t reg_ptr;
+	struct sim_fifo_item fifo[SIM_FIFO_SIZE];
+	unsigned int fifo_head;
+	unsigned int fifo_count;
+
+	// Tap stream generator
+	struct hrtimer stream_timer;
+	unsigned int stream_left;
+	unsigned int stream_interval_us;
+	unsigned int stream_pos;
+	uint8_t stream_key;
+
+	// Transfer latency and fault injection, tunable in debugfs
+	u32 latency_us;
+	u32 error_every;
+
+	// Counters
+	uint64_t xfers;
+	uint64_t errors;
+	uint64_t pushed;
+	uint64_t popped;
+	uint64_t dropped;
+	unsigned int fifo_max;
+};
+
+static struct sim_kbd *sim_kbds[SIM_MAX_INSTANCES];
+static struct dentry *sim_debugfs_root;
+
+// Push one event into the FIFO, lock held
+static void sim_fifo_push_locked(struct sim_kbd *sim, uint8_t state, uint8_t scancode)
+{
+	unsigned int tail;
+
+	if (sim->fifo_count == SIM_FIFO_SIZE) {
+		sim->dropped++;
+		if (sim->regs[REG_ID_CFG] & CFG_OVERFLOW_INT) {
+			sim->regs[REG_ID_INT] |= INT_OVERFLOW;
+		}
+
+		// Firmware either drops new events or overwrites the oldest
+		if (!(sim->regs[REG_ID_CFG] & CFG_OVERFLOW_ON)) {
+			return;
+		}
+		sim->fifo_head = (sim->fifo_head + 1) % SIM_FIFO_SIZE;
+		sim->fifo_count--;
+	}
+
+	tail = (sim->fifo_head + sim->fifo_count) % SIM_FIFO_SIZE;
+	sim->fifo[tail].state = state;
+	sim->fifo[tail].scancode = scancode;
+	sim->fifo_count++;
+	sim->pushed++;
+	sim->fifo_max = max(sim->fifo_max, sim->fifo_count);
+
+	if (sim->regs[REG_ID_CFG] & CFG_KEY_INT) {
+		sim->regs[REG_ID_INT] |= INT_KEY;
+	}
+}
+
+static void sim_fifo_push(struct sim_kbd *sim, uint8_t state, uint8_t scancode)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	sim_fifo_push_locked(sim, state, scancode);
+	spin_unlock_irqrestore(&sim->lock, flags);
+}
+
+static void sim_tap(struct sim_kbd *sim, uint8_t scancode)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	sim_fifo_push_locked(sim, KEY_STATE_PRESSED, scancode);
+	sim_fifo_push_locked(sim, KEY_STATE_RELEASED, scancode);
+	spin_unlock_irqrestore(&sim->lock, flags);
+}
+
+// Pop one event, an empty FIFO reads as zeroes
+static void sim_fifo_pop_locked(struct sim_kbd *sim, uint8_t *dst)
+{
+	if (sim->fifo_count == 0) {
+		dst[0] = 0;
+		dst[1] = 0;
+		return;
+	}
+
+	dst[0] = sim->fifo[sim->fifo_head].state;
+	dst[1] = sim->fifo[sim->fifo_head].scancode;
+	sim->fifo_head = (sim->fifo_head + 1) % SIM_FIFO_SIZE;
+	sim->fifo_count--;
+	sim->popped++;
+}
+
+// Fill a read from the selected register, lock held
+static void sim_read_locked(struct sim_kbd *sim, uint8_t *buf, uint16_t len)
+{
+	uint16_t i;
+
+	// FIFO pops one item per two bytes, so a long read drains several
+	if (sim->reg_ptr == REG_ID_FIF) {
+		for (i = 0; i + 1 < len; i += 2) {
+			sim_fifo_pop_locked(sim, &buf[i]);
+		}
+		if (i < len) {
+			buf[i] = 0;
+		}
+		return;
+	}
+
+	if (sim->reg_ptr == REG_ID_KEY) {
+		sim->regs[REG_ID_KEY] = sim->fifo_count & 0x1f;
+	}
+
+	// Other registers reply with the register ID followed by the value
+	memset(buf, 0, len);
+	buf[0] = sim->reg_ptr;
+	if (len > 1) {
+		buf[1] = (sim->reg_ptr <= REG_ID_LAST) ? sim->regs[sim->reg_ptr] : 0;
+	}
+}
+
+// Register write, writable registers carry the write bit
+static void sim_write_locked(struct sim_kbd *sim, uint8_t const *buf, uint16_t len)
+{
+	uint8_t reg = buf[0] & ~PICOCALC_WRITE_MASK;
+
+	sim->reg_ptr = reg;
+	if (!(buf[0] & PICOCALC_WRITE_MASK) || (len < 2) || (reg > REG_ID_LAST)) {
+		return;
+	}
+
+	switch (reg) {
+	case REG_ID_INT:
+		// Writing clears interrupt flags
+		sim->regs[REG_ID_INT] = 0;
+		break;
+	case REG_ID_CFG:
+	case REG_ID_BKL:
+	case REG_ID_BK2:
+		sim->regs[reg] = buf[1];
+		break;
+	default:
+		break;
+	}
+}
+
+static int sim_master_xfer(struct i2c_adapter *adap, struct i2c_msg *msgs, int num)
+{
+	struct sim_kbd *sim = i2c_get_adapdata(adap);
+	unsigned long flags;
+	u32 delay_us, every;
+	int i;
+
+	// Simulated bus time
+	delay_us = READ_ONCE(sim->latency_us);
+	if (delay_us) {
+		usleep_range(delay_us, delay_us + delay_us / 4 + 1);
+	}
+
+	spin_lock_irqsave(&sim->lock, flags);
+	sim->xfers++;
+
+	// Injected bus fault
+	every = READ_ONCE(sim->error_every);
+	if (every && (sim->xfers % every) == 0) {
+		sim->errors++;
+		spin_unlock_irqrestore(&sim->lock, flags);
+		return -EIO;
+	}
+
+	for (i = 0; i < num; i++) {
+		if (msgs[i].addr != SIM_ADDR) {
+			spin_unlock_irqrestore(&sim->lock, flags);
+			return -ENXIO;
+		}
+		if (msgs[i].len == 0) {
+			continue;
+		}
+		if (msgs[i].flags & I2C_M_RD) {
+			sim_read_locked(sim, msgs[i].buf, msgs[i].len);
+		} else {
+			sim_write_locked(sim, msgs[i].buf, msgs[i].len);
+		}
+	}
+
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	return num;
+}
+
+static u32 sim_functionality(struct i2c_adapter *adap)
+{
+	return I2C_FUNC_I2C | I2C_FUNC_SMBUS_EMUL;
+}
+
+static struct i2c_algorithm const sim_algo = {
+	.master_xfer = sim_master_xfer,
+	.functionality = sim_functionality,
+};
+
+// Key for the n-th tap of a burst or stream, 0 cycles through a-z
+static uint8_t sim_burst_key(uint8_t key, unsigned int n)
+{
+	return key ? key : 'a' + n % 26;
+}
+
+// Stream generator, one tap per expiry
+static enum hrtimer_restart sim_stream_function(struct hrtimer *timer)
+{
+	struct sim_kbd *sim = container_of(timer, struct sim_kbd, stream_timer);
+	unsigned long flags;
+	uint8_t key;
+	bool more;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	if (sim->stream_left) {
+		key = sim_burst_key(sim->stream_key, sim->stream_pos);
+		sim_fifo_push_locked(sim, KEY_STATE_PRESSED, key);
+		sim_fifo_push_locked(sim, KEY_STATE_RELEASED, key);
+		sim->stream_pos++;
+		sim->stream_left--;
+	}
+	more = (sim->stream_left > 0);
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	if (!more) {
+		return HRTIMER_NORESTART;
+	}
+	hrtimer_forward_now(timer, us_to_ktime(sim->stream_interval_us));
+	return HRTIMER_RESTART;
+}
+
+static int sim_parse_scancode(char const *arg, uint8_t *scancode)
+{
+	return kstrtou8(arg, 0, scancode);
+}
+
+// Run one line of the key script
+static int sim_run_command(struct sim_kbd *sim, char *line)
+{
+	char *cmd, *arg;
+	uint8_t scancode, state;
+	unsigned int count, interval, i;
+	char key;
+
+	cmd = strsep(&line, " \t");
+	arg = line ? skip_spaces(line) : NULL;
+	if (!cmd || !*cmd) {
+		return 0;
+	}
+	if (!arg && (strcmp(cmd, "s") != 0)) {
+		return -EINVAL;
+	}
+
+	if (!strcmp(cmd, "p") || !strcmp(cmd, "r")) {
+		if (sim_parse_scancode(arg, &scancode)) {
+			return -EINVAL;
+		}
+		sim_fifo_push(sim, (cmd[0] == 'p') ? KEY_STATE_PRESSED : KEY_STATE_RELEASED,
+			scancode);
+
+	} else if (!strcmp(cmd, "h")) {
+		if (sscanf(arg, "%hhi %hhu", &scancode, &state) != 2) {
+			return -EINVAL;
+		}
+		sim_fifo_push(sim, state, scancode);
+
+	} else if (!strcmp(cmd, "t")) {
+		if (!arg[0]) {
+			return -EINVAL;
+		}
+		sim_tap(sim, arg[0]);
+
+	} else if (!strcmp(cmd, "s")) {
+		for (i = 0; arg && arg[i]; i++) {
+			sim_tap(sim, arg[i]);
+		}
+
+	} else if (!strcmp(cmd, "b")) {
+		key = 0;
+		if (sscanf(arg, "%u %c", &count, &key) < 1) {
+			return -EINVAL;
+		}
+		for (i = 0; i < count; i++) {
+			sim_tap(sim, sim_burst_key(key, i));
+		}
+
+	} else if (!strcmp(cmd, "x")) {
+		key = 0;
+		if ((sscanf(arg, "%u %u %c", &count, &interval, &key) < 2) || (interval == 0)) {
+			return -EINVAL;
+		}
+		hrtimer_cancel(&sim->stream_timer);
+		sim->stream_left = count;
+		sim->stream_interval_us = interval;
+		sim->stream_pos = 0;
+		sim->stream_key = key;
+		if (count) {
+			hrtimer_start(&sim->stream_timer, us_to_ktime(interval),
+				HRTIMER_MODE_REL);
+		}
+
+	} else {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static ssize_t keys_write(struct file *file, char const __user *ubuf,
+	size_t count, loff_t *ppos)
+{
+	struct sim_kbd *sim = file->private_data;
+	char *buf, *cursor, *line;
+	int rc = 0;
+
+	if (count >= PAGE_SIZE) {
+		return -E2BIG;
+	}
+
+	buf = memdup_user_nul(ubuf, count);
+	if (IS_ERR(buf)) {
+		return PTR_ERR(buf);
+	}
+
+	cursor = buf;
+	while ((line = strsep(&cursor, "\n")) != NULL) {
+		if ((rc = sim_run_command(sim, strim(line)))) {
+			break;
+		}
+	}
+
+	kfree(buf);
+	return rc ? rc : count;
+}
+
+static struct file_operations const keys_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = keys_write,
+	.llseek = noop_llseek,
+};
+
+// Battery register value, bit 7 set while charging
+static int battery_get(void *data, u64 *val)
+{
+	struct sim_kbd *sim = data;
+
+	*val = READ_ONCE(sim->regs[REG_ID_BAT]);
+	return 0;
+}
+
+static int battery_set(void *data, u64 val)
+{
+	struct sim_kbd *sim = data;
+
+	if (val > 0xff) {
+		return -EINVAL;
+	}
+	WRITE_ONCE(sim->regs[REG_ID_BAT], val);
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(battery_fops, battery_get, battery_set, "%llu\n");
+
+static int stats_show(struct seq_file *s, void *unused)
+{
+	struct sim_kbd *sim = s->private;
+	unsigned long flags;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	seq_printf(s, "xfers %llu\nerrors %llu\npushed %llu\npopped %llu\n"
+		"dropped %llu\nfifo %u\nfifo_max %u\nstream_left %u\n"
+		"backlight %u\nkeyboard_backlight %u\n",
+		sim->xfers, sim->errors, sim->pushed, sim->popped, sim->dropped,
+		sim->fifo_count, sim->fifo_max, sim->stream_left,
+		sim->regs[REG_ID_BKL], sim->regs[REG_ID_BK2]);
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(stats);
+
+static void sim_destroy(struct sim_kbd *sim)
+{
+	debugfs_remove_recursive(sim->dir);
+	hrtimer_cancel(&sim->stream_timer);
+	if (sim->client) {
+		i2c_unregister_device(sim->client);
+	}
+	i2c_del_adapter(&sim->adap);
+	kfree(sim);
+}
+
+static struct sim_kbd *sim_create(int id)
+{
+	struct sim_kbd *sim;
+	struct i2c_board_info info = {
+		I2C_BOARD_INFO("picocalc_kbd", SIM_ADDR),
+	};
+	char name[16];
+	int rc;
+
+	sim = kzalloc(sizeof(*sim), GFP_KERNEL);
+	if (!sim) {
+		return ERR_PTR(-ENOMEM);
+	}
+
+	sim->id = id;
+	spin_lock_init(&sim->lock);
+	sim->regs[REG_ID_VER] = fw_version;
+	sim->regs[REG_ID_BAT] = 80;
+	sim->latency_us = latency_us;
+	sim->error_every = error_every;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
+	hrtimer_init(&sim->stream_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	sim->stream_timer.function = sim_stream_function;
+#else
+	hrtimer_setup(&sim->stream_timer, sim_stream_function, CLOCK_MONOTONIC,
+		HRTIMER_MODE_REL);
+#endif
+
+	sim->adap.owner = THIS_MODULE;
+	sim->adap.algo = &sim_algo;
+	snprintf(sim->adap.name, sizeof(sim->adap.name), "picocalc_kbd_sim.%d", id);
+	i2c_set_adapdata(&sim->adap, sim);
+	if ((rc = i2c_add_adapter(&sim->adap))) {
+		kfree(sim);
+		return ERR_PTR(rc);
+	}
+
+	snprintf(name, sizeof(name), "%d", id);
+	sim->dir = debugfs_create_dir(name, sim_debugfs_root);
+	debugfs_create_file("keys", 0200, sim->dir, sim, &keys_fops);
+	debugfs_create_file_unsafe("battery", 0644, sim->dir, sim, &battery_fops);
+	debugfs_create_u32("latency_us", 0644, sim->dir, &sim->latency_us);
+	debugfs_create_u32("error_every", 0644, sim->dir, &sim->error_every);
+	debugfs_create_file("stats", 0444, sim->dir, sim, &stats_fops);
+
+	// Instantiate the keyboard so picocalc_kbd binds to it
+	sim->client = i2c_new_client_device(&sim->adap, &info);
+	if (IS_ERR(sim->client)) {
+		rc = PTR_ERR(sim->client);
+		sim->client = NULL;
+		sim_destroy(sim);
+		return ERR_PTR(rc);
+	}
+
+	pr_info("%s Simulated keyboard %d on i2c-%d\n", __func__, id, sim->adap.nr);
+
+	return sim;
+}
+
+static void picocalc_kbd_sim_cleanup(void)
+{
+	int i;
+
+	for (i = 0; i < SIM_MAX_INSTANCES; i++) {
+		if (sim_kbds[i]) {
+			sim_destroy(sim_kbds[i]);
+			sim_kbds[i] = NULL;
+		}
+	}
+	debugfs_remove_recursive(sim_debugfs_root);
+}
+
+// Module constructor
+static int __init picocalc_kbd_sim_init(void)
+{
+	int i;
+
+	if ((instances == 0) || (instances > SIM_MAX_INSTANCES)) {
+		pr_err("%s instances must be 1 to %d\n", __func__, SIM_MAX_INSTANCES);
+		return -EINVAL;
+	}
+
+	sim_debugfs_root = debugfs_create_dir("picocalc_kbd_sim", NULL);
+
+	for (i = 0; i < instances; i++) {
+		sim_kbds[i] = sim_create(i);
+		if (IS_ERR(sim_kbds[i])) {
+			int rc = PTR_ERR(sim_kbds[i]);
+
+			sim_kbds[i] = NULL;
+			picocalc_kbd_sim_cleanup();
+			return rc;
+		}
+	}
+
+	return 0;
+}
+module_init(picocalc_kbd_sim_init);
+
+// Module destructor
+static void __exit picocalc_kbd_sim_exit(void)
+{
+	picocalc_kbd_sim_cleanup();
+}
+module_exit(picocalc_kbd_sim_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("PicoCalc keyboard firmware simulator on a virtual I2C bus");
+MODULE_VERSION("0.01");
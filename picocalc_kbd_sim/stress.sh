@@ -0,0 +1,111 @@
+#!/bin/bash
+# Stress check for the key FIFO path, on a simulated keyboard.
+#
+# Loads picocalc_kbd_sim and picocalc_kbd, holds the input device open so the
+# driver polls, then streams taps of one key at the driver's max_keys_per_sec.
+# Fails unless the simulator dropped nothing and every press reached evdev.
+#
+#   make -C picocalc_kbd_sim && make -C picocalc_kbd
+#   sudo ./picocalc_kbd_sim/stress.sh [taps] [picocalc_kbd parameters...]
+#
+# LATENCY_US sets the simulated time per I2C transfer, 200 by default.
+set -e
+
+HERE=$(dirname "$(realpath "$0")")
+SIM_KO=${HERE}/picocalc_kbd_sim.ko
+KBD_KO=${HERE}/../picocalc_kbd/picocalc_kbd.ko
+TAPS=${1:-3000}
+[ $# -gt 0 ] && shift
+LATENCY_US=${LATENCY_US:-200}
+DEBUGFS=/sys/kernel/debug/picocalc_kbd_sim/0
+KEY_A=30
+
+if [ "$(id -u)" -ne 0 ]; then
+    echo "stress.sh: needs root to load modules" >&2
+    exit 2
+fi
+for ko in "$SIM_KO" "$KBD_KO"; do
+    if [ ! -f "$ko" ]; then
+        echo "stress.sh: $ko not built" >&2
+        exit 2
+    fi
+done
+if grep -q "^picocalc_kbd " /proc/modules; then
+    echo "stress.sh: picocalc_kbd is already loaded, remove it first" >&2
+    exit 2
+fi
+
+RAW=$(mktemp)
+READER=
+cleanup() {
+    [ -n "$READER" ] && kill "$READER" 2>/dev/null && wait "$READER" 2>/dev/null
+    rmmod picocalc_kbd 2>/dev/null || true
+    rmmod picocalc_kbd_sim 2>/dev/null || true
+    rm -f "$RAW"
+}
+trap cleanup EXIT
+
+insmod "$SIM_KO" instances=1 latency_us="$LATENCY_US"
+insmod "$KBD_KO" "$@"
+
+# The simulated keyboard sits at 0x1f on the adapter the simulator added
+CLIENT=
+for adapter in /sys/bus/i2c/devices/i2c-*; do
+    if [ "$(cat "$adapter/name")" = "picocalc_kbd_sim.0" ]; then
+        CLIENT=/sys/bus/i2c/devices/${adapter##*/i2c-}-001f
+    fi
+done
+for i in $(seq 50); do
+    [ -n "$CLIENT" ] && ls "$CLIENT"/input/input*/ 2>/dev/null | grep -q '^event' && break
+    sleep 0.1
+done
+EVDEV=/dev/input/$(ls "$CLIENT"/input/input*/ | grep '^event' | head -n1)
+BATTERY=$(ls "$CLIENT/power_supply")
+SYSFS=/sys/firmware/${BATTERY%-battery}
+if [ ! -c "$EVDEV" ] || [ ! -d "$SYSFS" ]; then
+    echo "stress.sh: simulated keyboard did not probe" >&2
+    exit 1
+fi
+
+# Reading the input device keeps the driver polling, and cat writes
+# everything it read before it is killed
+cat "$EVDEV" > "$RAW" &
+READER=$!
+sleep 0.5
+
+RATE=$(cat "$SYSFS/max_keys_per_sec")
+INTERVAL_US=$(( (1000000 + RATE - 1) / RATE ))
+echo "Streaming $TAPS taps every $INTERVAL_US us ($RATE keys/s) through $EVDEV"
+echo "x $TAPS $INTERVAL_US a" > "$DEBUGFS/keys"
+
+DEADLINE=$(( $(date +%s) + TAPS * INTERVAL_US / 1000000 + 10 ))
+while [ "$(awk '/^stream_left/ { print $2 }' "$DEBUGFS/stats")" -ne 0 ]; do
+    if [ "$(date +%s)" -gt "$DEADLINE" ]; then
+        echo "stress.sh: stream did not finish" >&2
+        exit 1
+    fi
+    sleep 0.2
+done
+
+# Let the last drain through
+sleep 1
+kill "$READER"
+wait "$READER" 2>/dev/null || true
+READER=
+
+# struct input_event is two longs of time, then type, code and value
+EVENT_SIZE=$(( $(getconf LONG_BIT) / 4 + 8 ))
+PRESSES=$(od -An -v -tu2 -w"$EVENT_SIZE" "$RAW" | awk -v t=$(( EVENT_SIZE / 2 - 4 )) \
+    -v key=$KEY_A '$(t + 1) == 1 && $(t + 2) == key && $(t + 3) == 1 { n++ }
+    END { print n + 0 }')
+DROPPED=$(awk '/^dropped/ { print $2 }' "$DEBUGFS/stats")
+
+echo "presses $PRESSES of $TAPS, dropped $DROPPED"
+echo "overflow_stats $(cat "$SYSFS/overflow_stats")"
+echo "frames_split $(cat "$SYSFS/frames_split")"
+
+if [ "$DROPPED" -ne 0 ] || [ "$PRESSES" -ne "$TAPS" ]; then
+    echo "FAIL"
+    exit 1
+fi
+echo "PASS"
@@ -0,0 +1,179 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Pixel conversion for the picocalc ILI9488 panel
+ * pixconv.c: Scalar reference kernels, rectangle walking and runtime dispatch.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pixconv_impl.h"
+
+#if defined(__arm__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+void pixconv_rgb565_scalar(uint8_t* dst, void const* src, size_t count)
+{
+	uint16_t const* s = src;
+	uint16_t v;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		v = s[i];
+		dst[0] = (v >> 8) & 0xf8;
+		dst[1] = (v >> 3) & 0xfc;
+		dst[2] = (v << 3) & 0xf8;
+		dst += PIXCONV_BYTES_PER_PIXEL;
+	}
+}
+
+void pixconv_xrgb8888_scalar(uint8_t* dst, void const* src, size_t count)
+{
+	uint32_t const* s = src;
+	uint32_t v;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		v = s[i];
+		dst[0] = (v >> 16) & 0xfc;
+		dst[1] = (v >> 8) & 0xfc;
+		dst[2] = v & 0xfc;
+		dst += PIXCONV_BYTES_PER_PIXEL;
+	}
+}
+
+static struct pixconv_impl const pixconv_impl_scalar = {
+	.name = "scalar",
+	.row = {
+		[PIXCONV_RGB565] = pixconv_rgb565_scalar,
+		[PIXCONV_XRGB8888] = pixconv_xrgb8888_scalar,
+	},
+};
+
+// Scalar plus every vector kernel the CPU supports, in rising preference
+static struct pixconv_impl const* pixconv_impls[8];
+
+static void pixconv_probe(void)
+{
+	unsigned int n = 0;
+
+	if (pixconv_impls[0]) {
+		return;
+	}
+
+#if defined(PIXCONV_HAVE_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("ssse3")) {
+		pixconv_impls[++n] = &pixconv_impl_ssse3;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		pixconv_impls[++n] = &pixconv_impl_avx2;
+	}
+#elif defined(__aarch64__)
+	pixconv_impls[++n] = &pixconv_impl_neon;
+#elif defined(PIXCONV_HAVE_NEON)
+	if (getauxval(AT_HWCAP) & HWCAP_NEON) {
+		pixconv_impls[++n] = &pixconv_impl_neon;
+	}
+#endif
+	(void)n;
+
+	// Published last, the list is complete once this is set
+	__atomic_store_n(&pixconv_impls[0], &pixconv_impl_scalar, __ATOMIC_RELEASE);
+}
+
+struct pixconv_impl const* const* pixconv_available(void)
+{
+	if (!__atomic_load_n(&pixconv_impls[0], __ATOMIC_ACQUIRE)) {
+		pixconv_probe();
+	}
+	return pixconv_impls;
+}
+
+struct pixconv_impl const* pixconv_find(char const* name)
+{
+	struct pixconv_impl const* const* impl;
+
+	for (impl = pixconv_available(); *impl; impl++) {
+		if (!strcmp((*impl)->name, name)) {
+			return *impl;
+		}
+	}
+	return NULL;
+}
+
+static struct pixconv_impl const* pixconv_current;
+
+int pixconv_select(char const* name)
+{
+	struct pixconv_impl const* impl = pixconv_find(name);
+
+	if (!impl) {
+		return -1;
+	}
+	__atomic_store_n(&pixconv_current, impl, __ATOMIC_RELEASE);
+	return 0;
+}
+
+struct pixconv_impl const* pixconv_active(void)
+{
+	struct pixconv_impl const* const* impls;
+	struct pixconv_impl const* impl;
+	char const* name;
+	unsigned int n;
+
+	impl = __atomic_load_n(&pixconv_current, __ATOMIC_ACQUIRE);
+	if (impl) {
+		return impl;
+	}
+
+	// Environment override first, otherwise the most capable kernel
+	name = getenv("PIXCONV_IMPL");
+	impl = name ? pixconv_find(name) : NULL;
+	if (!impl) {
+		impls = pixconv_available();
+		for (n = 0; impls[n + 1]; n++) {
+		}
+		impl = impls[n];
+	}
+
+	__atomic_store_n(&pixconv_current, impl, __ATOMIC_RELEASE);
+	return impl;
+}
+
+void pixconv_convert_with(struct pixconv_impl const* impl, enum pixconv_format format,
+	uint8_t* dst, size_t dst_stride, void const* src, size_t src_stride,
+	struct pixconv_rect const* rect)
+{
+	pixconv_row_fn row = impl->row[format];
+	uint8_t const* s;
+	unsigned int y;
+
+	if (!dst_stride) {
+		dst_stride = (size_t)rect->width * PIXCONV_BYTES_PER_PIXEL;
+	}
+	s = (uint8_t const*)src + (size_t)rect->y * src_stride
+		+ (size_t)rect->x * pixconv_format_bpp(format);
+
+	// Packed rows on both sides convert as one long row
+	if ((dst_stride == (size_t)rect->width * PIXCONV_BYTES_PER_PIXEL)
+	 && (src_stride == (size_t)rect->width * pixconv_format_bpp(format))) {
+		row(dst, s, (size_t)rect->width * rect->height);
+		return;
+	}
+
+	for (y = 0; y < rect->height; y++) {
+		row(dst, s, rect->width);
+		dst += dst_stride;
+		s += src_stride;
+	}
+}
+
+void pixconv_convert(enum pixconv_format format, uint8_t* dst, size_t dst_stride,
+	void const* src, size_t src_stride, struct pixconv_rect const* rect)
+{
+	pixconv_convert_with(pixconv_active(), format, dst, dst_stride, src,
+		src_stride, rect);
+}
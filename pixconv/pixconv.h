@@ -0,0 +1,81 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Pixel conversion for the picocalc ILI9488 panel
+ * pixconv.h: RGB565 and XRGB8888 to the packed RGB666 the panel takes over SPI.
+ *
+ * Each output pixel is three bytes R, G, B with the colour in the top six bits
+ * and the low two bits clear. Scalar, SSSE3, AVX2 and NEON kernels give
+ * bit-identical output, the fastest one the CPU supports is picked on first
+ * use. Setting PIXCONV_IMPL=<name> in the environment overrides the choice.
+ */
+
+#ifndef PIXCONV_H_
+#define PIXCONV_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PIXCONV_BYTES_PER_PIXEL	3
+
+enum pixconv_format
+{
+	PIXCONV_RGB565 = 0,
+	PIXCONV_XRGB8888,
+	PIXCONV_FORMATS,
+};
+
+// Subrectangle of a source buffer, in pixels
+struct pixconv_rect
+{
+	unsigned int x;
+	unsigned int y;
+	unsigned int width;
+	unsigned int height;
+};
+
+// Row kernel, converts count pixels
+typedef void (*pixconv_row_fn)(uint8_t* dst, void const* src, size_t count);
+
+struct pixconv_impl
+{
+	char const* name;
+	pixconv_row_fn row[PIXCONV_FORMATS];
+};
+
+// Bytes per source pixel
+static inline unsigned int pixconv_format_bpp(enum pixconv_format format)
+{
+	return (format == PIXCONV_RGB565) ? 2 : 4;
+}
+
+// Convert rect of src, whose rows are src_stride bytes apart, to dst. Output
+// rows are dst_stride bytes apart, 0 packs them at width * 3
+void pixconv_convert(enum pixconv_format format, uint8_t* dst, size_t dst_stride,
+	void const* src, size_t src_stride, struct pixconv_rect const* rect);
+
+// Same with an explicit implementation, for benchmarks and cross-checks
+void pixconv_convert_with(struct pixconv_impl const* impl, enum pixconv_format format,
+	uint8_t* dst, size_t dst_stride, void const* src, size_t src_stride,
+	struct pixconv_rect const* rect);
+
+// Implementation in use, picked on first call
+struct pixconv_impl const* pixconv_active(void);
+
+// Implementations this CPU can run, scalar first, NULL terminated
+struct pixconv_impl const* const* pixconv_available(void);
+
+// Implementation by name, NULL if unknown or not supported here
+struct pixconv_impl const* pixconv_find(char const* name);
+
+// Force an implementation, returns -1 if it is unknown or not supported here
+int pixconv_select(char const* name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Pixel conversion for the picocalc ILI9488 panel
+ * pixconv_avx2.c: AVX2 kernels, built with -mavx2 and only called when the
+ * CPU reports it.
+ */
+
+#include "pixconv_impl.h"
+
+#if defined(PIXCONV_HAVE_X86)
+
+#include <immintrin.h>
+
+// 8 XRGB8888 pixels become 24 bytes (16 + 8 byte stores)
+static void pixconv_xrgb8888_avx2(uint8_t* dst, void const* src, size_t count)
+{
+	uint8_t const* s = src;
+	__m256i const shuf = _mm256_setr_epi8(
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	__m256i const pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+	__m256i const mask = _mm256_set1_epi8((char)0xfc);
+	__m256i v;
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		v = _mm256_loadu_si256((__m256i const*)s);
+
+		// 12 bytes per lane, then the two lanes joined into the low 24 bytes
+		v = _mm256_shuffle_epi8(v, shuf);
+		v = _mm256_and_si256(_mm256_permutevar8x32_epi32(v, pack), mask);
+
+		_mm_storeu_si128((__m128i*)dst, _mm256_castsi256_si128(v));
+		_mm_storel_epi64((__m128i*)(dst + 16), _mm256_extracti128_si256(v, 1));
+
+		s += 32;
+		dst += 24;
+	}
+
+	pixconv_xrgb8888_scalar(dst, s, count - i);
+}
+
+// 16 RGB565 pixels become 48 bytes (32 + 16 byte stores)
+static void pixconv_rgb565_avx2(uint8_t* dst, void const* src, size_t count)
+{
+	uint8_t const* s = src;
+	__m256i const rg_lo = _mm256_setr_epi8(
+		0, 1, -1, 2, 3, -1, 4, 5, -1, 6, 7, -1, 8, 9, -1, 10,
+		0, 1, -1, 2, 3, -1, 4, 5, -1, 6, 7, -1, 8, 9, -1, 10);
+	__m256i const b_lo = _mm256_setr_epi8(
+		-1, -1, 0, -1, -1, 2, -1, -1, 4, -1, -1, 6, -1, -1, 8, -1,
+		-1, -1, 0, -1, -1, 2, -1, -1, 4, -1, -1, 6, -1, -1, 8, -1);
+	__m256i const rg_hi = _mm256_setr_epi8(
+		11, -1, 12, 13, -1, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		11, -1, 12, 13, -1, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	__m256i const b_hi = _mm256_setr_epi8(
+		-1, 10, -1, -1, 12, -1, -1, 14, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, 10, -1, -1, 12, -1, -1, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+	__m256i const mask_rb = _mm256_set1_epi16(0xf8);
+	__m256i const mask_g = _mm256_set1_epi16(0xfc);
+	__m256i v, rg, b, lo, hi;
+	size_t i;
+
+	for (i = 0; i + 16 <= count; i += 16) {
+		v = _mm256_loadu_si256((__m256i const*)s);
+
+		// Per 16 bit lane: R in the low byte, G in the high byte, B alone
+		rg = _mm256_or_si256(
+			_mm256_and_si256(_mm256_srli_epi16(v, 8), mask_rb),
+			_mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(v, 3), mask_g), 8));
+		b = _mm256_and_si256(_mm256_slli_epi16(v, 3), mask_rb);
+
+		// Per 128 bit lane: 16 output bytes in lo, the next 8 in the low half of hi
+		lo = _mm256_or_si256(_mm256_shuffle_epi8(rg, rg_lo), _mm256_shuffle_epi8(b, b_lo));
+		hi = _mm256_or_si256(_mm256_shuffle_epi8(rg, rg_hi), _mm256_shuffle_epi8(b, b_hi));
+
+		// Quadwords lo0 lo1 hi0 lo2, then lo3 hi2
+		_mm256_storeu_si256((__m256i*)dst, _mm256_blend_epi32(
+			_mm256_permute4x64_epi64(lo, _MM_SHUFFLE(2, 2, 1, 0)),
+			_mm256_permute4x64_epi64(hi, _MM_SHUFFLE(0, 0, 0, 0)), 0x30));
+		_mm_storeu_si128((__m128i*)(dst + 32), _mm_alignr_epi8(
+			_mm256_extracti128_si256(hi, 1), _mm256_extracti128_si256(lo, 1), 8));
+
+		s += 32;
+		dst += 48;
+	}
+
+	pixconv_rgb565_scalar(dst, s, count - i);
+}
+
+struct pixconv_impl const pixconv_impl_avx2 = {
+	.name = "avx2",
+	.row = {
+		[PIXCONV_RGB565] = pixconv_rgb565_avx2,
+		[PIXCONV_XRGB8888] = pixconv_xrgb8888_avx2,
+	},
+};
+
+#endif
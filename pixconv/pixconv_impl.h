@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Pixel conversion for the picocalc ILI9488 panel
+ * pixconv_impl.h: Kernels shared between the per-ISA translation units.
+ */
+
+#ifndef PIXCONV_IMPL_H_
+#define PIXCONV_IMPL_H_
+
+#include "pixconv.h"
+
+// Portable reference, also used for the tails of the vector kernels
+void pixconv_rgb565_scalar(uint8_t* dst, void const* src, size_t count);
+void pixconv_xrgb8888_scalar(uint8_t* dst, void const* src, size_t count);
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PIXCONV_HAVE_X86 1
+extern struct pixconv_impl const pixconv_impl_ssse3;
+extern struct pixconv_impl const pixconv_impl_avx2;
+#endif
+
+// 32 bit ARM builds get PIXCONV_ARM_NEON from the Makefile once the compiler
+// takes the armv7-a NEON flags
+#if defined(__aarch64__) || (defined(__arm__) && defined(PIXCONV_ARM_NEON))
+#define PIXCONV_HAVE_NEON 1
+extern struct pixconv_impl const pixconv_impl_neon;
+#endif
+
+#endif
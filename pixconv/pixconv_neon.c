@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Pixel conversion for the picocalc ILI9488 panel
+ * pixconv_neon.c: NEON kernels for the Cortex-A53. Always present on aarch64,
+ * checked through AT_HWCAP on 32 bit ARM where this file needs the armv7-a
+ * NEON flags from the Makefile and is left empty without them.
+ */
+
+#include "pixconv_impl.h"
+
+#if defined(PIXCONV_HAVE_NEON)
+
+#include <arm_neon.h>
+
+// 16 XRGB8888 pixels, deinterleaved on load and reinterleaved on store
+static void pixconv_xrgb8888_neon(uint8_t* dst, void const* src, size_t count)
+{
+	uint8_t const* s = src;
+	uint8x16_t const mask = vdupq_n_u8(0xfc);
+	uint8x16x4_t v;
+	uint8x16x3_t o;
+	size_t i;
+
+	for (i = 0; i + 16 <= count; i += 16) {
+
+		// Little endian XRGB8888 is B, G, R, X in memory
+		v = vld4q_u8(s);
+		o.val[0] = vandq_u8(v.val[2], mask);
+		o.val[1] = vandq_u8(v.val[1], mask);
+		o.val[2] = vandq_u8(v.val[0], mask);
+		vst3q_u8(dst, o);
+
+		s += 64;
+		dst += 48;
+	}
+
+	pixconv_xrgb8888_scalar(dst, s, count - i);
+}
+
+// 16 RGB565 pixels, channels narrowed out of two 8 lane vectors
+static void pixconv_rgb565_neon(uint8_t* dst, void const* src, size_t count)
+{
+	uint16_t const* s = src;
+	uint16x8_t lo, hi;
+	uint8x16x3_t o;
+	size_t i;
+
+	for (i = 0; i + 16 <= count; i += 16) {
+		lo = vld1q_u16(s);
+		hi = vld1q_u16(s + 8);
+
+		o.val[0] = vandq_u8(vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8)),
+			vdupq_n_u8(0xf8));
+		o.val[1] = vandq_u8(vcombine_u8(vshrn_n_u16(lo, 3), vshrn_n_u16(hi, 3)),
+			vdupq_n_u8(0xfc));
+		o.val[2] = vshlq_n_u8(vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)), 3);
+		vst3q_u8(dst, o);
+
+		s += 16;
+		dst += 48;
+	}
+
+	pixconv_rgb565_scalar(dst, s, count - i);
+}
+
+struct pixconv_impl const pixconv_impl_neon = {
+	.name = "neon",
+	.row = {
+		[PIXCONV_RGB565] = pixconv_rgb565_neon,
+		[PIXCONV_XRGB8888] = pixconv_xrgb8888_neon,
+	},
+};
+
+#endif
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Pixel conversion for the picocalc ILI9488 panel
+ * pixconv_sse.c: SSSE3 kernels, built with -mssse3 and only called when the
+ * CPU reports it.
+ */
+
+#include "pixconv_impl.h"
+
+#if defined(PIXCONV_HAVE_X86)
+
+#include <tmmintrin.h>
+
+// 16 XRGB8888 pixels (4 loads) become exactly 48 bytes (3 stores)
+static void pixconv_xrgb8888_ssse3(uint8_t* dst, void const* src, size_t count)
+{
+	uint8_t const* s = src;
+	__m128i const shuf = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+		-1, -1, -1, -1);
+	__m128i const mask = _mm_set1_epi8((char)0xfc);
+	__m128i s0, s1, s2, s3;
+	size_t i;
+
+	for (i = 0; i + 16 <= count; i += 16) {
+
+		// Each to R, G, B in the low 12 bytes, top 4 zero
+		s0 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const*)(s + 0)), shuf);
+		s1 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const*)(s + 16)), shuf);
+		s2 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const*)(s + 32)), shuf);
+		s3 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const*)(s + 48)), shuf);
+
+		_mm_storeu_si128((__m128i*)(dst + 0), _mm_and_si128(mask,
+			_mm_or_si128(s0, _mm_slli_si128(s1, 12))));
+		_mm_storeu_si128((__m128i*)(dst + 16), _mm_and_si128(mask,
+			_mm_or_si128(_mm_srli_si128(s1, 4), _mm_slli_si128(s2, 8))));
+		_mm_storeu_si128((__m128i*)(dst + 32), _mm_and_si128(mask,
+			_mm_or_si128(_mm_srli_si128(s2, 8), _mm_slli_si128(s3, 4))));
+
+		s += 64;
+		dst += 48;
+	}
+
+	pixconv_xrgb8888_scalar(dst, s, count - i);
+}
+
+// 8 RGB565 pixels become 24 bytes (16 + 8 byte stores)
+static void pixconv_rgb565_ssse3(uint8_t* dst, void const* src, size_t count)
+{
+	uint8_t const* s = src;
+	__m128i const rg_lo = _mm_setr_epi8(0, 1, -1, 2, 3, -1, 4, 5, -1, 6, 7, -1,
+		8, 9, -1, 10);
+	__m128i const b_lo = _mm_setr_epi8(-1, -1, 0, -1, -1, 2, -1, -1, 4, -1, -1, 6,
+		-1, -1, 8, -1);
+	__m128i const rg_hi = _mm_setr_epi8(11, -1, 12, 13, -1, 14, 15, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1);
+	__m128i const b_hi = _mm_setr_epi8(-1, 10, -1, -1, 12, -1, -1, 14,
+		-1, -1, -1, -1, -1, -1, -1, -1);
+	__m128i const mask_rb = _mm_set1_epi16(0xf8);
+	__m128i const mask_g = _mm_set1_epi16(0xfc);
+	__m128i v, rg, b;
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		v = _mm_loadu_si128((__m128i const*)s);
+
+		// Per 16 bit lane: R in the low byte, G in the high byte, B alone
+		rg = _mm_or_si128(
+			_mm_and_si128(_mm_srli_epi16(v, 8), mask_rb),
+			_mm_slli_epi16(_mm_and_si128(_mm_srli_epi16(v, 3), mask_g), 8));
+		b = _mm_and_si128(_mm_slli_epi16(v, 3), mask_rb);
+
+		_mm_storeu_si128((__m128i*)dst, _mm_or_si128(
+			_mm_shuffle_epi8(rg, rg_lo), _mm_shuffle_epi8(b, b_lo)));
+		_mm_storel_epi64((__m128i*)(dst + 16), _mm_or_si128(
+			_mm_shuffle_epi8(rg, rg_hi), _mm_shuffle_epi8(b, b_hi)));
+
+		s += 16;
+		dst += 24;
+	}
+
+	pixconv_rgb565_scalar(dst, s, count - i);
+}
+
+struct pixconv_impl const pixconv_impl_ssse3 = {
+	.name = "ssse3",
+	.row = {
+		[PIXCONV_RGB565] = pixconv_rgb565_ssse3,
+		[PIXCONV_XRGB8888] = pixconv_xrgb8888_ssse3,
+	},
+};
+
+#endif
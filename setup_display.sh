@@ -37,22 +37,15 @@ echo "Starting TFT setup..."
 # Update system and install dependencies
 echo "Updating the system and installing dependencies..."
 apt update && apt upgrade -y
-apt install -y cmake git build-essential nano
+apt install -y git build-essential nano
 
-# Configure fbcp-ili9341
-echo "Downloading and configuring fbcp-ili9341..."
-if [ ! -d "fbcp-ili9341-picocalc" ]; then
-    git clone https://github.com/wasdwasd0105/fbcp-ili9341-picocalc.git
-fi
-cd fbcp-ili9341-picocalc
-mkdir -p build
-cd build
-rm -rf *
-cmake -DUSE_GPU=ON -DSPI_BUS_CLOCK_DIVISOR=12 \
-      -DGPIO_TFT_DATA_CONTROL=24 -DGPIO_TFT_RESET_PIN=25 \
-      -DILI9488=ON -DUSE_DMA_TRANSFERS=ON -DDMA_TX_CHANNEL=10 -DDMA_RX_CHANNEL=11 -DSTATISTICS=0 ..
-make -j$(nproc)
-sudo install fbcp-ili9341 /usr/local/bin/
+# Build the framebuffer mirror from this repository. Its tuning is on the
+# command line, see picocalc_fbmirror --help
+FBMIRROR_ARGS="--spi-hz 32000000 --dc-gpio 24 --reset-gpio 25"
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+echo "Building picocalc_fbmirror..."
+make -C "$SCRIPT_DIR/picocalc_fbmirror" -j$(nproc)
+make -C "$SCRIPT_DIR/picocalc_fbmirror" install
 
 # Prompt before modifying config.txt
 echo
@@ -109,10 +102,13 @@ sed -i "s|^dtoverlay=vc4-kms-v3d|#dtoverlay=vc4-kms-v3d (line commented for TFT
 
 sudo sed -i '/^\[pi4\]/s/^/#/' "$CONFIG_FILE"
 
+# Drop spi0-0cs left over from fbcp-ili9341 installs, picocalc_fbmirror
+# needs the chip select and /dev/spidev0.0 it takes away
+sed -i '/^dtoverlay=spi0-0cs/d' "$CONFIG_FILE"
+
 
 # Add required configuration lines
 echo "#Modifications for ILI9488 installation implemented by the script on $(date +%m/%d/%Y)" >> "$CONFIG_FILE"
-update_config "dtoverlay" "spi0-0cs"
 update_config "dtparam" "spi=on"
 update_config "hdmi_force_hotplug" "1"
 update_config "hdmi_cvt" "320 320 60 1 0 0 0"
@@ -127,19 +123,10 @@ echo "# Feel free to send feedback and suggestions." >> "$CONFIG_FILE"
 echo "Removing duplicate lines in config.txt..."
 remove_duplicates "$CONFIG_FILE"
 
-# Configure sudoers for fbcp-ili9341
-echo "Setting permissions in sudoers..."
-VISUDO_FILE="/etc/sudoers.d/fbcp-ili9341"
-if [ ! -f "$VISUDO_FILE" ]; then
-    echo "ALL ALL=(ALL) NOPASSWD: /usr/local/bin/fbcp-ili9341" > "$VISUDO_FILE"
-    chmod 440 "$VISUDO_FILE"
-fi
-
-# Set binary permissions
-echo "Configuring permissions for fbcp-ili9341..."
-chmod u+s /usr/local/bin/fbcp-ili9341
+# picocalc_fbmirror runs as root from rc.local, it is neither setuid nor in sudoers
+rm -f /etc/sudoers.d/fbcp-ili9341
 
-# Configure rc.local to start fbcp-ili9341
+# Configure rc.local to start picocalc_fbmirror
 echo "Configuring /etc/rc.local..."
 RC_LOCAL="/etc/rc.local"
 if [ ! -f "$RC_LOCAL" ]; then
@@ -148,15 +135,17 @@ if [ ! -f "$RC_LOCAL" ]; then
 # rc.local
 # This script is executed at the end of each multi-user runlevel.
 
-# Start fbcp-ili9341
-/usr/local/bin/fbcp-ili9341 >> /var/log/fbcp-ili9341.log 2>&1 &
+# Start picocalc_fbmirror
+/usr/local/bin/picocalc_fbmirror $FBMIRROR_ARGS >> /var/log/picocalc_fbmirror.log 2>&1 &
 
 exit 0
 EOT
     chmod +x "$RC_LOCAL"
 else
-    if ! grep -q "fbcp-ili9341" "$RC_LOCAL"; then
-        sed -i '/exit 0/i \\n# Start fbcp-ili9341\n/usr/local/bin/fbcp-ili9341 >> /var/log/fbcp-ili9341.log 2>&1 &' "$RC_LOCAL"
+    # Replace an fbcp-ili9341 start line left by an older version of this script
+    sed -i '/fbcp-ili9341/d' "$RC_LOCAL"
+    if ! grep -q "picocalc_fbmirror" "$RC_LOCAL"; then
+        sed -i "/exit 0/i \\\\n# Start picocalc_fbmirror\\n/usr/local/bin/picocalc_fbmirror $FBMIRROR_ARGS >> /var/log/picocalc_fbmirror.log 2>&1 \\&" "$RC_LOCAL"
     fi
 fi
 
@@ -172,7 +161,7 @@ sudo systemctl start rc-local
 
 # Finish and force reboot
 echo "Finalizing processes..."
-killall -9 fbcp-ili9341 2>/dev/null || true
+killall -9 fbcp-ili9341 picocalc_fbmirror 2>/dev/null || true
 sync
 
 echo -e "\nSetup complete. The Raspberry Pi will now reboot."
@@ -18,15 +18,18 @@ sudo apt install -y \
 echo "🔧 Step 2: Building kernel module in ${SRC_DIR}..."
 make -C /lib/modules/$(uname -r)/build M=$(realpath ${SRC_DIR}) modules
 
-echo "📁 Step 3: Installing kernel module to system..."
+echo "🔧 Step 3: Compiling device tree overlay..."
+dtc -@ -I dts -O dtb -o ${DTBO_DIR}/${DTBO_FILE} ${DTBO_DIR}/${MODULE_NAME}-overlay.dts
+
+echo "📁 Step 4: Installing kernel module to system..."
 sudo mkdir -p /lib/modules/$(uname -r)/extra
 sudo cp ${SRC_DIR}/${KO_FILE} /lib/modules/$(uname -r)/extra/
 sudo depmod
 
-echo "📄 Step 4: Installing DTBO to /boot/overlays/..."
+echo "📄 Step 5: Installing DTBO to /boot/overlays/..."
 sudo cp ${DTBO_DIR}/${DTBO_FILE} /boot/overlays/
 
-echo "📝 Step 5: Updating /boot/config.txt..."
+echo "📝 Step 6: Updating /boot/config.txt..."
 CONFIG=/boot/config.txt
 
 grep -q "^dtoverlay=${MODULE_NAME}" $CONFIG || {